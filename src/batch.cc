@@ -0,0 +1,352 @@
+// Copyright 2017 Neverware
+
+#include "src/batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "src/io.h"
+#include "src/map_cache.h"
+#include "src/png_stream.h"
+#include "src/pool.h"
+#include "src/queue.h"
+#include "src/va_util.h"
+
+namespace vadem {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// One input on its way through the stages, holding whatever the next
+// stage needs
+struct Frame {
+  std::string input;
+  SolidRgbImage rgb;
+  ImageLease image;
+  SurfaceLease surface;
+};
+
+using FramePtr = std::unique_ptr<Frame>;
+using FrameQueue = BoundedQueue<FramePtr>;
+
+std::string base_name(const std::string& path) {
+  const std::size_t slash = path.rfind('/');
+  return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+bool ends_with(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Workers of one stage. Each takes frames with |take| until it returns
+// false, runs |process| on them and pushes them to |out|, if any. The
+// last worker to finish closes |out|.
+class Stage {
+ public:
+  Stage(const std::size_t workers,
+        std::function<bool(FramePtr*)> take,
+        std::function<void(Frame&)> process,
+        FrameQueue* out)
+      : take(std::move(take)),
+        process(std::move(process)),
+        out(out),
+        running(workers),
+        stats() {
+    stats.workers = workers;
+    for (std::size_t i = 0; i < workers; i++) {
+      threads.emplace_back(&Stage::work, this);
+    }
+  }
+
+  ~Stage() { join(); }
+
+  void join() {
+    for (auto& thread : threads) {
+      if (thread.joinable()) {
+        thread.join();
+      }
+    }
+  }
+
+  // Valid once joined
+  const BatchStageStats& result() const { return stats; }
+
+ private:
+  void work() {
+    std::size_t frames = 0, errors = 0;
+    Clock::duration busy(0);
+
+    FramePtr frame;
+    while (take(&frame)) {
+      const Clock::time_point start = Clock::now();
+      bool ok = true;
+      try {
+        process(*frame);
+      } catch (const std::exception& e) {
+        // One write, so lines from different workers don't interleave
+        std::ostringstream message;
+        message << frame->input << ": " << e.what() << "\n";
+        std::cerr << message.str() << std::flush;
+        ok = false;
+      }
+      busy += Clock::now() - start;
+      if (!ok) {
+        errors++;
+        frame.reset();
+        continue;
+      }
+      frames++;
+      if (out) {
+        out->push(std::move(frame));
+      } else {
+        frame.reset();
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.frames += frames;
+    stats.errors += errors;
+    stats.busy_seconds += std::chrono::duration<double>(busy).count();
+    if (--running == 0 && out) {
+      out->close();
+    }
+  }
+
+  const std::function<bool(FramePtr*)> take;
+  const std::function<void(Frame&)> process;
+  FrameQueue* const out;
+  std::mutex mutex;
+  std::size_t running;
+  BatchStageStats stats;
+  std::vector<std::thread> threads;
+};
+
+BatchQueueStats queue_stats(const FrameQueue& queue) {
+  const FrameQueue::Stats stats = queue.stats();
+  return {stats.capacity, stats.mean_occupancy, stats.peak_occupancy,
+          stats.full_waits, stats.empty_waits};
+}
+
+}  // namespace
+
+const char* batch_stage_name(const BatchStage stage) {
+  switch (stage) {
+    case BatchStage::kDecode:
+      return "decode";
+    case BatchStage::kConvert:
+      return "convert";
+    case BatchStage::kUpload:
+      return "upload";
+    case BatchStage::kReadback:
+      return "readback";
+    case BatchStage::kEncode:
+      return "encode";
+  }
+  return "unknown";
+}
+
+BatchOptions batch_default_options() {
+  BatchOptions options;
+  options.output_dir = "batch_output";
+  options.workers[static_cast<int>(BatchStage::kDecode)] = 2;
+  options.workers[static_cast<int>(BatchStage::kConvert)] = 2;
+  options.workers[static_cast<int>(BatchStage::kUpload)] = 1;
+  options.workers[static_cast<int>(BatchStage::kReadback)] = 1;
+  options.workers[static_cast<int>(BatchStage::kEncode)] = 2;
+  options.queue_capacity = 8;
+  options.pool_bytes = 512 << 20;
+  return options;
+}
+
+std::vector<std::string> batch_list_inputs(const std::string& path) {
+  std::vector<std::string> inputs;
+
+  DIR* const dir = opendir(path.c_str());
+  if (dir) {
+    while (const dirent* const entry = readdir(dir)) {
+      const std::string name = entry->d_name;
+      if (ends_with(name, ".png")) {
+        inputs.push_back(path + "/" + name);
+      }
+    }
+    closedir(dir);
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
+  }
+
+  std::ifstream list(path);
+  if (!list) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  std::string line;
+  while (std::getline(list, line)) {
+    if (!line.empty()) {
+      inputs.push_back(line);
+    }
+  }
+  return inputs;
+}
+
+BatchStats batch_run(VADisplay display, const BatchOptions& options) {
+  if (mkdir(options.output_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw std::runtime_error("failed to create " + options.output_dir + ": " +
+                             strerror(errno));
+  }
+  for (const std::size_t workers : options.workers) {
+    if (workers == 0) {
+      throw std::invalid_argument("every batch stage needs a worker");
+    }
+  }
+
+  VaPool pool(display, options.pool_bytes);
+  std::unique_ptr<FrameQueue> queues[kBatchStageCount - 1];
+  for (auto& queue : queues) {
+    queue.reset(new FrameQueue(options.queue_capacity));
+  }
+  auto pop_from = [](FrameQueue* queue) {
+    return [queue](FramePtr* frame) { return queue->pop(frame); };
+  };
+
+  std::atomic<std::size_t> next_input(0);
+  auto take_input = [&](FramePtr* frame) {
+    const std::size_t i = next_input++;
+    if (i >= options.inputs.size()) {
+      return false;
+    }
+    frame->reset(new Frame);
+    (*frame)->input = options.inputs[i];
+    return true;
+  };
+
+  auto decode = [](Frame& frame) { frame.rgb.read(frame.input); };
+
+  auto convert = [&](Frame& frame) {
+    frame.image = pool.acquire_image(VA_FOURCC_NV12, frame.rgb.get_width(),
+                                     frame.rgb.get_height());
+    va_image_copy_from_png(display, *frame.image, frame.rgb);
+    frame.rgb = SolidRgbImage();
+  };
+
+  auto upload = [&](Frame& frame) {
+    const VAImage& image = *frame.image;
+    frame.surface =
+        pool.acquire_surface(VA_FOURCC_NV12, image.width, image.height);
+    buffer_map_invalidate(display, image.buf);
+    check_status(vaPutImage(display, frame.surface->id, image.image_id, 0, 0,
+                            image.width, image.height, 0, 0, image.width,
+                            image.height));
+    check_status(vaSyncSurface(display, frame.surface->id));
+    frame.image.reset();
+  };
+
+  auto readback = [&](Frame& frame) {
+    const PooledSurface& surface = *frame.surface;
+    frame.image =
+        pool.acquire_image(VA_FOURCC_NV12, surface.width, surface.height);
+    buffer_map_invalidate(display, frame.image->buf);
+    check_status(vaGetImage(display, surface.id, 0, 0, surface.width,
+                            surface.height, frame.image->image_id));
+    frame.surface.reset();
+  };
+
+  auto encode = [&](Frame& frame) {
+    const std::string filename =
+        options.output_dir + "/" + base_name(frame.input);
+    std::ofstream stream(filename, std::ios::binary);
+    if (!stream) {
+      throw std::runtime_error("failed to open " + filename);
+    }
+    Nv12DownloadGenerator<> generator(display, *frame.image);
+    generator.write(stream);
+    frame.image.reset();
+  };
+
+  BatchStats stats;
+  const Clock::time_point start = Clock::now();
+  {
+    // Destroyed, and so joined, last stage first
+    Stage stages[] = {
+        {options.workers[0], take_input, decode, queues[0].get()},
+        {options.workers[1], pop_from(queues[0].get()), convert,
+         queues[1].get()},
+        {options.workers[2], pop_from(queues[1].get()), upload,
+         queues[2].get()},
+        {options.workers[3], pop_from(queues[2].get()), readback,
+         queues[3].get()},
+        {options.workers[4], pop_from(queues[3].get()), encode, nullptr},
+    };
+    for (std::size_t i = 0; i < kBatchStageCount; i++) {
+      stages[i].join();
+      stats.stages[i] = stages[i].result();
+    }
+  }
+  stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  for (std::size_t i = 0; i + 1 < kBatchStageCount; i++) {
+    stats.queues[i] = queue_stats(*queues[i]);
+  }
+  return stats;
+}
+
+void batch_print_stats(std::ostream& out, const BatchStats& stats) {
+  const std::size_t frames = stats.stages[kBatchStageCount - 1].frames;
+  out << frames << " frames in " << std::fixed << std::setprecision(2)
+      << stats.seconds << " s, "
+      << (stats.seconds > 0 ? frames / stats.seconds : 0.0) << " frames/s"
+      << std::endl;
+
+  // Per worker, so the stage with the lowest rate times its workers is
+  // the one holding the rest up
+  out << std::left << std::setw(10) << "stage" << std::right << std::setw(8)
+      << "workers" << std::setw(8) << "frames" << std::setw(8) << "errors"
+      << std::setw(14) << "frames/s/wkr" << std::setw(8) << "busy%"
+      << std::endl;
+  for (std::size_t i = 0; i < kBatchStageCount; i++) {
+    const BatchStageStats& stage = stats.stages[i];
+    const std::size_t done = stage.frames + stage.errors;
+    const double busy_share =
+        (stats.seconds > 0)
+            ? stage.busy_seconds / (stats.seconds * stage.workers)
+            : 0.0;
+    out << std::left << std::setw(10)
+        << batch_stage_name(static_cast<BatchStage>(i)) << std::right
+        << std::setw(8) << stage.workers << std::setw(8) << stage.frames
+        << std::setw(8) << stage.errors << std::setw(14)
+        << (stage.busy_seconds > 0 ? done / stage.busy_seconds : 0.0)
+        << std::setw(8) << busy_share * 100 << std::endl;
+  }
+
+  out << std::left << std::setw(20) << "queue" << std::right << std::setw(10)
+      << "capacity" << std::setw(8) << "mean" << std::setw(8) << "peak"
+      << std::setw(12) << "full_waits" << std::setw(12) << "empty_waits"
+      << std::endl;
+  for (std::size_t i = 0; i + 1 < kBatchStageCount; i++) {
+    const BatchQueueStats& queue = stats.queues[i];
+    const std::string name =
+        std::string(batch_stage_name(static_cast<BatchStage>(i))) + "->" +
+        batch_stage_name(static_cast<BatchStage>(i + 1));
+    out << std::left << std::setw(20) << name << std::right << std::setw(10)
+        << queue.capacity << std::setw(8) << queue.mean_occupancy
+        << std::setw(8) << queue.peak_occupancy << std::setw(12)
+        << queue.full_waits << std::setw(12) << queue.empty_waits
+        << std::endl;
+  }
+}
+}
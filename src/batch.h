@@ -0,0 +1,82 @@
+// Copyright 2017 Neverware
+
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <va/va.h>
+
+namespace vadem {
+
+// Stages of a batch run, in order
+enum class BatchStage { kDecode, kConvert, kUpload, kReadback, kEncode };
+
+const std::size_t kBatchStageCount = 5;
+
+const char* batch_stage_name(BatchStage stage);
+
+struct BatchOptions {
+  // PNG files to process, see batch_list_inputs()
+  std::vector<std::string> inputs;
+  // Where the round-tripped PNGs go, under their input file names.
+  // Created if missing.
+  std::string output_dir;
+  // Threads per stage, indexed by BatchStage
+  std::size_t workers[kBatchStageCount];
+  // Frames each queue between two stages holds, rounded up to a power of
+  // two
+  std::size_t queue_capacity;
+  // Ceiling for the VaPool images and surfaces are recycled through
+  std::size_t pool_bytes;
+};
+
+// Defaults: two decode, convert and encode workers, one each for upload
+// and readback, queues of 8 and a 512 MiB pool
+BatchOptions batch_default_options();
+
+struct BatchStageStats {
+  std::size_t workers;
+  // Frames passed on, and frames dropped because the stage failed on them
+  std::size_t frames;
+  std::size_t errors;
+  // Time the workers spent on frames, summed over workers
+  double busy_seconds;
+};
+
+struct BatchQueueStats {
+  std::size_t capacity;
+  double mean_occupancy;
+  std::size_t peak_occupancy;
+  std::size_t full_waits;
+  std::size_t empty_waits;
+};
+
+struct BatchStats {
+  double seconds;
+  BatchStageStats stages[kBatchStageCount];
+  // queues[i] feeds stage i + 1
+  BatchQueueStats queues[kBatchStageCount - 1];
+};
+
+// |path|'s *.png files in name order if it's a directory, otherwise the
+// lines of the file list at |path|, skipping blank ones
+std::vector<std::string> batch_list_inputs(const std::string& path);
+
+// Round-trip every input through |display|: decode the PNG, convert it to
+// an NV12 image, vaPutImage() it into a surface, vaGetImage() it back and
+// encode it as a PNG again. Each step is a stage with its own workers,
+// passing frames on through a bounded lock-free queue, so the slowest
+// stage sets the pace while the rest overlap with it. Frames a stage
+// fails on are reported to stderr and dropped. Images and surfaces are
+// recycled through a VaPool.
+BatchStats batch_run(VADisplay display, const BatchOptions& options);
+
+// Per-stage throughput and per-queue occupancy as a table
+void batch_print_stats(std::ostream& out, const BatchStats& stats);
+}
+
+#endif  // BATCH_H_
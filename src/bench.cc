@@ -0,0 +1,743 @@
+// Copyright 2017 Neverware
+
+// Times the conversion and I/O paths over a range of image sizes and
+// settings and prints the results as JSON:
+//
+//   vadem_bench [--sizes=256,1080p,4k,8k] [--filter=SUBSTRING]
+//               [--min-time=SECONDS] [--pitch-align=N]
+//               [--map-latency-us=N]
+//
+// Each benchmark runs until --min-time has passed, after one untimed
+// warm-up run. Results are reported per run as MPixel/s, GB/s (of the
+// bytes a run reads plus writes, as counted by each benchmark) and
+// ns/pixel, along with the settings in effect. Settings are varied one at
+// a time from the defaults rather than in every combination. Each result
+// is also logged to stderr as it comes in.
+//
+// --pitch-align and --map-latency-us configure the software VA backend
+// and are only accepted when built with it.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <va/va.h>
+#include <va/va_drm.h>
+
+#include "png.hpp"
+#include "src/color.h"
+#include "src/convert.h"
+#include "src/dmabuf.h"
+#include "src/io.h"
+#include "src/map_cache.h"
+#include "src/nv12.h"
+#include "src/parallel.h"
+#include "src/pipeline.h"
+#include "src/pool.h"
+#include "src/raw.h"
+#include "src/staging.h"
+#include "src/util.h"
+#include "src/va_util.h"
+#include "src/y4m.h"
+
+#ifdef VADEM_SOFT_VA
+#include "src/soft_va.h"
+#endif
+
+using namespace vadem;
+
+namespace {
+
+using Params = std::vector<std::pair<std::string, std::string>>;
+
+struct Size {
+  std::string name;
+  std::size_t width, height;
+};
+
+const Size kSizes[] = {
+    {"256", 256, 256},
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+    {"8k", 7680, 4320},
+};
+
+// Global settings a benchmark runs under
+struct Settings {
+  SimdLevel simd;
+  std::size_t threads;
+  WriteMode write;
+  ReadMode read;
+
+  void apply() const {
+    simd_level_set(simd);
+    thread_count_set(threads);
+    write_mode_set(write);
+    read_mode_set(read);
+  }
+
+  Params params() const {
+    return {{"simd", simd_level_name(simd)},
+            {"threads", std::to_string(threads)},
+            {"write_mode", write_mode_name(write)},
+            {"read_mode", read_mode_name(read)}};
+  }
+};
+
+// Captured on first use, before any benchmark changes the thread count
+Settings default_settings() {
+  static const std::size_t threads = thread_count();
+  return {simd_level_detect(), threads, WriteMode::kStaged,
+          ReadMode::kStreaming};
+}
+
+// The defaults, then each SIMD level, thread count and read or write
+// mode on its own
+std::vector<Settings> settings_sweep(const bool writes, const bool reads) {
+  const Settings defaults = default_settings();
+  std::vector<Settings> sweep{defaults};
+
+  for (int level = 0; level <= static_cast<int>(defaults.simd); level++) {
+    if (level != static_cast<int>(defaults.simd)) {
+      Settings settings = defaults;
+      settings.simd = static_cast<SimdLevel>(level);
+      sweep.push_back(settings);
+    }
+  }
+  for (const std::size_t threads : {1, 2, 4, 8, 16}) {
+    if (threads != defaults.threads) {
+      Settings settings = defaults;
+      settings.threads = threads;
+      sweep.push_back(settings);
+    }
+  }
+  if (writes) {
+    for (const WriteMode mode : {WriteMode::kDirect, WriteMode::kStreaming}) {
+      Settings settings = defaults;
+      settings.write = mode;
+      sweep.push_back(settings);
+    }
+  }
+  if (reads) {
+    for (const ReadMode mode : {ReadMode::kDirect, ReadMode::kBuffered}) {
+      Settings settings = defaults;
+      settings.read = mode;
+      sweep.push_back(settings);
+    }
+  }
+  return sweep;
+}
+
+Params operator+(Params a, const Params& b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+std::string json_string(const std::string& str) {
+  std::string out = "\"";
+  for (const char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out + "\"";
+}
+
+class Bench {
+ public:
+  Bench(const double min_time, const std::string& filter)
+      : min_time(min_time), filter(filter) {}
+
+  // Time |fn|, which processes |pixels| pixels and reads plus writes
+  // |bytes| bytes per call
+  void run(const std::string& name,
+           const Params& params,
+           const std::size_t pixels,
+           const double bytes,
+           const std::function<void()>& fn) {
+    if (name.find(filter) == std::string::npos) {
+      return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    fn();
+    std::size_t iterations = 0;
+    const Clock::time_point start = Clock::now();
+    double seconds = 0;
+    do {
+      fn();
+      iterations++;
+      seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < min_time);
+
+    const double per_call = seconds / iterations;
+    std::ostringstream json;
+    json << "{\"name\": " << json_string(name) << ", \"params\": {";
+    for (std::size_t i = 0; i < params.size(); i++) {
+      json << (i ? ", " : "") << json_string(params[i].first) << ": "
+           << json_string(params[i].second);
+    }
+    json << "}, \"pixels\": " << pixels << ", \"bytes\": " << bytes
+         << ", \"iterations\": " << iterations
+         << ", \"seconds\": " << seconds
+         << ", \"mpixel_per_s\": " << pixels / per_call / 1e6
+         << ", \"gb_per_s\": " << bytes / per_call / 1e9
+         << ", \"ns_per_pixel\": " << per_call * 1e9 / pixels << "}";
+    results.push_back(json.str());
+    std::cerr << results.back() << std::endl;
+  }
+
+  void write_json(std::ostream& out) const {
+    out << "{\"simd_level_detected\": "
+        << json_string(simd_level_name(simd_level_detect()))
+        << ", \"hardware_threads\": " << default_settings().threads
+#ifdef VADEM_SOFT_VA
+        << ", \"va_backend\": \"soft\""
+#else
+        << ", \"va_backend\": \"libva\""
+#endif
+        << ", \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+      out << "  " << results[i] << ((i + 1 < results.size()) ? ",\n" : "\n");
+    }
+    out << "]}" << std::endl;
+  }
+
+ private:
+  const double min_time;
+  const std::string filter;
+  std::vector<std::string> results;
+};
+
+// Smooth gradients with some per-pixel noise, so neither the converters
+// nor the PNG encoder see anything degenerate
+SolidRgbImage make_test_image(const std::size_t width,
+                              const std::size_t height) {
+  SolidRgbImage image(width, height);
+  uint32_t noise = 1;
+  for (std::size_t y = 0; y < height; y++) {
+    for (std::size_t x = 0; x < width; x++) {
+      noise = noise * 1664525 + 1013904223;
+      const int n = (noise >> 28) - 8;
+      const int r = static_cast<int>(x * 255 / width) + n;
+      const int g = static_cast<int>(y * 255 / height) + n;
+      image.set_pixel(x, y, png::rgb_pixel(clamp(r, 0, 255), clamp(g, 0, 255),
+                                           clamp(128 + n * 4, 0, 255)));
+    }
+  }
+  return image;
+}
+
+// Keeps results the compiler could otherwise discard
+volatile unsigned sink;
+
+// "NV12" for VA_FOURCC_NV12 and so on
+std::string fourcc_str(const uint32_t fourcc) {
+  const char chars[] = {static_cast<char>(fourcc),
+                        static_cast<char>(fourcc >> 8),
+                        static_cast<char>(fourcc >> 16),
+                        static_cast<char>(fourcc >> 24)};
+  return std::string(chars, sizeof(chars));
+}
+
+// Name of a new empty file under $TMPDIR, or empty if it can't be
+// created. The caller unlinks it.
+std::string make_temp_file() {
+  std::string filename =
+      std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") +
+      "/vadem_bench_XXXXXX";
+  const int fd = mkstemp(&filename[0]);
+  if (fd == -1) {
+    return std::string();
+  }
+  close(fd);
+  return filename;
+}
+
+template <typename Arithmetic>
+void bench_color(Bench& bench,
+                 const std::string& arithmetic,
+                 const Params& base,
+                 const SolidRgbImage& rgb) {
+  const std::size_t w = rgb.get_width();
+  const std::size_t h = rgb.get_height();
+  const Params params = base + Params{{"arithmetic", arithmetic}};
+
+  bench.run("color_from_rgb", params, w * h, w * h * 3.0, [&]() {
+    unsigned sum = 0;
+    for (std::size_t y = 0; y < h; y++) {
+      for (std::size_t x = 0; x < w; x++) {
+        const auto color = BasicYCbCr<Arithmetic>::from_rgb(rgb[y][x]);
+        sum += color.Y + color.Cb + color.Cr;
+      }
+    }
+    sink = sum;
+  });
+
+  // Treat the RGB bytes as YCbCr, which covers the whole input range
+  bench.run("color_to_rgb", params, w * h, w * h * 3.0, [&]() {
+    unsigned sum = 0;
+    for (std::size_t y = 0; y < h; y++) {
+      for (std::size_t x = 0; x < w; x++) {
+        const png::rgb_pixel px = rgb[y][x];
+        const png::rgb_pixel out =
+            BasicYCbCr<Arithmetic>(px.red, px.green, px.blue).to_rgb();
+        sum += out.red + out.green + out.blue;
+      }
+    }
+    sink = sum;
+  });
+}
+
+template <typename Arithmetic>
+void bench_nv12_copies(Bench& bench,
+                       VADisplay display,
+                       const std::string& arithmetic,
+                       const Params& base,
+                       const std::vector<Settings>& sweep,
+                       const SolidRgbImage& rgb,
+                       const VAImage& nv12) {
+  const std::size_t pixels = rgb.get_width() * rgb.get_height();
+  const Params params = base + Params{{"arithmetic", arithmetic}};
+
+  for (const Settings& settings : sweep) {
+    settings.apply();
+    bench.run("va_image_nv12_copy_from_png", params + settings.params(),
+              pixels, pixels * 4.5, [&]() {
+                va_image_nv12_copy_from_png<Arithmetic>(display, nv12, rgb);
+              });
+    bench.run("va_image_nv12_copy_to_png", params + settings.params(), pixels,
+              pixels * 4.5, [&]() {
+                sink = va_image_copy_to_png<Arithmetic>(display, nv12)
+                           .get_width();
+              });
+  }
+  default_settings().apply();
+}
+
+void bench_size(Bench& bench, VADisplay display, const Size& size) {
+  const std::size_t w = size.width;
+  const std::size_t h = size.height;
+  const std::size_t pixels = w * h;
+  const Params base{{"size", size.name}};
+  SolidRgbImage rgb = make_test_image(w, h);
+  const VAImage nv12 = va_image_create_nv12(display, w, h);
+  const VAImage rgbx = va_image_create_rgb(display, w, h);
+  default_settings().apply();
+
+  bench_color<FloatArithmetic<>>(bench, "float", base, rgb);
+  bench_color<FixedPointArithmetic<>>(bench, "fixed", base, rgb);
+
+  // Every copy at every setting for the default arithmetic, plus the
+  // defaults for the rest
+  bench_nv12_copies<FloatArithmetic<>>(bench, display, "float", base,
+                                       settings_sweep(true, true), rgb, nv12);
+  const std::vector<Settings> defaults{default_settings()};
+#define BENCH_ARITHMETIC(Arithmetic)                                 \
+  bench_nv12_copies<Arithmetic>(bench, display, #Arithmetic, base,    \
+                                defaults, rgb, nv12);
+  VADEM_FOR_EACH_ARITHMETIC(BENCH_ARITHMETIC)
+#undef BENCH_ARITHMETIC
+
+  bench.run("va_image_nv12_copy_from_png",
+            base + Params{{"chroma_filter", "sample"}} +
+                default_settings().params(),
+            pixels, pixels * 4.5, [&]() {
+              va_image_nv12_copy_from_png(display, nv12, rgb,
+                                          ChromaFilter::kSample);
+            });
+
+  for (const Settings& settings : settings_sweep(true, true)) {
+    settings.apply();
+    bench.run("va_image_rgb_copy_from_png", base + settings.params(), pixels,
+              pixels * 7.0,
+              [&]() { va_image_rgb_copy_from_png(display, rgbx, rgb); });
+    bench.run("va_image_rgb_copy_to_png", base + settings.params(), pixels,
+              pixels * 7.0, [&]() {
+                sink = va_image_copy_to_png(display, rgbx).get_width();
+              });
+  }
+  default_settings().apply();
+
+  // Planar ingest and back, chroma merged or split by the SIMD kernels
+  const VAImage i420 = va_image_create_i420(display, w, h);
+  for (const Settings& settings : settings_sweep(true, true)) {
+    settings.apply();
+    bench.run("va_image_yuv420_copy",
+              base + Params{{"from", "I420"}, {"to", "NV12"}} +
+                  settings.params(),
+              pixels, pixels * 3.0,
+              [&]() { va_image_yuv420_copy(display, i420, nv12); });
+    bench.run("va_image_yuv420_copy",
+              base + Params{{"from", "NV12"}, {"to", "I420"}} +
+                  settings.params(),
+              pixels, pixels * 3.0,
+              [&]() { va_image_yuv420_copy(display, nv12, i420); });
+  }
+  default_settings().apply();
+
+  // 10- and 16-bit copies, to set against the 8-bit ones above with
+  // arithmetic FixedPointArithmetic<Bt2020Limited>: same matrix, same
+  // rounding, twice the bytes per sample. Readback is timed both into a
+  // new image, as the 8-bit copies are, and into a reused one, since a
+  // new 16-bit image is big enough that faulting it in dominates.
+  {
+    const SolidRgb16Image rgb16 = png_widen_to_16_bit(rgb);
+    SolidRgb16Image reused(w, h);
+    const Params params = base + Params{{"matrix", "Bt2020Limited"}};
+    for (const uint32_t fourcc : {VA_FOURCC_P010, VA_FOURCC_P016}) {
+      const VAImage image = (fourcc == VA_FOURCC_P010)
+                                ? va_image_create_p010(display, w, h)
+                                : va_image_create_p016(display, w, h);
+      const Params fourcc_params =
+          params + Params{{"fourcc", fourcc_str(fourcc)}};
+      for (const Settings& settings : settings_sweep(true, true)) {
+        settings.apply();
+        bench.run("va_image_p016_copy_from_png",
+                  fourcc_params + settings.params(), pixels, pixels * 9.0,
+                  [&]() {
+                    va_image_p016_copy_from_png(display, image, rgb16);
+                  });
+        bench.run("va_image_p016_copy_to_png",
+                  fourcc_params + Params{{"dst", "new"}} + settings.params(),
+                  pixels, pixels * 9.0, [&]() {
+                    sink = va_image_p016_copy_to_png(display, image)
+                               .get_width();
+                  });
+        bench.run("va_image_p016_copy_to_png",
+                  fourcc_params + Params{{"dst", "reused"}} +
+                      settings.params(),
+                  pixels, pixels * 9.0, [&]() {
+                    va_image_p016_copy_to_png(display, image, reused);
+                  });
+      }
+      default_settings().apply();
+      check_status(vaDestroyImage(display, image.image_id));
+    }
+  }
+
+  // What the row kernels replaced: converting and storing a pixel at a
+  // time, which scatters single-byte writes over both planes
+  bench.run("nv12_upload_per_pixel", base + Params{{"access", "unchecked"}},
+            pixels, pixels * 4.5, [&]() {
+              BasicNv12Buffer<UncheckedAccess> buf(display, nv12);
+              for (std::size_t y = 0; y < h; y++) {
+                for (std::size_t x = 0; x < w; x++) {
+                  buf.set_pixel(x, y, YCbCr::from_rgb(rgb[y][x]));
+                }
+              }
+            });
+  bench.run("nv12_upload_per_pixel", base + Params{{"access", "checked"}},
+            pixels, pixels * 4.5, [&]() {
+              BasicNv12Buffer<CheckedAccess> buf(display, nv12);
+              for (std::size_t y = 0; y < h; y++) {
+                for (std::size_t x = 0; x < w; x++) {
+                  buf.set_pixel(x, y, YCbCr::from_rgb(rgb[y][x]));
+                }
+              }
+            });
+
+  // The same luma fill through the per-byte accessors and through row
+  // pointers; only the latter auto-vectorizes
+  bench.run("nv12_luma_fill", base + Params{{"loop", "per_pixel_unchecked"}},
+            pixels, pixels, [&]() {
+              BasicNv12Buffer<UncheckedAccess> buf(display, nv12);
+              for (std::size_t y = 0; y < h; y++) {
+                for (std::size_t x = 0; x < w; x++) {
+                  buf.set_u8(buf.offset_Y(x, y), x + y);
+                }
+              }
+            });
+  bench.run("nv12_luma_fill", base + Params{{"loop", "per_pixel_checked"}},
+            pixels, pixels, [&]() {
+              BasicNv12Buffer<CheckedAccess> buf(display, nv12);
+              for (std::size_t y = 0; y < h; y++) {
+                for (std::size_t x = 0; x < w; x++) {
+                  buf.set_u8(buf.offset_Y(x, y), x + y);
+                }
+              }
+            });
+  bench.run("nv12_luma_fill", base + Params{{"loop", "row"}}, pixels, pixels,
+            [&]() {
+              Nv12Buffer buf(display, nv12);
+              for (std::size_t y = 0; y < h; y++) {
+                uint8_t* const row = buf.y_row(y);
+                for (std::size_t x = 0; x < w; x++) {
+                  row[x] = x + y;
+                }
+              }
+            });
+
+  bench.run("va_image_dump", base, pixels, pixels * 3.0,
+            [&]() { va_image_dump(display, nv12, "/dev/null"); });
+  bench.run("va_image_save", base + Params{{"fourcc", "NV12"}}, pixels,
+            pixels * 1.5,
+            [&]() { va_image_save(display, nv12, "/dev/null"); });
+  bench.run("va_image_save", base + Params{{"fourcc", "RGBX"}}, pixels,
+            pixels * 4.0,
+            [&]() { va_image_save(display, rgbx, "/dev/null"); });
+
+  // Back-to-back operations on one image, mapping it each time against
+  // once
+  for (const bool cached : {false, true}) {
+    std::unique_ptr<BufferMapCache> map_cache;
+    if (cached) {
+      map_cache.reset(new BufferMapCache(display));
+    }
+    bench.run("va_image_save_dump",
+              base + Params{{"map_cache", cached ? "on" : "off"}}, pixels,
+              pixels * 4.5, [&]() {
+                va_image_save(display, nv12, "/dev/null");
+                va_image_dump(display, nv12, "/dev/null");
+              });
+  }
+
+  std::stringstream encoded;
+  rgb.write_stream(encoded);
+  const std::string png_bytes = encoded.str();
+  bench.run("png_encode", base, pixels, pixels * 3.0 + png_bytes.size(),
+            [&]() {
+              std::ostringstream stream;
+              rgb.write_stream(stream);
+              sink = stream.tellp();
+            });
+  bench.run("png_decode", base, pixels, pixels * 3.0 + png_bytes.size(),
+            [&]() {
+              std::istringstream stream(png_bytes);
+              SolidRgbImage image;
+              image.read(stream);
+              sink = image.get_width();
+            });
+
+  const std::string filename = make_temp_file();
+  if (!filename.empty()) {
+    std::ofstream(filename, std::ios::binary) << png_bytes;
+    bench.run("va_image_nv12_load_png", base, pixels,
+              pixels * 1.5 + png_bytes.size(), [&]() {
+                const VAImage image = va_image_nv12_load_png(display, filename);
+                check_status(vaDestroyImage(display, image.image_id));
+              });
+    unlink(filename.c_str());
+  }
+
+  // A stream of frames through one open file, each frame a copy of luma
+  // and a split or merge of chroma
+  {
+    Y4mWriter writer("/dev/null", w, h);
+    bench.run("y4m_write", base, pixels, pixels * 3.0,
+              [&]() { writer.write(display, nv12); });
+  }
+  const std::string y4m_filename = make_temp_file();
+  if (!y4m_filename.empty()) {
+    const std::size_t frames = 8;
+    {
+      Y4mWriter writer(y4m_filename, w, h);
+      for (std::size_t i = 0; i < frames; i++) {
+        writer.write(display, nv12);
+      }
+      writer.close();
+    }
+    bench.run("y4m_read", base, pixels * frames, pixels * frames * 3.0, [&]() {
+      Y4mReader reader(y4m_filename);
+      while (reader.read(display, nv12)) {
+      }
+    });
+    unlink(y4m_filename.c_str());
+  }
+
+  // Raw frames in each layout, written through a mapping and loaded from
+  // one, against the PNG load above
+  const std::string raw_filename = make_temp_file();
+  if (!raw_filename.empty()) {
+    for (const uint32_t fourcc :
+         {VA_FOURCC_NV12, VA_FOURCC_I420, VA_FOURCC_YV12}) {
+      const Params params = base + Params{{"fourcc", fourcc_str(fourcc)}};
+      bench.run("va_image_dump_file", params, pixels, pixels * 3.0,
+                [&]() { va_image_dump(display, nv12, raw_filename, fourcc); });
+      // Whether or not the filter left the one above out
+      va_image_dump(display, nv12, raw_filename, fourcc);
+      bench.run("va_image_load_raw", params, pixels, pixels * 3.0, [&]() {
+        va_image_load_raw(display, nv12, raw_filename, fourcc);
+      });
+    }
+    unlink(raw_filename.c_str());
+  }
+
+  // Allocation per frame against recycling through a pool
+  bench.run("va_image_create_destroy", base, pixels, pixels * 1.5, [&]() {
+    const VAImage image = va_image_create_nv12(display, w, h);
+    check_status(vaDestroyImage(display, image.image_id));
+  });
+  VaPool pool(display, pixels * 2);
+  bench.run("va_pool_acquire_release", base, pixels, pixels * 1.5, [&]() {
+    sink = pool.acquire_image(VA_FOURCC_NV12, w, h)->image_id;
+  });
+
+  // Converting straight into a surface against converting into an image
+  // and copying that over. The put-image path counts the extra copy.
+  VaPool upload_pool(display, pixels * 16);
+  for (const uint32_t fourcc : {VA_FOURCC_NV12, VA_FOURCC_RGBX}) {
+    const bool is_nv12 = (fourcc == VA_FOURCC_NV12);
+    const double frame_bytes = pixels * (is_nv12 ? 1.5 : 4.0);
+    const SurfaceLease surface = upload_pool.acquire_surface(fourcc, w, h);
+    for (const UploadPath prefer :
+         {UploadPath::kDerive, UploadPath::kPutImage}) {
+      const UploadPath path =
+          va_surface_copy_from_png(upload_pool, *surface, rgb,
+                                   ChromaFilter::kBox, prefer);
+      const double bytes = pixels * 3.0 + frame_bytes +
+                           ((path == UploadPath::kPutImage) ? frame_bytes * 2
+                                                            : 0.0);
+      bench.run("va_surface_copy_from_png",
+                base + Params{{"fourcc", is_nv12 ? "NV12" : "RGBX"},
+                              {"path", upload_path_name(path)}},
+                pixels, bytes, [&]() {
+                  va_surface_copy_from_png(upload_pool, *surface, rgb,
+                                           ChromaFilter::kBox, prefer);
+                });
+    }
+  }
+
+  // A stream of frames through the pipelines; depth 1 runs every step
+  // back to back
+  const std::size_t frames = 8;
+  for (const std::size_t depth : {1, 2, 3}) {
+    const Params params = base + Params{{"depth", std::to_string(depth)}};
+    UploadPipeline upload(upload_pool, VA_FOURCC_NV12, w, h, depth);
+    bench.run("upload_pipeline", params, pixels * frames,
+              pixels * frames * 7.5, [&]() {
+                for (std::size_t i = 0; i < frames; i++) {
+                  upload.submit(rgb, [](const PooledSurface& surface) {
+                    sink = surface.id;
+                  });
+                }
+                upload.flush();
+              });
+
+    const SurfaceLease surface =
+        upload_pool.acquire_surface(VA_FOURCC_NV12, w, h);
+    ReadbackPipeline readback(upload_pool, VA_FOURCC_NV12, w, h, depth);
+    bench.run("readback_pipeline", params, pixels * frames,
+              pixels * frames * 7.5, [&]() {
+                std::vector<std::future<SolidRgbImage>> images;
+                for (std::size_t i = 0; i < frames; i++) {
+                  images.push_back(readback.submit(surface->id));
+                }
+                for (auto& image : images) {
+                  sink = image.get().get_width();
+                }
+              });
+  }
+
+  // Handing a frame over as a DMA-BUF, against the PNG round trip above.
+  // Counts the frame as read and written once, though nothing's copied.
+  {
+    const SurfaceLease surface =
+        upload_pool.acquire_surface(VA_FOURCC_NV12, w, h);
+    bench.run("dmabuf_export_import", base, pixels, pixels * 3.0, [&]() {
+      const DmaBuf buf = va_surface_export_dmabuf(display, surface->id);
+      VASurfaceID imported = va_surface_import_dmabuf(display, buf);
+      check_status(vaDestroySurfaces(display, &imported, 1));
+    });
+  }
+
+  check_status(vaDestroyImage(display, nv12.image_id));
+  check_status(vaDestroyImage(display, i420.image_id));
+  check_status(vaDestroyImage(display, rgbx.image_id));
+}
+
+// The generators pick their own sizes
+void bench_gradients(Bench& bench, VADisplay display) {
+  bench.run("va_image_nv12_gen_CbCr_gradient", {{"size", "512"}}, 512 * 512,
+            512 * 512 * 1.5, [&]() {
+              const VAImage image =
+                  va_image_nv12_gen_CbCr_gradient(display, 128);
+              check_status(vaDestroyImage(display, image.image_id));
+            });
+  bench.run("va_image_nv12_gen_Y_gradient", {{"size", "128"}}, 128 * 128,
+            128 * 128 * 1.5, [&]() {
+              const VAImage image = va_image_nv12_gen_Y_gradient(display);
+              check_status(vaDestroyImage(display, image.image_id));
+            });
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string sizes = "256,1080p,4k,8k";
+  std::string filter;
+  double min_time = 0.5;
+
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    std::string value;
+    if (parse_flag(arg, "sizes", &value)) {
+      sizes = value;
+    } else if (parse_flag(arg, "filter", &value)) {
+      filter = value;
+    } else if (parse_flag(arg, "min-time", &value)) {
+      min_time = atof(value.c_str());
+#ifdef VADEM_SOFT_VA
+    } else if (parse_flag(arg, "pitch-align", &value)) {
+      SoftVaConfig config = soft_va_config();
+      config.pitch_align = strtoul(value.c_str(), nullptr, 10);
+      soft_va_config_set(config);
+    } else if (parse_flag(arg, "map-latency-us", &value)) {
+      SoftVaConfig config = soft_va_config();
+      config.map_latency =
+          std::chrono::microseconds(strtoul(value.c_str(), nullptr, 10));
+      soft_va_config_set(config);
+#endif
+    } else {
+      std::cerr << "unknown argument: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+#ifdef VADEM_SOFT_VA
+  const int fd = -1;
+#else
+  const char* device_path = "/dev/dri/renderD128";
+  const int fd = open(device_path, 0);
+  if (fd == -1) {
+    std::cerr << "failed to open " << device_path << std::endl;
+    return 1;
+  }
+#endif
+
+  VADisplay display = vaGetDisplayDRM(fd);
+  int major = 0;
+  int minor = 0;
+  check_status(vaInitialize(display, &major, &minor));
+
+  // va_image_dump() and va_image_save() log every call
+  std::cout.setstate(std::ios::failbit);
+
+  Bench bench(min_time, filter);
+  bench_gradients(bench, display);
+  for (const Size& size : kSizes) {
+    if (("," + sizes + ",").find("," + size.name + ",") != std::string::npos) {
+      bench_size(bench, display, size);
+    }
+  }
+
+  std::cout.clear();
+  bench.write_json(std::cout);
+
+  check_status(vaTerminate(display));
+  return 0;
+}
@@ -8,37 +8,263 @@
 
 namespace vadem {
 
+// Coefficients for converting between 8-bit RGB and YCbCr:
+//
+//   Y  = y_r * R + y_g * G + y_b * B + y_offset
+//   Cb = cb_r * R + cb_g * G + cb_b * B + 128
+//   Cr = cr_r * R + cr_g * G + cr_b * B + 128
+//
+//   R = y_scale * (Y - y_offset) + r_cr * (Cr - 128)
+//   G = y_scale * (Y - y_offset) + g_cr * (Cr - 128) + g_cb * (Cb - 128)
+//   B = y_scale * (Y - y_offset) + b_cb * (Cb - 128)
+struct ColorMatrix {
+  double y_r, y_g, y_b, y_offset;
+  double cb_r, cb_g, cb_b;
+  double cr_r, cr_g, cr_b;
+  double y_scale, r_cr, g_cr, g_cb, b_cb;
+};
+
+// Matrix policies for the arithmetic policies below. Limited range puts
+// Y in [16, 235] and Cb/Cr in [16, 240]; full range uses all of [0, 255].
+
 // Adapted from "YCbCr and YCCK Color Models",
 // https://software.intel.com/en-us/node/503873
-class YCbCr {
- public:
+struct Bt601Limited {
+  static constexpr ColorMatrix coefficients() {
+    return {0.257, 0.504, 0.098, 16,  // Y
+            -0.148, -0.291, 0.439,  // Cb
+            0.439, -0.368, -0.071,  // Cr
+            1.164, 1.596, -0.813, -0.392, 2.017};  // RGB
+  }
+};
+
+struct Bt601Full {
+  static constexpr ColorMatrix coefficients() {
+    return {0.2990, 0.5870, 0.1140, 0,  // Y
+            -0.1687, -0.3313, 0.5000,  // Cb
+            0.5000, -0.4187, -0.0813,  // Cr
+            1.0000, 1.4020, -0.7141, -0.3441, 1.7720};  // RGB
+  }
+};
+
+struct Bt709Limited {
+  static constexpr ColorMatrix coefficients() {
+    return {0.1826, 0.6142, 0.0620, 16,  // Y
+            -0.1006, -0.3386, 0.4392,  // Cb
+            0.4392, -0.3989, -0.0403,  // Cr
+            1.1644, 1.7927, -0.5329, -0.2132, 2.1124};  // RGB
+  }
+};
+
+struct Bt709Full {
+  static constexpr ColorMatrix coefficients() {
+    return {0.2126, 0.7152, 0.0722, 0,  // Y
+            -0.1146, -0.3854, 0.5000,  // Cb
+            0.5000, -0.4542, -0.0458,  // Cr
+            1.0000, 1.5748, -0.4681, -0.1873, 1.8556};  // RGB
+  }
+};
+
+struct Bt2020Limited {
+  static constexpr ColorMatrix coefficients() {
+    return {0.2256, 0.5823, 0.0509, 16,  // Y
+            -0.1227, -0.3166, 0.4392,  // Cb
+            0.4392, -0.4039, -0.0353,  // Cr
+            1.1644, 1.6787, -0.6504, -0.1873, 2.1418};  // RGB
+  }
+};
+
+struct Bt2020Full {
+  static constexpr ColorMatrix coefficients() {
+    return {0.2627, 0.6780, 0.0593, 0,  // Y
+            -0.1396, -0.3604, 0.5000,  // Cb
+            0.5000, -0.4598, -0.0402,  // Cr
+            1.0000, 1.4746, -0.5714, -0.1646, 1.8814};  // RGB
+  }
+};
+
+// Calls X(matrix) for every matrix above, for explicit instantiation of
+// code templated on the matrix alone.
+#define VADEM_FOR_EACH_MATRIX(X) \
+  X(Bt601Limited)                \
+  X(Bt601Full)                   \
+  X(Bt709Limited)                \
+  X(Bt709Full)                   \
+  X(Bt2020Limited)               \
+  X(Bt2020Full)
+
+// ColorMatrix with every coefficient scaled by 256 and rounded
+struct FixedColorMatrix {
+  int y_r, y_g, y_b, y_offset;
+  int cb_r, cb_g, cb_b;
+  int cr_r, cr_g, cr_b;
+  int y_scale, r_cr, g_cr, g_cb, b_cb;
+};
+
+constexpr int to_fixed(const double c) {
+  return (c < 0) ? -static_cast<int>(-c * 256 + 0.5)
+                 : static_cast<int>(c * 256 + 0.5);
+}
+
+constexpr FixedColorMatrix to_fixed(const ColorMatrix& m) {
+  return {to_fixed(m.y_r),     to_fixed(m.y_g),  to_fixed(m.y_b),
+          static_cast<int>(m.y_offset),
+          to_fixed(m.cb_r),    to_fixed(m.cb_g), to_fixed(m.cb_b),
+          to_fixed(m.cr_r),    to_fixed(m.cr_g), to_fixed(m.cr_b),
+          to_fixed(m.y_scale), to_fixed(m.r_cr), to_fixed(m.g_cr),
+          to_fixed(m.g_cb),    to_fixed(m.b_cb)};
+}
+
+// Arithmetic policies for BasicYCbCr. Each provides the component type T
+// and the per-channel conversions for its Matrix; results are clamped and
+// narrowed to bytes by BasicYCbCr.
+
+template <typename Matrix = Bt601Limited>
+struct FloatArithmetic {
   using T = float;
 
-  YCbCr() : Y(0), Cb(0), Cr(0) {}
+  static constexpr ColorMatrix coefficients() {
+    return Matrix::coefficients();
+  }
+
+  static T luma(const T R, const T G, const T B) {
+    return coefficients().y_r * R + coefficients().y_g * G +
+           coefficients().y_b * B + coefficients().y_offset;
+  }
+
+  static T blue_difference(const T R, const T G, const T B) {
+    return coefficients().cb_r * R + coefficients().cb_g * G +
+           coefficients().cb_b * B + 128;
+  }
+
+  static T red_difference(const T R, const T G, const T B) {
+    return coefficients().cr_r * R + coefficients().cr_g * G +
+           coefficients().cr_b * B + 128;
+  }
+
+  static T red(const T Y, const T /*Cb*/, const T Cr) {
+    return coefficients().y_scale * (Y - coefficients().y_offset) +
+           coefficients().r_cr * (Cr - 128);
+  }
+
+  static T green(const T Y, const T Cb, const T Cr) {
+    return coefficients().y_scale * (Y - coefficients().y_offset) +
+           coefficients().g_cr * (Cr - 128) +
+           coefficients().g_cb * (Cb - 128);
+  }
+
+  static T blue(const T Y, const T Cb, const T /*Cr*/) {
+    return coefficients().y_scale * (Y - coefficients().y_offset) +
+           coefficients().b_cb * (Cb - 128);
+  }
+
+  // Mean of four samples, e.g. for 2x2 chroma decimation. Exact, since
+  // the sum of four bytes fits comfortably in a float.
+  static T mean(const T a, const T b, const T c, const T d) {
+    return (a + b + c + d) / 4;
+  }
+};
+
+// FloatArithmetic with every coefficient scaled by 256 and rounded, e.g.
+// Y = ((66 * R + 129 * G + 25 * B + 128) >> 8) + 16 for Bt601Limited.
+// Unlike the float path, which truncates, results are rounded to nearest.
+//
+// Checked against FloatArithmetic over every possible input for each of
+// the matrices above (by vadem_test, see src/test.cc), the results differ
+// by at most 1 in each of Y, Cb, Cr, R, G and B.
+template <typename Matrix = Bt601Limited>
+struct FixedPointArithmetic {
+  using T = int;
+
+  static constexpr FixedColorMatrix coefficients() {
+    return to_fixed(Matrix::coefficients());
+  }
+
+  static T luma(const T R, const T G, const T B) {
+    return descale(coefficients().y_r * R + coefficients().y_g * G +
+                   coefficients().y_b * B) +
+           coefficients().y_offset;
+  }
+
+  static T blue_difference(const T R, const T G, const T B) {
+    return descale(coefficients().cb_r * R + coefficients().cb_g * G +
+                   coefficients().cb_b * B) +
+           128;
+  }
+
+  static T red_difference(const T R, const T G, const T B) {
+    return descale(coefficients().cr_r * R + coefficients().cr_g * G +
+                   coefficients().cr_b * B) +
+           128;
+  }
+
+  static T red(const T Y, const T /*Cb*/, const T Cr) {
+    return descale(coefficients().y_scale * (Y - coefficients().y_offset) +
+                   coefficients().r_cr * (Cr - 128));
+  }
+
+  static T green(const T Y, const T Cb, const T Cr) {
+    return descale(coefficients().y_scale * (Y - coefficients().y_offset) +
+                   coefficients().g_cr * (Cr - 128) +
+                   coefficients().g_cb * (Cb - 128));
+  }
+
+  static T blue(const T Y, const T Cb, const T /*Cr*/) {
+    return descale(coefficients().y_scale * (Y - coefficients().y_offset) +
+                   coefficients().b_cb * (Cb - 128));
+  }
+
+  // Mean of four samples, rounded to nearest
+  static T mean(const T a, const T b, const T c, const T d) {
+    return (a + b + c + d + 2) >> 2;
+  }
 
-  YCbCr(const T Y, const T Cb, const T Cr) : Y(Y), Cb(Cb), Cr(Cr) {}
+  // Drop the 8 fractional bits, rounding to nearest
+  static T descale(const T val) { return (val + 128) >> 8; }
+};
+
+// Calls X(arithmetic) for every arithmetic/matrix combination, for
+// explicit instantiation of code templated on the arithmetic policy.
+#define VADEM_FOR_EACH_ARITHMETIC(X)       \
+  X(FloatArithmetic<Bt601Limited>)         \
+  X(FloatArithmetic<Bt601Full>)            \
+  X(FloatArithmetic<Bt709Limited>)         \
+  X(FloatArithmetic<Bt709Full>)            \
+  X(FloatArithmetic<Bt2020Limited>)        \
+  X(FloatArithmetic<Bt2020Full>)           \
+  X(FixedPointArithmetic<Bt601Limited>)    \
+  X(FixedPointArithmetic<Bt601Full>)       \
+  X(FixedPointArithmetic<Bt709Limited>)    \
+  X(FixedPointArithmetic<Bt709Full>)       \
+  X(FixedPointArithmetic<Bt2020Limited>)   \
+  X(FixedPointArithmetic<Bt2020Full>)
+
+template <typename Arithmetic>
+class BasicYCbCr {
+ public:
+  using T = typename Arithmetic::T;
+
+  BasicYCbCr() : Y(0), Cb(0), Cr(0) {}
 
-  static YCbCr from_rgb(const T R, const T G, const T B) {
-    const T Y = 0.257 * R + 0.504 * G + 0.098 * B + 16;
-    const T Cb = -0.148 * R - 0.291 * G + 0.439 * B + 128;
-    const T Cr = 0.439 * R - 0.368 * G - 0.071 * B + 128;
-    return {Y, Cb, Cr};
+  BasicYCbCr(const T Y, const T Cb, const T Cr) : Y(Y), Cb(Cb), Cr(Cr) {}
+
+  static BasicYCbCr from_rgb(const T R, const T G, const T B) {
+    return {clamp_255(Arithmetic::luma(R, G, B)),
+            clamp_255(Arithmetic::blue_difference(R, G, B)),
+            clamp_255(Arithmetic::red_difference(R, G, B))};
   }
 
-  static YCbCr from_rgb(const png::rgb_pixel& pixel) {
+  static BasicYCbCr from_rgb(const png::rgb_pixel& pixel) {
     return from_rgb(pixel.red, pixel.green, pixel.blue);
   }
 
   png::rgb_pixel to_rgb() const { return {red_u8(), green_u8(), blue_u8()}; }
 
-  T red() const { return clamp_255(1.164 * (Y - 16) + 1.596 * (Cr - 128)); }
+  T red() const { return clamp_255(Arithmetic::red(Y, Cb, Cr)); }
 
-  T green() const {
-    return clamp_255(1.164 * (Y - 16) - 0.813 * (Cr - 128) -
-                     0.392 * (Cb - 128));
-  }
+  T green() const { return clamp_255(Arithmetic::green(Y, Cb, Cr)); }
 
-  T blue() const { return clamp_255(1.164 * (Y - 16) + 2.017 * (Cb - 128)); }
+  T blue() const { return clamp_255(Arithmetic::blue(Y, Cb, Cr)); }
 
   uint8_t red_u8() const { return red(); }
 
@@ -50,6 +276,10 @@ class YCbCr {
 
   T Y, Cb, Cr;
 };
+
+using YCbCr = BasicYCbCr<FloatArithmetic<>>;
+
+using FixedPointYCbCr = BasicYCbCr<FixedPointArithmetic<>>;
 }
 
 #endif  // COLOR_H_
@@ -0,0 +1,1196 @@
+// Copyright 2017 Neverware
+
+#include "src/convert.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VADEM_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace vadem {
+
+namespace {
+
+// The FloatArithmetic SIMD kernels evaluate the same expressions as
+// FloatArithmetic in the same order and in double precision, then round
+// to float and truncate, so they produce exactly the bytes the scalar path
+// does. The FixedPointArithmetic ones are exact in 32-bit lanes. Both take
+// their coefficients from the policy, so each matrix gets its own
+// constant-folded kernel.
+
+template <typename Arithmetic>
+void rgb_row_to_y_uv_scalar(const uint8_t* rgb,
+                            const std::size_t begin,
+                            const std::size_t end,
+                            uint8_t* y,
+                            uint8_t* uv) {
+  for (std::size_t x = begin; x < end; x++) {
+    const uint8_t* px = rgb + x * 3;
+    const auto color = BasicYCbCr<Arithmetic>::from_rgb(px[0], px[1], px[2]);
+    y[x] = color.Y;
+    if (uv && (x & 1)) {
+      uv[x - 1] = color.Cb;
+      uv[x] = color.Cr;
+    }
+  }
+}
+
+// CbCr of the mean of each 2x2 block of a pair of RGB rows
+template <typename Arithmetic>
+void rgb_rows_to_uv_box_scalar(const uint8_t* rgb0,
+                               const uint8_t* rgb1,
+                               const std::size_t begin,
+                               const std::size_t end,
+                               uint8_t* uv) {
+  for (std::size_t x = begin; x + 1 < end; x += 2) {
+    const uint8_t* p = rgb0 + x * 3;
+    const uint8_t* q = rgb1 + x * 3;
+    const auto color = BasicYCbCr<Arithmetic>::from_rgb(
+        Arithmetic::mean(p[0], p[3], q[0], q[3]),
+        Arithmetic::mean(p[1], p[4], q[1], q[4]),
+        Arithmetic::mean(p[2], p[5], q[2], q[5]));
+    uv[x] = color.Cb;
+    uv[x + 1] = color.Cr;
+  }
+}
+
+template <typename Arithmetic>
+void nv12_row_to_rgb_scalar(const uint8_t* y,
+                            const uint8_t* uv,
+                            const std::size_t begin,
+                            const std::size_t end,
+                            uint8_t* rgb) {
+  for (std::size_t x = begin; x < end; x++) {
+    const std::size_t c = x & ~static_cast<std::size_t>(1);
+    const png::rgb_pixel pixel =
+        BasicYCbCr<Arithmetic>(y[x], uv[c], uv[c + 1]).to_rgb();
+    uint8_t* px = rgb + x * 3;
+    px[0] = pixel.red;
+    px[1] = pixel.green;
+    px[2] = pixel.blue;
+  }
+}
+
+void nv12_uv_split_scalar(const uint8_t* uv,
+                          const std::size_t begin,
+                          const std::size_t end,
+                          uint8_t* u,
+                          uint8_t* v) {
+  for (std::size_t x = begin; x < end; x++) {
+    u[x] = uv[x * 2];
+    v[x] = uv[x * 2 + 1];
+  }
+}
+
+void nv12_uv_merge_scalar(const uint8_t* u,
+                          const uint8_t* v,
+                          const std::size_t begin,
+                          const std::size_t end,
+                          uint8_t* uv) {
+  for (std::size_t x = begin; x < end; x++) {
+    uv[x * 2] = u[x];
+    uv[x * 2 + 1] = v[x];
+  }
+}
+
+#ifdef VADEM_X86_SIMD
+
+// Shared load/store helpers
+
+// Load four packed RGB pixels (12 bytes) without reading past them.
+__attribute__((target("sse4.1"))) inline __m128i load_rgb4(
+    const uint8_t* p) {
+  int32_t tail;
+  memcpy(&tail, p + 8, sizeof(tail));
+  const __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+  return _mm_insert_epi32(v, tail, 2);
+}
+
+// Byte shuffle that widens channel |c| of four packed RGB pixels to
+// 32-bit lanes.
+__attribute__((target("sse4.1"))) inline __m128i channel_mask(const int c) {
+  return _mm_setr_epi8(c, -1, -1, -1, c + 3, -1, -1, -1, c + 6, -1, -1, -1,
+                       c + 9, -1, -1, -1);
+}
+
+// Byte shuffle that widens channel |c| of pixels 1 and 3 to 32-bit lanes
+// 0 and 1, or to lanes 2 and 3 if |high|.
+__attribute__((target("sse4.1"))) inline __m128i odd_channel_mask(
+    const int c,
+    const bool high) {
+  return high ? _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, c + 3, -1, -1,
+                              -1, c + 9, -1, -1, -1)
+              : _mm_setr_epi8(c + 3, -1, -1, -1, c + 9, -1, -1, -1, -1, -1,
+                              -1, -1, -1, -1, -1, -1);
+}
+
+__attribute__((target("sse4.1"))) inline void store_u32(uint8_t* p,
+                                                         const __m128i v) {
+  const int32_t bytes = _mm_cvtsi128_si32(v);
+  memcpy(p, &bytes, sizeof(bytes));
+}
+
+// Widen four luma bytes and the two CbCr pairs they share to 32-bit
+// lanes with the |y_offset|/128 offsets removed.
+__attribute__((target("sse4.1"))) inline void load_nv12_4(const uint8_t* y,
+                                                            const uint8_t* uv,
+                                                            const int y_offset,
+                                                            __m128i* c,
+                                                            __m128i* d,
+                                                            __m128i* e) {
+  int32_t y4, uv4;
+  memcpy(&y4, y, sizeof(y4));
+  memcpy(&uv4, uv, sizeof(uv4));
+  const __m128i uv32 = _mm_cvtsi32_si128(uv4);
+  const __m128i cb_mask = _mm_setr_epi8(0, -1, -1, -1, 0, -1, -1, -1, 2, -1,
+                                        -1, -1, 2, -1, -1, -1);
+  const __m128i cr_mask = _mm_setr_epi8(1, -1, -1, -1, 1, -1, -1, -1, 3, -1,
+                                        -1, -1, 3, -1, -1, -1);
+  const __m128i offset_128 = _mm_set1_epi32(128);
+  *c = _mm_sub_epi32(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(y4)),
+                     _mm_set1_epi32(y_offset));
+  *d = _mm_sub_epi32(_mm_shuffle_epi8(uv32, cb_mask), offset_128);
+  *e = _mm_sub_epi32(_mm_shuffle_epi8(uv32, cr_mask), offset_128);
+}
+
+// Pack four pixels' worth of 32-bit R, G and B lanes, saturating to
+// [0, 255], and store them as 12 bytes of packed RGB.
+__attribute__((target("sse4.1"))) inline void store_rgb4(uint8_t* p,
+                                                          const __m128i r,
+                                                          const __m128i g,
+                                                          const __m128i b) {
+  const __m128i planar = _mm_packus_epi16(
+      _mm_packus_epi32(r, g), _mm_packus_epi32(b, _mm_setzero_si128()));
+  const __m128i packed = _mm_shuffle_epi8(
+      planar, _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1,
+                            -1));
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(p), packed);
+  const int32_t tail = _mm_extract_epi32(packed, 2);
+  memcpy(p + 8, &tail, sizeof(tail));
+}
+
+// SSE4.1 arithmetic, four pixels at a time
+
+__attribute__((target("sse4.1"))) inline __m128d affine_sse(
+    const __m128d r,
+    const __m128d g,
+    const __m128d b,
+    const double cr,
+    const double cg,
+    const double cb,
+    const double offset) {
+  __m128d v = _mm_add_pd(_mm_mul_pd(_mm_set1_pd(cr), r),
+                         _mm_mul_pd(_mm_set1_pd(cg), g));
+  v = _mm_add_pd(v, _mm_mul_pd(_mm_set1_pd(cb), b));
+  return _mm_add_pd(v, _mm_set1_pd(offset));
+}
+
+// ((cr * r + cg * g + cb * b + 128) >> 8) + offset
+__attribute__((target("sse4.1"))) inline __m128i fixed_affine_sse(
+    const __m128i r,
+    const __m128i g,
+    const __m128i b,
+    const int cr,
+    const int cg,
+    const int cb,
+    const int offset) {
+  __m128i v = _mm_add_epi32(_mm_mullo_epi32(_mm_set1_epi32(cr), r),
+                            _mm_mullo_epi32(_mm_set1_epi32(cg), g));
+  v = _mm_add_epi32(v, _mm_mullo_epi32(_mm_set1_epi32(cb), b));
+  v = _mm_srai_epi32(_mm_add_epi32(v, _mm_set1_epi32(128)), 8);
+  return _mm_add_epi32(v, _mm_set1_epi32(offset));
+}
+
+// Round two doubles to float and truncate them to 32-bit integers, as
+// assigning a float to a uint8_t does.
+__attribute__((target("sse4.1"))) inline __m128i truncate_sse(
+    const __m128d lo,
+    const __m128d hi) {
+  return _mm_cvttps_epi32(_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+}
+
+// Luma of four pixels as 32-bit lanes
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i luma4_sse(
+    FloatArithmetic<Matrix>,
+    const __m128i r,
+    const __m128i g,
+    const __m128i b) {
+  const ColorMatrix m = Matrix::coefficients();
+  const __m128d lo =
+      affine_sse(_mm_cvtepi32_pd(r), _mm_cvtepi32_pd(g), _mm_cvtepi32_pd(b),
+                 m.y_r, m.y_g, m.y_b, m.y_offset);
+  const __m128d hi = affine_sse(_mm_cvtepi32_pd(_mm_srli_si128(r, 8)),
+                                _mm_cvtepi32_pd(_mm_srli_si128(g, 8)),
+                                _mm_cvtepi32_pd(_mm_srli_si128(b, 8)), m.y_r,
+                                m.y_g, m.y_b, m.y_offset);
+  return truncate_sse(lo, hi);
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i luma4_sse(
+    FixedPointArithmetic<Matrix>,
+    const __m128i r,
+    const __m128i g,
+    const __m128i b) {
+  const FixedColorMatrix m = FixedPointArithmetic<Matrix>::coefficients();
+  return fixed_affine_sse(r, g, b, m.y_r, m.y_g, m.y_b, m.y_offset);
+}
+
+__attribute__((target("sse4.1"))) inline __m128i chroma2_sse_pd(
+    const ColorMatrix& m,
+    const __m128d r,
+    const __m128d g,
+    const __m128d b) {
+  const __m128d cb = affine_sse(r, g, b, m.cb_r, m.cb_g, m.cb_b, 128);
+  const __m128d cr = affine_sse(r, g, b, m.cr_r, m.cr_g, m.cr_b, 128);
+  // Cb Cb Cr Cr -> Cb Cr Cb Cr
+  return _mm_shuffle_epi32(truncate_sse(cb, cr), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+// Cb and Cr of the pixels in lanes 0 and 1, interleaved as Cb Cr Cb Cr
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i chroma2_sse(
+    FloatArithmetic<Matrix>,
+    const __m128i r,
+    const __m128i g,
+    const __m128i b) {
+  return chroma2_sse_pd(Matrix::coefficients(), _mm_cvtepi32_pd(r),
+                        _mm_cvtepi32_pd(g), _mm_cvtepi32_pd(b));
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i chroma2_sse(
+    FixedPointArithmetic<Matrix>,
+    const __m128i r,
+    const __m128i g,
+    const __m128i b) {
+  const FixedColorMatrix m = FixedPointArithmetic<Matrix>::coefficients();
+  return _mm_unpacklo_epi32(
+      fixed_affine_sse(r, g, b, m.cb_r, m.cb_g, m.cb_b, 128),
+      fixed_affine_sse(r, g, b, m.cr_r, m.cr_g, m.cr_b, 128));
+}
+
+// chroma2_sse() of the means of two 2x2 blocks, given the sums of their
+// four pixels' channels in lanes 0 and 1
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i chroma_mean2_sse(
+    FloatArithmetic<Matrix>,
+    const __m128i r_sum,
+    const __m128i g_sum,
+    const __m128i b_sum) {
+  const __m128d quarter = _mm_set1_pd(0.25);
+  return chroma2_sse_pd(Matrix::coefficients(),
+                        _mm_mul_pd(_mm_cvtepi32_pd(r_sum), quarter),
+                        _mm_mul_pd(_mm_cvtepi32_pd(g_sum), quarter),
+                        _mm_mul_pd(_mm_cvtepi32_pd(b_sum), quarter));
+}
+
+// (sum + 2) >> 2, as FixedPointArithmetic::mean() rounds
+__attribute__((target("sse4.1"))) inline __m128i fixed_mean_sse(
+    const __m128i sum) {
+  return _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(2)), 2);
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i chroma_mean2_sse(
+    FixedPointArithmetic<Matrix>,
+    const __m128i r_sum,
+    const __m128i g_sum,
+    const __m128i b_sum) {
+  return chroma2_sse(FixedPointArithmetic<Matrix>(), fixed_mean_sse(r_sum),
+                     fixed_mean_sse(g_sum), fixed_mean_sse(b_sum));
+}
+
+__attribute__((target("sse4.1"))) inline __m128d linear2_sse(
+    const __m128d a,
+    const __m128d b,
+    const double ca,
+    const double cb) {
+  return _mm_add_pd(_mm_mul_pd(_mm_set1_pd(ca), a),
+                    _mm_mul_pd(_mm_set1_pd(cb), b));
+}
+
+// Round to float, clamp to [0, 255] and truncate, as YCbCr::red_u8() and
+// friends do.
+__attribute__((target("sse4.1"))) inline __m128i clamp_truncate_sse(
+    const __m128 v) {
+  const __m128 clamped =
+      _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255));
+  return _mm_cvttps_epi32(clamped);
+}
+
+// Convert the low two lanes of |c|, |d| and |e| to float RGB in the low
+// two lanes of |r|, |g| and |b|.
+__attribute__((target("sse4.1"))) inline void ycbcr2_to_rgb_sse(
+    const ColorMatrix& m,
+    const __m128i c,
+    const __m128i d,
+    const __m128i e,
+    __m128* r,
+    __m128* g,
+    __m128* b) {
+  const __m128d cd = _mm_cvtepi32_pd(c);
+  const __m128d dd = _mm_cvtepi32_pd(d);
+  const __m128d ed = _mm_cvtepi32_pd(e);
+  *r = _mm_cvtpd_ps(linear2_sse(cd, ed, m.y_scale, m.r_cr));
+  *g = _mm_cvtpd_ps(_mm_add_pd(linear2_sse(cd, ed, m.y_scale, m.g_cr),
+                               _mm_mul_pd(_mm_set1_pd(m.g_cb), dd)));
+  *b = _mm_cvtpd_ps(linear2_sse(cd, dd, m.y_scale, m.b_cb));
+}
+
+// RGB of four pixels from their offset-removed Y, Cb and Cr, as 32-bit
+// lanes ready for store_rgb4()
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline void rgb4_sse(
+    FloatArithmetic<Matrix>,
+    const __m128i c,
+    const __m128i d,
+    const __m128i e,
+    __m128i* r,
+    __m128i* g,
+    __m128i* b) {
+  const ColorMatrix m = Matrix::coefficients();
+  __m128 r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+  ycbcr2_to_rgb_sse(m, c, d, e, &r_lo, &g_lo, &b_lo);
+  ycbcr2_to_rgb_sse(m, _mm_srli_si128(c, 8), _mm_srli_si128(d, 8),
+                    _mm_srli_si128(e, 8), &r_hi, &g_hi, &b_hi);
+  *r = clamp_truncate_sse(_mm_movelh_ps(r_lo, r_hi));
+  *g = clamp_truncate_sse(_mm_movelh_ps(g_lo, g_hi));
+  *b = clamp_truncate_sse(_mm_movelh_ps(b_lo, b_hi));
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline void rgb4_sse(
+    FixedPointArithmetic<Matrix>,
+    const __m128i c,
+    const __m128i d,
+    const __m128i e,
+    __m128i* r,
+    __m128i* g,
+    __m128i* b) {
+  const FixedColorMatrix m = FixedPointArithmetic<Matrix>::coefficients();
+  const __m128i zero = _mm_setzero_si128();
+  *r = fixed_affine_sse(c, e, zero, m.y_scale, m.r_cr, 0, 0);
+  *g = fixed_affine_sse(c, e, d, m.y_scale, m.g_cr, m.g_cb, 0);
+  *b = fixed_affine_sse(c, d, zero, m.y_scale, m.b_cb, 0, 0);
+}
+
+template <typename Arithmetic>
+__attribute__((target("sse4.1"))) void rgb_row_to_y_uv_sse41(
+    const uint8_t* rgb,
+    const std::size_t width,
+    uint8_t* y,
+    uint8_t* uv) {
+  const __m128i r_mask = channel_mask(0);
+  const __m128i g_mask = channel_mask(1);
+  const __m128i b_mask = channel_mask(2);
+  const __m128i r_odd_mask = odd_channel_mask(0, false);
+  const __m128i g_odd_mask = odd_channel_mask(1, false);
+  const __m128i b_odd_mask = odd_channel_mask(2, false);
+  const __m128i zero = _mm_setzero_si128();
+
+  std::size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i px = load_rgb4(rgb + x * 3);
+
+    const __m128i y32 = luma4_sse(Arithmetic(), _mm_shuffle_epi8(px, r_mask),
+                                  _mm_shuffle_epi8(px, g_mask),
+                                  _mm_shuffle_epi8(px, b_mask));
+    const __m128i y16 = _mm_packus_epi32(y32, zero);
+    store_u32(y + x, _mm_packus_epi16(y16, zero));
+
+    if (uv) {
+      const __m128i c32 =
+          chroma2_sse(Arithmetic(), _mm_shuffle_epi8(px, r_odd_mask),
+                      _mm_shuffle_epi8(px, g_odd_mask),
+                      _mm_shuffle_epi8(px, b_odd_mask));
+      const __m128i c16 = _mm_packus_epi32(c32, zero);
+      store_u32(uv + x, _mm_packus_epi16(c16, zero));
+    }
+  }
+
+  rgb_row_to_y_uv_scalar<Arithmetic>(rgb, x, width, y, uv);
+}
+
+template <typename Arithmetic>
+__attribute__((target("sse4.1"))) void rgb_rows_to_uv_box_sse41(
+    const uint8_t* rgb0,
+    const uint8_t* rgb1,
+    const std::size_t width,
+    uint8_t* uv) {
+  const __m128i r_mask = channel_mask(0);
+  const __m128i g_mask = channel_mask(1);
+  const __m128i b_mask = channel_mask(2);
+  const __m128i zero = _mm_setzero_si128();
+
+  std::size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i px0 = load_rgb4(rgb0 + x * 3);
+    const __m128i px1 = load_rgb4(rgb1 + x * 3);
+
+    // Sum each column, then adjacent columns, leaving the sums of the two
+    // blocks in lanes 0 and 1
+    __m128i r = _mm_add_epi32(_mm_shuffle_epi8(px0, r_mask),
+                              _mm_shuffle_epi8(px1, r_mask));
+    __m128i g = _mm_add_epi32(_mm_shuffle_epi8(px0, g_mask),
+                              _mm_shuffle_epi8(px1, g_mask));
+    __m128i b = _mm_add_epi32(_mm_shuffle_epi8(px0, b_mask),
+                              _mm_shuffle_epi8(px1, b_mask));
+    r = _mm_hadd_epi32(r, r);
+    g = _mm_hadd_epi32(g, g);
+    b = _mm_hadd_epi32(b, b);
+
+    const __m128i c32 = chroma_mean2_sse(Arithmetic(), r, g, b);
+    const __m128i c16 = _mm_packus_epi32(c32, zero);
+    store_u32(uv + x, _mm_packus_epi16(c16, zero));
+  }
+
+  rgb_rows_to_uv_box_scalar<Arithmetic>(rgb0, rgb1, x, width, uv);
+}
+
+template <typename Arithmetic>
+__attribute__((target("sse4.1"))) void nv12_row_to_rgb_sse41(
+    const uint8_t* y,
+    const uint8_t* uv,
+    const std::size_t width,
+    uint8_t* rgb) {
+  const int y_offset = Arithmetic::coefficients().y_offset;
+  std::size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i c, d, e, r, g, b;
+    load_nv12_4(y + x, uv + x, y_offset, &c, &d, &e);
+    rgb4_sse(Arithmetic(), c, d, e, &r, &g, &b);
+    store_rgb4(rgb + x * 3, r, g, b);
+  }
+
+  nv12_row_to_rgb_scalar<Arithmetic>(y, uv, x, width, rgb);
+}
+
+// Sixteen pairs at a time: gather each half's Cb bytes into its low
+// eight and Cr bytes into its high eight, then recombine the halves
+__attribute__((target("sse4.1"))) void nv12_uv_split_sse41(
+    const uint8_t* uv,
+    const std::size_t pairs,
+    uint8_t* u,
+    uint8_t* v) {
+  const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3,
+                                             5, 7, 9, 11, 13, 15);
+  std::size_t x = 0;
+  for (; x + 16 <= pairs; x += 16) {
+    const __m128i a = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x * 2)),
+        deinterleave);
+    const __m128i b = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x * 2 + 16)),
+        deinterleave);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x),
+                     _mm_unpacklo_epi64(a, b));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(v + x),
+                     _mm_unpackhi_epi64(a, b));
+  }
+
+  nv12_uv_split_scalar(uv, x, pairs, u, v);
+}
+
+__attribute__((target("sse4.1"))) void nv12_uv_merge_sse41(
+    const uint8_t* u,
+    const uint8_t* v,
+    const std::size_t pairs,
+    uint8_t* uv) {
+  std::size_t x = 0;
+  for (; x + 16 <= pairs; x += 16) {
+    const __m128i cb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(u + x));
+    const __m128i cr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + x));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + x * 2),
+                     _mm_unpacklo_epi8(cb, cr));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + x * 2 + 16),
+                     _mm_unpackhi_epi8(cb, cr));
+  }
+
+  nv12_uv_merge_scalar(u, v, x, pairs, uv);
+}
+
+// AVX2 arithmetic, eight pixels at a time
+
+__attribute__((target("avx2"))) inline __m256d affine_avx2(
+    const __m256d r,
+    const __m256d g,
+    const __m256d b,
+    const double cr,
+    const double cg,
+    const double cb,
+    const double offset) {
+  __m256d v = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(cr), r),
+                            _mm256_mul_pd(_mm256_set1_pd(cg), g));
+  v = _mm256_add_pd(v, _mm256_mul_pd(_mm256_set1_pd(cb), b));
+  return _mm256_add_pd(v, _mm256_set1_pd(offset));
+}
+
+// As fixed_affine_sse(), with a coefficient per lane
+__attribute__((target("avx2"))) inline __m256i fixed_affine_avx2(
+    const __m256i r,
+    const __m256i g,
+    const __m256i b,
+    const __m256i cr,
+    const __m256i cg,
+    const __m256i cb,
+    const int offset) {
+  __m256i v = _mm256_add_epi32(_mm256_mullo_epi32(cr, r),
+                               _mm256_mullo_epi32(cg, g));
+  v = _mm256_add_epi32(v, _mm256_mullo_epi32(cb, b));
+  v = _mm256_srai_epi32(_mm256_add_epi32(v, _mm256_set1_epi32(128)), 8);
+  return _mm256_add_epi32(v, _mm256_set1_epi32(offset));
+}
+
+__attribute__((target("avx2"))) inline __m256i fixed_affine_avx2(
+    const __m256i r,
+    const __m256i g,
+    const __m256i b,
+    const int cr,
+    const int cg,
+    const int cb,
+    const int offset) {
+  return fixed_affine_avx2(r, g, b, _mm256_set1_epi32(cr),
+                           _mm256_set1_epi32(cg), _mm256_set1_epi32(cb),
+                           offset);
+}
+
+// As fixed_mean_sse(), eight lanes at a time
+__attribute__((target("avx2"))) inline __m256i fixed_mean_avx2(
+    const __m256i sum) {
+  return _mm256_srai_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(2)), 2);
+}
+
+__attribute__((target("avx2"))) inline __m128i truncate_avx2(
+    const __m256d v) {
+  return _mm_cvttps_epi32(_mm256_cvtpd_ps(v));
+}
+
+__attribute__((target("avx2"))) inline __m256i combine_avx2(
+    const __m128i lo,
+    const __m128i hi) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+// As load_nv12_4(), for eight luma bytes and the four CbCr pairs they
+// share
+__attribute__((target("avx2"))) inline void load_nv12_8(const uint8_t* y,
+                                                         const uint8_t* uv,
+                                                         const int y_offset,
+                                                         __m256i* c,
+                                                         __m256i* d,
+                                                         __m256i* e) {
+  const __m128i uv64 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(uv));
+  const __m128i cb_mask =
+      _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m128i cr_mask =
+      _mm_setr_epi8(1, 1, 3, 3, 5, 5, 7, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+  const __m256i offset_128 = _mm256_set1_epi32(128);
+  *c = _mm256_sub_epi32(
+      _mm256_cvtepu8_epi32(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(y))),
+      _mm256_set1_epi32(y_offset));
+  *d = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_shuffle_epi8(uv64, cb_mask)),
+                        offset_128);
+  *e = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_shuffle_epi8(uv64, cr_mask)),
+                        offset_128);
+}
+
+// As store_rgb4(), for eight pixels (24 bytes). The packs and shuffle
+// work within 128-bit lanes, leaving each half's 12 bytes at the bottom
+// of its lane; a cross-lane permute closes the gap.
+__attribute__((target("avx2"))) inline void store_rgb8(uint8_t* p,
+                                                       const __m256i r,
+                                                       const __m256i g,
+                                                       const __m256i b) {
+  const __m256i planar =
+      _mm256_packus_epi16(_mm256_packus_epi32(r, g),
+                          _mm256_packus_epi32(b, _mm256_setzero_si256()));
+  const __m256i packed = _mm256_permutevar8x32_epi32(
+      _mm256_shuffle_epi8(
+          planar, _mm256_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1,
+                                   -1, -1, -1, 0, 4, 8, 1, 5, 9, 2, 6, 10, 3,
+                                   7, 11, -1, -1, -1, -1)),
+      _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+                   _mm256_castsi256_si128(packed));
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 16),
+                   _mm256_extracti128_si256(packed, 1));
+}
+
+// Luma of pixels 0-3 (|a|) and 4-7 (|b|), packed to 16-bit lanes
+template <typename Matrix>
+__attribute__((target("avx2"))) inline __m128i luma8_avx2(
+    FloatArithmetic<Matrix>,
+    const __m128i r_a,
+    const __m128i g_a,
+    const __m128i b_a,
+    const __m128i r_b,
+    const __m128i g_b,
+    const __m128i b_b) {
+  const ColorMatrix m = Matrix::coefficients();
+  const __m256d y_a =
+      affine_avx2(_mm256_cvtepi32_pd(r_a), _mm256_cvtepi32_pd(g_a),
+                  _mm256_cvtepi32_pd(b_a), m.y_r, m.y_g, m.y_b, m.y_offset);
+  const __m256d y_b =
+      affine_avx2(_mm256_cvtepi32_pd(r_b), _mm256_cvtepi32_pd(g_b),
+                  _mm256_cvtepi32_pd(b_b), m.y_r, m.y_g, m.y_b, m.y_offset);
+  return _mm_packus_epi32(truncate_avx2(y_a), truncate_avx2(y_b));
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) inline __m128i luma8_avx2(
+    FixedPointArithmetic<Matrix>,
+    const __m128i r_a,
+    const __m128i g_a,
+    const __m128i b_a,
+    const __m128i r_b,
+    const __m128i g_b,
+    const __m128i b_b) {
+  const FixedColorMatrix m = FixedPointArithmetic<Matrix>::coefficients();
+  const __m256i y = fixed_affine_avx2(
+      combine_avx2(r_a, r_b), combine_avx2(g_a, g_b), combine_avx2(b_a, b_b),
+      m.y_r, m.y_g, m.y_b, m.y_offset);
+  return _mm_packus_epi32(_mm256_castsi256_si128(y),
+                          _mm256_extracti128_si256(y, 1));
+}
+
+__attribute__((target("avx2"))) inline void chroma4_avx2_pd(
+    const ColorMatrix& m,
+    const __m256d r,
+    const __m256d g,
+    const __m256d b,
+    __m128i* cb,
+    __m128i* cr) {
+  *cb = truncate_avx2(affine_avx2(r, g, b, m.cb_r, m.cb_g, m.cb_b, 128));
+  *cr = truncate_avx2(affine_avx2(r, g, b, m.cr_r, m.cr_g, m.cr_b, 128));
+}
+
+// Cb and Cr of four pixels as 32-bit lanes
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void chroma4_avx2(
+    FloatArithmetic<Matrix>,
+    const __m128i r,
+    const __m128i g,
+    const __m128i b,
+    __m128i* cb,
+    __m128i* cr) {
+  chroma4_avx2_pd(Matrix::coefficients(), _mm256_cvtepi32_pd(r),
+                  _mm256_cvtepi32_pd(g), _mm256_cvtepi32_pd(b), cb, cr);
+}
+
+// Cb of four pixels in the low lane and Cr in the high lane, given each
+// channel in both lanes
+__attribute__((target("avx2"))) inline void fixed_chroma4_avx2(
+    const FixedColorMatrix& m,
+    const __m256i r,
+    const __m256i g,
+    const __m256i b,
+    __m128i* cb,
+    __m128i* cr) {
+  const __m256i cbcr = fixed_affine_avx2(
+      r, g, b, combine_avx2(_mm_set1_epi32(m.cb_r), _mm_set1_epi32(m.cr_r)),
+      combine_avx2(_mm_set1_epi32(m.cb_g), _mm_set1_epi32(m.cr_g)),
+      combine_avx2(_mm_set1_epi32(m.cb_b), _mm_set1_epi32(m.cr_b)), 128);
+  *cb = _mm256_castsi256_si128(cbcr);
+  *cr = _mm256_extracti128_si256(cbcr, 1);
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void chroma4_avx2(
+    FixedPointArithmetic<Matrix>,
+    const __m128i r,
+    const __m128i g,
+    const __m128i b,
+    __m128i* cb,
+    __m128i* cr) {
+  fixed_chroma4_avx2(FixedPointArithmetic<Matrix>::coefficients(),
+                     combine_avx2(r, r), combine_avx2(g, g),
+                     combine_avx2(b, b), cb, cr);
+}
+
+// chroma4_avx2() of the means of four 2x2 blocks, given the sums of their
+// pixels' channels
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void chroma_mean4_avx2(
+    FloatArithmetic<Matrix>,
+    const __m128i r_sum,
+    const __m128i g_sum,
+    const __m128i b_sum,
+    __m128i* cb,
+    __m128i* cr) {
+  const __m256d quarter = _mm256_set1_pd(0.25);
+  chroma4_avx2_pd(Matrix::coefficients(),
+                  _mm256_mul_pd(_mm256_cvtepi32_pd(r_sum), quarter),
+                  _mm256_mul_pd(_mm256_cvtepi32_pd(g_sum), quarter),
+                  _mm256_mul_pd(_mm256_cvtepi32_pd(b_sum), quarter), cb, cr);
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void chroma_mean4_avx2(
+    FixedPointArithmetic<Matrix>,
+    const __m128i r_sum,
+    const __m128i g_sum,
+    const __m128i b_sum,
+    __m128i* cb,
+    __m128i* cr) {
+  fixed_chroma4_avx2(FixedPointArithmetic<Matrix>::coefficients(),
+                     fixed_mean_avx2(combine_avx2(r_sum, r_sum)),
+                     fixed_mean_avx2(combine_avx2(g_sum, g_sum)),
+                     fixed_mean_avx2(combine_avx2(b_sum, b_sum)), cb, cr);
+}
+
+__attribute__((target("avx2"))) inline __m256d linear2_avx2(
+    const __m256d a,
+    const __m256d b,
+    const double ca,
+    const double cb) {
+  return _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(ca), a),
+                       _mm256_mul_pd(_mm256_set1_pd(cb), b));
+}
+
+// RGB of four pixels from their offset-removed Y, Cb and Cr
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void rgb4_avx2(
+    FloatArithmetic<Matrix>,
+    const __m128i c,
+    const __m128i d,
+    const __m128i e,
+    __m128i* r,
+    __m128i* g,
+    __m128i* b) {
+  const ColorMatrix m = Matrix::coefficients();
+  const __m256d cd = _mm256_cvtepi32_pd(c);
+  const __m256d dd = _mm256_cvtepi32_pd(d);
+  const __m256d ed = _mm256_cvtepi32_pd(e);
+  const __m256d red = linear2_avx2(cd, ed, m.y_scale, m.r_cr);
+  const __m256d green =
+      _mm256_add_pd(linear2_avx2(cd, ed, m.y_scale, m.g_cr),
+                    _mm256_mul_pd(_mm256_set1_pd(m.g_cb), dd));
+  const __m256d blue = linear2_avx2(cd, dd, m.y_scale, m.b_cb);
+  *r = clamp_truncate_sse(_mm256_cvtpd_ps(red));
+  *g = clamp_truncate_sse(_mm256_cvtpd_ps(green));
+  *b = clamp_truncate_sse(_mm256_cvtpd_ps(blue));
+}
+
+// Only nv12_row_to_rgb_avx2()'s four-pixel tail takes this path, which
+// is no wider than SSE4.1's
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void rgb4_avx2(
+    FixedPointArithmetic<Matrix>,
+    const __m128i c,
+    const __m128i d,
+    const __m128i e,
+    __m128i* r,
+    __m128i* g,
+    __m128i* b) {
+  rgb4_sse(FixedPointArithmetic<Matrix>(), c, d, e, r, g, b);
+}
+
+// RGB of eight pixels. Floating point goes through rgb4_avx2() a half at
+// a time, since its doubles only fit four to a register.
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void rgb8_avx2(
+    FloatArithmetic<Matrix>,
+    const __m256i c,
+    const __m256i d,
+    const __m256i e,
+    __m256i* r,
+    __m256i* g,
+    __m256i* b) {
+  __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+  rgb4_avx2(FloatArithmetic<Matrix>(), _mm256_castsi256_si128(c),
+            _mm256_castsi256_si128(d), _mm256_castsi256_si128(e), &r_lo,
+            &g_lo, &b_lo);
+  rgb4_avx2(FloatArithmetic<Matrix>(), _mm256_extracti128_si256(c, 1),
+            _mm256_extracti128_si256(d, 1), _mm256_extracti128_si256(e, 1),
+            &r_hi, &g_hi, &b_hi);
+  *r = combine_avx2(r_lo, r_hi);
+  *g = combine_avx2(g_lo, g_hi);
+  *b = combine_avx2(b_lo, b_hi);
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void rgb8_avx2(
+    FixedPointArithmetic<Matrix>,
+    const __m256i c,
+    const __m256i d,
+    const __m256i e,
+    __m256i* r,
+    __m256i* g,
+    __m256i* b) {
+  const FixedColorMatrix m = FixedPointArithmetic<Matrix>::coefficients();
+  const __m256i zero = _mm256_setzero_si256();
+  *r = fixed_affine_avx2(c, e, zero, m.y_scale, m.r_cr, 0, 0);
+  *g = fixed_affine_avx2(c, e, d, m.y_scale, m.g_cr, m.g_cb, 0);
+  *b = fixed_affine_avx2(c, d, zero, m.y_scale, m.b_cb, 0, 0);
+}
+
+template <typename Arithmetic>
+__attribute__((target("avx2"))) void rgb_row_to_y_uv_avx2(
+    const uint8_t* rgb,
+    const std::size_t width,
+    uint8_t* y,
+    uint8_t* uv) {
+  const __m128i r_mask = channel_mask(0);
+  const __m128i g_mask = channel_mask(1);
+  const __m128i b_mask = channel_mask(2);
+  const __m128i r_odd_lo = odd_channel_mask(0, false);
+  const __m128i g_odd_lo = odd_channel_mask(1, false);
+  const __m128i b_odd_lo = odd_channel_mask(2, false);
+  const __m128i r_odd_hi = odd_channel_mask(0, true);
+  const __m128i g_odd_hi = odd_channel_mask(1, true);
+  const __m128i b_odd_hi = odd_channel_mask(2, true);
+
+  std::size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m128i px_a = load_rgb4(rgb + x * 3);
+    const __m128i px_b = load_rgb4(rgb + x * 3 + 12);
+
+    const __m128i y16 = luma8_avx2(
+        Arithmetic(), _mm_shuffle_epi8(px_a, r_mask),
+        _mm_shuffle_epi8(px_a, g_mask), _mm_shuffle_epi8(px_a, b_mask),
+        _mm_shuffle_epi8(px_b, r_mask), _mm_shuffle_epi8(px_b, g_mask),
+        _mm_shuffle_epi8(px_b, b_mask));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(y + x),
+                     _mm_packus_epi16(y16, y16));
+
+    if (uv) {
+      __m128i cb, cr;
+      chroma4_avx2(Arithmetic(),
+                   _mm_or_si128(_mm_shuffle_epi8(px_a, r_odd_lo),
+                                _mm_shuffle_epi8(px_b, r_odd_hi)),
+                   _mm_or_si128(_mm_shuffle_epi8(px_a, g_odd_lo),
+                                _mm_shuffle_epi8(px_b, g_odd_hi)),
+                   _mm_or_si128(_mm_shuffle_epi8(px_a, b_odd_lo),
+                                _mm_shuffle_epi8(px_b, b_odd_hi)),
+                   &cb, &cr);
+      const __m128i c16 = _mm_packus_epi32(_mm_unpacklo_epi32(cb, cr),
+                                           _mm_unpackhi_epi32(cb, cr));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(uv + x),
+                       _mm_packus_epi16(c16, c16));
+    }
+  }
+
+  rgb_row_to_y_uv_scalar<Arithmetic>(rgb, x, width, y, uv);
+}
+
+template <typename Arithmetic>
+__attribute__((target("avx2"))) void rgb_rows_to_uv_box_avx2(
+    const uint8_t* rgb0,
+    const uint8_t* rgb1,
+    const std::size_t width,
+    uint8_t* uv) {
+  const __m128i r_mask = channel_mask(0);
+  const __m128i g_mask = channel_mask(1);
+  const __m128i b_mask = channel_mask(2);
+
+  std::size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m128i px0_a = load_rgb4(rgb0 + x * 3);
+    const __m128i px0_b = load_rgb4(rgb0 + x * 3 + 12);
+    const __m128i px1_a = load_rgb4(rgb1 + x * 3);
+    const __m128i px1_b = load_rgb4(rgb1 + x * 3 + 12);
+
+    // Column sums of pixels 0-3 and 4-7, then the four block sums in order
+    const __m128i r = _mm_hadd_epi32(
+        _mm_add_epi32(_mm_shuffle_epi8(px0_a, r_mask),
+                      _mm_shuffle_epi8(px1_a, r_mask)),
+        _mm_add_epi32(_mm_shuffle_epi8(px0_b, r_mask),
+                      _mm_shuffle_epi8(px1_b, r_mask)));
+    const __m128i g = _mm_hadd_epi32(
+        _mm_add_epi32(_mm_shuffle_epi8(px0_a, g_mask),
+                      _mm_shuffle_epi8(px1_a, g_mask)),
+        _mm_add_epi32(_mm_shuffle_epi8(px0_b, g_mask),
+                      _mm_shuffle_epi8(px1_b, g_mask)));
+    const __m128i b = _mm_hadd_epi32(
+        _mm_add_epi32(_mm_shuffle_epi8(px0_a, b_mask),
+                      _mm_shuffle_epi8(px1_a, b_mask)),
+        _mm_add_epi32(_mm_shuffle_epi8(px0_b, b_mask),
+                      _mm_shuffle_epi8(px1_b, b_mask)));
+
+    __m128i cb, cr;
+    chroma_mean4_avx2(Arithmetic(), r, g, b, &cb, &cr);
+    const __m128i c16 = _mm_packus_epi32(_mm_unpacklo_epi32(cb, cr),
+                                         _mm_unpackhi_epi32(cb, cr));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(uv + x),
+                     _mm_packus_epi16(c16, c16));
+  }
+
+  rgb_rows_to_uv_box_scalar<Arithmetic>(rgb0, rgb1, x, width, uv);
+}
+
+template <typename Arithmetic>
+__attribute__((target("avx2"))) void nv12_row_to_rgb_avx2(
+    const uint8_t* y,
+    const uint8_t* uv,
+    const std::size_t width,
+    uint8_t* rgb) {
+  const int y_offset = Arithmetic::coefficients().y_offset;
+  std::size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i c, d, e, r, g, b;
+    load_nv12_8(y + x, uv + x, y_offset, &c, &d, &e);
+    rgb8_avx2(Arithmetic(), c, d, e, &r, &g, &b);
+    store_rgb8(rgb + x * 3, r, g, b);
+  }
+  if (x + 4 <= width) {
+    __m128i c, d, e, r, g, b;
+    load_nv12_4(y + x, uv + x, y_offset, &c, &d, &e);
+    rgb4_avx2(Arithmetic(), c, d, e, &r, &g, &b);
+    store_rgb4(rgb + x * 3, r, g, b);
+    x += 4;
+  }
+
+  nv12_row_to_rgb_scalar<Arithmetic>(y, uv, x, width, rgb);
+}
+
+// As the SSE4.1 version, 32 pairs at a time. The byte shuffles and
+// unpacks work within 128-bit lanes, so the quadwords come out of order
+// and are put back with a cross-lane permute.
+__attribute__((target("avx2"))) void nv12_uv_split_avx2(
+    const uint8_t* uv,
+    const std::size_t pairs,
+    uint8_t* u,
+    uint8_t* v) {
+  const __m256i deinterleave = _mm256_setr_epi8(
+      0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0, 2, 4, 6, 8, 10,
+      12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  std::size_t x = 0;
+  for (; x + 32 <= pairs; x += 32) {
+    const __m256i a = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(uv + x * 2)),
+        deinterleave);
+    const __m256i b = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(uv + x * 2 + 32)),
+        deinterleave);
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(u + x),
+        _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xd8));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(v + x),
+        _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xd8));
+  }
+
+  nv12_uv_split_scalar(uv, x, pairs, u, v);
+}
+
+__attribute__((target("avx2"))) void nv12_uv_merge_avx2(
+    const uint8_t* u,
+    const uint8_t* v,
+    const std::size_t pairs,
+    uint8_t* uv) {
+  std::size_t x = 0;
+  for (; x + 32 <= pairs; x += 32) {
+    const __m256i cb =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + x));
+    const __m256i cr =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + x));
+    const __m256i lo = _mm256_unpacklo_epi8(cb, cr);
+    const __m256i hi = _mm256_unpackhi_epi8(cb, cr);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv + x * 2),
+                        _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(uv + x * 2 + 32),
+                        _mm256_permute2x128_si256(lo, hi, 0x31));
+  }
+
+  nv12_uv_merge_scalar(u, v, x, pairs, uv);
+}
+
+#endif  // VADEM_X86_SIMD
+
+// Convert one RGB row to luma, plus chroma from the odd pixels when |uv|
+// is non-null.
+template <typename Arithmetic>
+void rgb_row_to_y_uv(const uint8_t* rgb,
+                     const std::size_t width,
+                     uint8_t* y,
+                     uint8_t* uv) {
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      rgb_row_to_y_uv_avx2<Arithmetic>(rgb, width, y, uv);
+      return;
+    case SimdLevel::kSse41:
+      rgb_row_to_y_uv_sse41<Arithmetic>(rgb, width, y, uv);
+      return;
+#endif
+    default:
+      rgb_row_to_y_uv_scalar<Arithmetic>(rgb, 0, width, y, uv);
+      return;
+  }
+}
+
+template <typename Arithmetic>
+void rgb_rows_to_uv_box(const uint8_t* rgb0,
+                        const uint8_t* rgb1,
+                        const std::size_t width,
+                        uint8_t* uv) {
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      rgb_rows_to_uv_box_avx2<Arithmetic>(rgb0, rgb1, width, uv);
+      return;
+    case SimdLevel::kSse41:
+      rgb_rows_to_uv_box_sse41<Arithmetic>(rgb0, rgb1, width, uv);
+      return;
+#endif
+    default:
+      rgb_rows_to_uv_box_scalar<Arithmetic>(rgb0, rgb1, 0, width, uv);
+      return;
+  }
+}
+
+SimdLevel cpu_simd_level() {
+#ifdef VADEM_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return SimdLevel::kAvx2;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    return SimdLevel::kSse41;
+  }
+#endif
+  return SimdLevel::kScalar;
+}
+
+std::atomic<int> forced_simd_level(-1);
+
+}  // namespace
+
+SimdLevel simd_level_detect() {
+  static const SimdLevel detected = cpu_simd_level();
+  return detected;
+}
+
+SimdLevel simd_level() {
+  const int forced = forced_simd_level.load(std::memory_order_relaxed);
+  return (forced < 0) ? simd_level_detect() : static_cast<SimdLevel>(forced);
+}
+
+void simd_level_set(const SimdLevel level) {
+  const SimdLevel detected = simd_level_detect();
+  forced_simd_level.store(
+      static_cast<int>((level > detected) ? detected : level),
+      std::memory_order_relaxed);
+}
+
+const char* simd_level_name(const SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kScalar:
+      return "scalar";
+    case SimdLevel::kSse41:
+      return "sse4.1";
+    case SimdLevel::kAvx2:
+      return "avx2";
+  }
+  return "unknown";
+}
+
+template <typename Arithmetic>
+void rgb_rows_to_nv12(const uint8_t* rgb0,
+                      const uint8_t* rgb1,
+                      const std::size_t width,
+                      uint8_t* y0,
+                      uint8_t* y1,
+                      uint8_t* uv,
+                      const ChromaFilter filter) {
+  rgb_row_to_y_uv<Arithmetic>(rgb0, width, y0, nullptr);
+  switch (filter) {
+    case ChromaFilter::kSample:
+      rgb_row_to_y_uv<Arithmetic>(rgb1, width, y1, uv);
+      return;
+    case ChromaFilter::kBox:
+      rgb_row_to_y_uv<Arithmetic>(rgb1, width, y1, nullptr);
+      rgb_rows_to_uv_box<Arithmetic>(rgb0, rgb1, width, uv);
+      return;
+  }
+}
+
+template <typename Arithmetic>
+void nv12_row_to_rgb(const uint8_t* y,
+                     const uint8_t* uv,
+                     const std::size_t width,
+                     uint8_t* rgb) {
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      nv12_row_to_rgb_avx2<Arithmetic>(y, uv, width, rgb);
+      return;
+    case SimdLevel::kSse41:
+      nv12_row_to_rgb_sse41<Arithmetic>(y, uv, width, rgb);
+      return;
+#endif
+    default:
+      nv12_row_to_rgb_scalar<Arithmetic>(y, uv, 0, width, rgb);
+      return;
+  }
+}
+
+void rgbx_row_to_rgb(const uint8_t* rgbx,
+                     const std::size_t width,
+                     uint8_t* rgb) {
+  for (std::size_t x = 0; x < width; x++) {
+    memcpy(rgb + x * 3, rgbx + x * 4, 3);
+  }
+}
+
+void rgb_row_to_rgbx(const uint8_t* rgb,
+                     const std::size_t width,
+                     uint8_t* rgbx) {
+  for (std::size_t x = 0; x < width; x++) {
+    memcpy(rgbx + x * 4, rgb + x * 3, 3);
+  }
+}
+
+void nv12_uv_split(const uint8_t* uv,
+                   const std::size_t pairs,
+                   uint8_t* u,
+                   uint8_t* v) {
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      nv12_uv_split_avx2(uv, pairs, u, v);
+      return;
+    case SimdLevel::kSse41:
+      nv12_uv_split_sse41(uv, pairs, u, v);
+      return;
+#endif
+    default:
+      nv12_uv_split_scalar(uv, 0, pairs, u, v);
+      return;
+  }
+}
+
+void nv12_uv_merge(const uint8_t* u,
+                   const uint8_t* v,
+                   const std::size_t pairs,
+                   uint8_t* uv) {
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      nv12_uv_merge_avx2(u, v, pairs, uv);
+      return;
+    case SimdLevel::kSse41:
+      nv12_uv_merge_sse41(u, v, pairs, uv);
+      return;
+#endif
+    default:
+      nv12_uv_merge_scalar(u, v, 0, pairs, uv);
+      return;
+  }
+}
+
+#define INSTANTIATE(Arithmetic)                                        \
+  template void rgb_rows_to_nv12<Arithmetic>(                          \
+      const uint8_t*, const uint8_t*, std::size_t, uint8_t*, uint8_t*, \
+      uint8_t*, ChromaFilter);                                         \
+  template void nv12_row_to_rgb<Arithmetic>(                           \
+      const uint8_t*, const uint8_t*, std::size_t, uint8_t*);
+
+VADEM_FOR_EACH_ARITHMETIC(INSTANTIATE)
+#undef INSTANTIATE
+}
@@ -0,0 +1,115 @@
+// Copyright 2017 Neverware
+
+#ifndef CONVERT_H_
+#define CONVERT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "color.h"
+
+namespace vadem {
+
+// Instruction sets the row conversion kernels are built for, from
+// slowest to fastest.
+enum class SimdLevel { kScalar, kSse41, kAvx2 };
+
+// Best level supported by the running CPU.
+SimdLevel simd_level_detect();
+
+// Level the kernels currently dispatch to. Defaults to
+// simd_level_detect().
+SimdLevel simd_level();
+
+// Force the kernels down to |level| (e.g. to compare implementations);
+// levels the CPU doesn't support are clamped to simd_level_detect().
+void simd_level_set(SimdLevel level);
+
+const char* simd_level_name(SimdLevel level);
+
+// How rgb_rows_to_nv12() decimates chroma to one CbCr pair per 2x2
+// block of pixels.
+enum class ChromaFilter {
+  // Chroma of the bottom-right pixel only, which is what per-pixel
+  // Nv12Buffer::set_pixel() ends up storing
+  kSample,
+  // Chroma of the mean of all four pixels
+  kBox,
+};
+
+// Convert a pair of RGB rows (three bytes per pixel, |width| pixels each)
+// to two rows of NV12 luma and one row of interleaved CbCr, each CbCr
+// pair stored once. |width| must be even.
+//
+// The result is bit-exact with BasicYCbCr<Arithmetic>::from_rgb() (of
+// Arithmetic::mean() of the block for kBox) at every SimdLevel, as
+// src/test.cc checks. Instantiated for every policy in
+// VADEM_FOR_EACH_ARITHMETIC.
+template <typename Arithmetic = FloatArithmetic<>>
+void rgb_rows_to_nv12(const uint8_t* rgb0,
+                      const uint8_t* rgb1,
+                      std::size_t width,
+                      uint8_t* y0,
+                      uint8_t* y1,
+                      uint8_t* uv,
+                      ChromaFilter filter = ChromaFilter::kBox);
+
+// Convert one row of NV12 luma and the row of interleaved CbCr it shares
+// with its neighbour to RGB (three bytes per pixel). |width| must be even.
+// Bit-exact with BasicYCbCr<Arithmetic>::to_rgb() at every SimdLevel.
+template <typename Arithmetic = FloatArithmetic<>>
+void nv12_row_to_rgb(const uint8_t* y,
+                     const uint8_t* uv,
+                     std::size_t width,
+                     uint8_t* rgb);
+
+// 16-bit counterparts of rgb_rows_to_nv12() and nv12_row_to_rgb() for
+// P010 and P016, with RGB as three uint16_t per pixel (png::rgb_pixel_16
+// in host byte order) and luma and CbCr as uint16_t samples. Full-scale
+// 16-bit RGB maps to full-scale 16-bit YCbCr. Samples are rounded to
+// their top |bits| bits, 10 for P010 and 16 for P016, with the rest left
+// zero as P010 stores them.
+//
+// The coefficients are Matrix's scaled by 8192 rather than 256, which
+// keeps every product in a 32-bit lane. Every SimdLevel gives the same
+// samples as the scalar path. Instantiated for every matrix in
+// VADEM_FOR_EACH_MATRIX.
+template <typename Matrix = Bt2020Limited>
+void rgb16_rows_to_p016(const uint16_t* rgb0,
+                        const uint16_t* rgb1,
+                        std::size_t width,
+                        uint16_t* y0,
+                        uint16_t* y1,
+                        uint16_t* uv,
+                        unsigned bits = 16,
+                        ChromaFilter filter = ChromaFilter::kBox);
+
+// Any |bits| of sample converts as is, the low bits of P010 being zero
+template <typename Matrix = Bt2020Limited>
+void p016_row_to_rgb16(const uint16_t* y,
+                       const uint16_t* uv,
+                       std::size_t width,
+                       uint16_t* rgb);
+
+// Drop the padding byte of each RGBX pixel in a row, or add it (leaving
+// the padding bytes of |rgbx| untouched).
+void rgbx_row_to_rgb(const uint8_t* rgbx, std::size_t width, uint8_t* rgb);
+
+void rgb_row_to_rgbx(const uint8_t* rgb, std::size_t width, uint8_t* rgbx);
+
+// Split an interleaved NV12 chroma row of |pairs| CbCr pairs into
+// separate Cb and Cr rows, as I420 and YV12 store them, or interleave
+// them again. Pure byte moves, vectorized at every SimdLevel above
+// kScalar.
+void nv12_uv_split(const uint8_t* uv,
+                   std::size_t pairs,
+                   uint8_t* u,
+                   uint8_t* v);
+
+void nv12_uv_merge(const uint8_t* u,
+                   const uint8_t* v,
+                   std::size_t pairs,
+                   uint8_t* uv);
+}
+
+#endif  // CONVERT_H_
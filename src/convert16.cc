@@ -0,0 +1,641 @@
+// Copyright 2017 Neverware
+
+// The 16-bit kernels declared in convert.h: rgb16_rows_to_p016() and
+// p016_row_to_rgb16(). Kept apart from the 8-bit ones since they share
+// no helpers with them beyond the SimdLevel dispatch.
+
+#include "src/convert.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "src/util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VADEM_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace vadem {
+
+namespace {
+
+// As to_fixed(), scaled by 8192. Thirteen fractional bits is as many as
+// fit: the largest sum, y_scale * 65535 plus b_cb * 32768 for
+// Bt709Limited, stays under 2^31.
+constexpr int to_fixed16(const double c) {
+  return (c < 0) ? -static_cast<int>(-c * 8192 + 0.5)
+                 : static_cast<int>(c * 8192 + 0.5);
+}
+
+constexpr FixedColorMatrix to_fixed16(const ColorMatrix& m) {
+  return {to_fixed16(m.y_r),     to_fixed16(m.y_g),  to_fixed16(m.y_b),
+          static_cast<int>(m.y_offset * 256),
+          to_fixed16(m.cb_r),    to_fixed16(m.cb_g), to_fixed16(m.cb_b),
+          to_fixed16(m.cr_r),    to_fixed16(m.cr_g), to_fixed16(m.cr_b),
+          to_fixed16(m.y_scale), to_fixed16(m.r_cr), to_fixed16(m.g_cr),
+          to_fixed16(m.g_cb),    to_fixed16(m.b_cb)};
+}
+
+const int kChromaOffset16 = 32768;
+
+// FixedPointArithmetic for 16-bit samples. Results are unclamped; see
+// SampleDepth for how they're stored.
+template <typename Matrix>
+struct Fixed16Arithmetic {
+  using T = int;
+
+  static constexpr FixedColorMatrix coefficients() {
+    return to_fixed16(Matrix::coefficients());
+  }
+
+  static T luma(const T R, const T G, const T B) {
+    return descale(coefficients().y_r * R + coefficients().y_g * G +
+                   coefficients().y_b * B) +
+           coefficients().y_offset;
+  }
+
+  static T blue_difference(const T R, const T G, const T B) {
+    return descale(coefficients().cb_r * R + coefficients().cb_g * G +
+                   coefficients().cb_b * B) +
+           kChromaOffset16;
+  }
+
+  static T red_difference(const T R, const T G, const T B) {
+    return descale(coefficients().cr_r * R + coefficients().cr_g * G +
+                   coefficients().cr_b * B) +
+           kChromaOffset16;
+  }
+
+  static T red(const T Y, const T /*Cb*/, const T Cr) {
+    return descale(coefficients().y_scale * (Y - coefficients().y_offset) +
+                   coefficients().r_cr * (Cr - kChromaOffset16));
+  }
+
+  static T green(const T Y, const T Cb, const T Cr) {
+    return descale(coefficients().y_scale * (Y - coefficients().y_offset) +
+                   coefficients().g_cr * (Cr - kChromaOffset16) +
+                   coefficients().g_cb * (Cb - kChromaOffset16));
+  }
+
+  static T blue(const T Y, const T Cb, const T /*Cr*/) {
+    return descale(coefficients().y_scale * (Y - coefficients().y_offset) +
+                   coefficients().b_cb * (Cb - kChromaOffset16));
+  }
+
+  static T mean(const T a, const T b, const T c, const T d) {
+    return (a + b + c + d + 2) >> 2;
+  }
+
+  // Drop the 13 fractional bits, rounding to nearest
+  static T descale(const T val) { return (val + 4096) >> 13; }
+};
+
+// How a sample is stored in the top |bits| bits of a uint16_t: clamped,
+// rounded to nearest (saturating at full scale) and masked. The SIMD
+// kernels do the same with a saturating pack, a saturating add and an
+// and.
+struct SampleDepth {
+  explicit SampleDepth(const unsigned bits) {
+    if (bits == 0 || bits > 16) {
+      throw std::runtime_error("unsupported sample depth: " +
+                               std::to_string(bits));
+    }
+    const unsigned shift = 16 - bits;
+    half = shift ? (1 << (shift - 1)) : 0;
+    mask = 0xffff & ~((1 << shift) - 1);
+  }
+
+  uint16_t store(const int val) const {
+    return std::min(clamp(val, 0, 65535) + half, 65535) & mask;
+  }
+
+  int half;
+  int mask;
+};
+
+uint16_t clamp_65535(const int val) {
+  return clamp(val, 0, 65535);
+}
+
+template <typename Matrix>
+void rgb16_row_to_y_uv_scalar(const uint16_t* rgb,
+                              const std::size_t begin,
+                              const std::size_t end,
+                              uint16_t* y,
+                              uint16_t* uv,
+                              const SampleDepth& depth) {
+  using Arithmetic = Fixed16Arithmetic<Matrix>;
+  for (std::size_t x = begin; x < end; x++) {
+    const uint16_t* px = rgb + x * 3;
+    y[x] = depth.store(Arithmetic::luma(px[0], px[1], px[2]));
+    if (uv && (x & 1)) {
+      uv[x - 1] =
+          depth.store(Arithmetic::blue_difference(px[0], px[1], px[2]));
+      uv[x] = depth.store(Arithmetic::red_difference(px[0], px[1], px[2]));
+    }
+  }
+}
+
+template <typename Matrix>
+void rgb16_rows_to_uv_box_scalar(const uint16_t* rgb0,
+                                 const uint16_t* rgb1,
+                                 const std::size_t begin,
+                                 const std::size_t end,
+                                 uint16_t* uv,
+                                 const SampleDepth& depth) {
+  using Arithmetic = Fixed16Arithmetic<Matrix>;
+  for (std::size_t x = begin; x + 1 < end; x += 2) {
+    const uint16_t* p = rgb0 + x * 3;
+    const uint16_t* q = rgb1 + x * 3;
+    const int r = Arithmetic::mean(p[0], p[3], q[0], q[3]);
+    const int g = Arithmetic::mean(p[1], p[4], q[1], q[4]);
+    const int b = Arithmetic::mean(p[2], p[5], q[2], q[5]);
+    uv[x] = depth.store(Arithmetic::blue_difference(r, g, b));
+    uv[x + 1] = depth.store(Arithmetic::red_difference(r, g, b));
+  }
+}
+
+// Both rows of rgb16_rows_to_p016() from pixel |begin| on. The SIMD
+// kernels do the same in a single pass, gathering each pixel once for
+// its luma and its share of chroma.
+template <typename Matrix>
+void rgb16_rows_to_p016_scalar(const uint16_t* rgb0,
+                               const uint16_t* rgb1,
+                               const std::size_t begin,
+                               const std::size_t end,
+                               uint16_t* y0,
+                               uint16_t* y1,
+                               uint16_t* uv,
+                               const SampleDepth& depth,
+                               const ChromaFilter filter) {
+  rgb16_row_to_y_uv_scalar<Matrix>(rgb0, begin, end, y0, nullptr, depth);
+  switch (filter) {
+    case ChromaFilter::kSample:
+      rgb16_row_to_y_uv_scalar<Matrix>(rgb1, begin, end, y1, uv, depth);
+      return;
+    case ChromaFilter::kBox:
+      rgb16_row_to_y_uv_scalar<Matrix>(rgb1, begin, end, y1, nullptr, depth);
+      rgb16_rows_to_uv_box_scalar<Matrix>(rgb0, rgb1, begin, end, uv, depth);
+      return;
+  }
+}
+
+template <typename Matrix>
+void p016_row_to_rgb16_scalar(const uint16_t* y,
+                              const uint16_t* uv,
+                              const std::size_t begin,
+                              const std::size_t end,
+                              uint16_t* rgb) {
+  using Arithmetic = Fixed16Arithmetic<Matrix>;
+  for (std::size_t x = begin; x < end; x++) {
+    const std::size_t c = x & ~static_cast<std::size_t>(1);
+    uint16_t* px = rgb + x * 3;
+    px[0] = clamp_65535(Arithmetic::red(y[x], uv[c], uv[c + 1]));
+    px[1] = clamp_65535(Arithmetic::green(y[x], uv[c], uv[c + 1]));
+    px[2] = clamp_65535(Arithmetic::blue(y[x], uv[c], uv[c + 1]));
+  }
+}
+
+#ifdef VADEM_X86_SIMD
+
+// Shared load/store helpers. Four packed 16-bit RGB pixels are 24 bytes:
+// a 16-byte head holding words 0-7 and an 8-byte tail holding words
+// 8-11.
+
+// Widen R, G and B of four packed 16-bit pixels to 32-bit lanes without
+// reading past them. Each channel is shuffled out of the head and the
+// tail and the two or'd together. The masks are spelled out so that they
+// fold to constants.
+__attribute__((target("sse4.1"))) inline void load_rgb16_4(const uint16_t* p,
+                                                             __m128i* r,
+                                                             __m128i* g,
+                                                             __m128i* b) {
+  const __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  const __m128i tail =
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 8));
+  *r = _mm_or_si128(
+      _mm_shuffle_epi8(head, _mm_setr_epi8(0, 1, -1, -1, 6, 7, -1, -1, 12, 13,
+                                           -1, -1, -1, -1, -1, -1)),
+      _mm_shuffle_epi8(tail, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                           -1, -1, -1, 2, 3, -1, -1)));
+  *g = _mm_or_si128(
+      _mm_shuffle_epi8(head, _mm_setr_epi8(2, 3, -1, -1, 8, 9, -1, -1, 14, 15,
+                                           -1, -1, -1, -1, -1, -1)),
+      _mm_shuffle_epi8(tail, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                           -1, -1, -1, 4, 5, -1, -1)));
+  *b = _mm_or_si128(
+      _mm_shuffle_epi8(head, _mm_setr_epi8(4, 5, -1, -1, 10, 11, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1, -1)),
+      _mm_shuffle_epi8(tail, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 0,
+                                           1, -1, -1, 6, 7, -1, -1)));
+}
+
+// Pack four pixels' worth of 32-bit R, G and B lanes, saturating to
+// [0, 65535], and store them as 24 bytes of packed 16-bit RGB.
+__attribute__((target("sse4.1"))) inline void store_rgb16_4(uint16_t* p,
+                                                              const __m128i r,
+                                                              const __m128i g,
+                                                              const __m128i b) {
+  // R0-3 G0-3 and B0-3 twice
+  const __m128i rg = _mm_packus_epi32(r, g);
+  const __m128i bb = _mm_packus_epi32(b, b);
+  const __m128i head = _mm_or_si128(
+      _mm_shuffle_epi8(rg, _mm_setr_epi8(0, 1, 8, 9, -1, -1, 2, 3, 10, 11, -1,
+                                         -1, 4, 5, 12, 13)),
+      _mm_shuffle_epi8(bb, _mm_setr_epi8(-1, -1, -1, -1, 0, 1, -1, -1, -1, -1,
+                                         2, 3, -1, -1, -1, -1)));
+  const __m128i tail = _mm_or_si128(
+      _mm_shuffle_epi8(rg, _mm_setr_epi8(-1, -1, 6, 7, 14, 15, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1)),
+      _mm_shuffle_epi8(bb, _mm_setr_epi8(4, 5, -1, -1, -1, -1, 6, 7, -1, -1,
+                                         -1, -1, -1, -1, -1, -1)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), head);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 8), tail);
+}
+
+// SampleDepth::store() of eight 32-bit lanes, four in |a| and four in
+// |b|, as eight 16-bit lanes
+__attribute__((target("sse4.1"))) inline __m128i store_depth8(
+    const __m128i a,
+    const __m128i b,
+    const SampleDepth& depth) {
+  const __m128i half = _mm_set1_epi16(static_cast<int16_t>(depth.half));
+  const __m128i mask = _mm_set1_epi16(static_cast<int16_t>(depth.mask));
+  return _mm_and_si128(_mm_adds_epu16(_mm_packus_epi32(a, b), half), mask);
+}
+
+// SSE4.1 arithmetic, four pixels at a time
+
+// ((cr * r + cg * g + cb * b + 4096) >> 13) + offset
+__attribute__((target("sse4.1"))) inline __m128i dot3_fixed16_sse(
+    const __m128i r,
+    const __m128i g,
+    const __m128i b,
+    const int cr,
+    const int cg,
+    const int cb,
+    const int offset) {
+  const __m128i sum =
+      _mm_add_epi32(_mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(cr)),
+                                  _mm_mullo_epi32(g, _mm_set1_epi32(cg))),
+                    _mm_mullo_epi32(b, _mm_set1_epi32(cb)));
+  return _mm_add_epi32(
+      _mm_srai_epi32(_mm_add_epi32(sum, _mm_set1_epi32(4096)), 13),
+      _mm_set1_epi32(offset));
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i luma4_16_sse(
+    const __m128i r,
+    const __m128i g,
+    const __m128i b) {
+  constexpr FixedColorMatrix m = Fixed16Arithmetic<Matrix>::coefficients();
+  return dot3_fixed16_sse(r, g, b, m.y_r, m.y_g, m.y_b, m.y_offset);
+}
+
+// Cb and Cr of the pixels in lanes 0 and 1, interleaved as Cb Cr Cb Cr
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline __m128i chroma2_16_sse(
+    const __m128i r,
+    const __m128i g,
+    const __m128i b) {
+  constexpr FixedColorMatrix m = Fixed16Arithmetic<Matrix>::coefficients();
+  return _mm_unpacklo_epi32(
+      dot3_fixed16_sse(r, g, b, m.cb_r, m.cb_g, m.cb_b, kChromaOffset16),
+      dot3_fixed16_sse(r, g, b, m.cr_r, m.cr_g, m.cr_b, kChromaOffset16));
+}
+
+// (sum + 2) >> 2 of the sums in lanes 0 and 1 of |v| and |w|'s
+// neighbouring columns, as Fixed16Arithmetic::mean() rounds
+__attribute__((target("sse4.1"))) inline __m128i mean2_sse(const __m128i v,
+                                                            const __m128i w) {
+  const __m128i sum = _mm_add_epi32(v, w);
+  return _mm_srai_epi32(
+      _mm_add_epi32(_mm_hadd_epi32(sum, sum), _mm_set1_epi32(2)), 2);
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) inline void rgb4_16_sse(const __m128i y32,
+                                                           const __m128i uv32,
+                                                           __m128i* r,
+                                                           __m128i* g,
+                                                           __m128i* b) {
+  constexpr FixedColorMatrix m = Fixed16Arithmetic<Matrix>::coefficients();
+  const __m128i chroma_offset = _mm_set1_epi32(kChromaOffset16);
+  const __m128i c = _mm_sub_epi32(y32, _mm_set1_epi32(m.y_offset));
+  const __m128i d = _mm_sub_epi32(
+      _mm_shuffle_epi32(uv32, _MM_SHUFFLE(2, 2, 0, 0)), chroma_offset);
+  const __m128i e = _mm_sub_epi32(
+      _mm_shuffle_epi32(uv32, _MM_SHUFFLE(3, 3, 1, 1)), chroma_offset);
+  const __m128i round = _mm_set1_epi32(4096);
+
+  const __m128i luma =
+      _mm_add_epi32(_mm_mullo_epi32(c, _mm_set1_epi32(m.y_scale)), round);
+  *r = _mm_srai_epi32(
+      _mm_add_epi32(luma, _mm_mullo_epi32(e, _mm_set1_epi32(m.r_cr))), 13);
+  *g = _mm_srai_epi32(
+      _mm_add_epi32(
+          _mm_add_epi32(luma, _mm_mullo_epi32(e, _mm_set1_epi32(m.g_cr))),
+          _mm_mullo_epi32(d, _mm_set1_epi32(m.g_cb))),
+      13);
+  *b = _mm_srai_epi32(
+      _mm_add_epi32(luma, _mm_mullo_epi32(d, _mm_set1_epi32(m.b_cb))), 13);
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) void rgb16_rows_to_p016_sse41(
+    const uint16_t* rgb0,
+    const uint16_t* rgb1,
+    const std::size_t width,
+    uint16_t* y0,
+    uint16_t* y1,
+    uint16_t* uv,
+    const SampleDepth& depth,
+    const ChromaFilter filter) {
+  const int odd = _MM_SHUFFLE(3, 1, 3, 1);
+
+  std::size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i r0, g0, b0, r1, g1, b1;
+    load_rgb16_4(rgb0 + x * 3, &r0, &g0, &b0);
+    load_rgb16_4(rgb1 + x * 3, &r1, &g1, &b1);
+
+    const __m128i luma0 = luma4_16_sse<Matrix>(r0, g0, b0);
+    const __m128i luma1 = luma4_16_sse<Matrix>(r1, g1, b1);
+    const __m128i luma = store_depth8(luma0, luma1, depth);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(y0 + x), luma);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(y1 + x),
+                     _mm_unpackhi_epi64(luma, luma));
+
+    const __m128i c32 =
+        (filter == ChromaFilter::kBox)
+            ? chroma2_16_sse<Matrix>(mean2_sse(r0, r1), mean2_sse(g0, g1),
+                                     mean2_sse(b0, b1))
+            : chroma2_16_sse<Matrix>(_mm_shuffle_epi32(r1, odd),
+                                     _mm_shuffle_epi32(g1, odd),
+                                     _mm_shuffle_epi32(b1, odd));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(uv + x),
+                     store_depth8(c32, c32, depth));
+  }
+
+  rgb16_rows_to_p016_scalar<Matrix>(rgb0, rgb1, x, width, y0, y1, uv, depth,
+                                    filter);
+}
+
+template <typename Matrix>
+__attribute__((target("sse4.1"))) void p016_row_to_rgb16_sse41(
+    const uint16_t* y,
+    const uint16_t* uv,
+    const std::size_t width,
+    uint16_t* rgb) {
+  std::size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i y32 = _mm_cvtepu16_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + x)));
+    const __m128i uv32 = _mm_cvtepu16_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(uv + x)));
+    __m128i r, g, b;
+    rgb4_16_sse<Matrix>(y32, uv32, &r, &g, &b);
+    store_rgb16_4(rgb + x * 3, r, g, b);
+  }
+
+  p016_row_to_rgb16_scalar<Matrix>(y, uv, x, width, rgb);
+}
+
+// AVX2 arithmetic, eight pixels at a time. The loads and stores go
+// through the SSE4.1 helpers four pixels at a time; only the arithmetic
+// is widened.
+
+__attribute__((target("avx2"))) inline __m256i combine(const __m128i lo,
+                                                        const __m128i hi) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+__attribute__((target("avx2"))) inline void load_rgb16_8(
+    const uint16_t* p,
+    __m256i* r,
+    __m256i* g,
+    __m256i* b) {
+  __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+  load_rgb16_4(p, &r_lo, &g_lo, &b_lo);
+  load_rgb16_4(p + 12, &r_hi, &g_hi, &b_hi);
+  *r = combine(r_lo, r_hi);
+  *g = combine(g_lo, g_hi);
+  *b = combine(b_lo, b_hi);
+}
+
+// store_depth8() of all eight lanes of |v|
+__attribute__((target("avx2"))) inline __m128i store_depth8(
+    const __m256i v,
+    const SampleDepth& depth) {
+  return store_depth8(_mm256_castsi256_si128(v),
+                      _mm256_extracti128_si256(v, 1), depth);
+}
+
+__attribute__((target("avx2"))) inline __m256i dot3_fixed16_avx2(
+    const __m256i r,
+    const __m256i g,
+    const __m256i b,
+    const int cr,
+    const int cg,
+    const int cb,
+    const int offset) {
+  const __m256i sum = _mm256_add_epi32(
+      _mm256_add_epi32(_mm256_mullo_epi32(r, _mm256_set1_epi32(cr)),
+                       _mm256_mullo_epi32(g, _mm256_set1_epi32(cg))),
+      _mm256_mullo_epi32(b, _mm256_set1_epi32(cb)));
+  return _mm256_add_epi32(
+      _mm256_srai_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(4096)), 13),
+      _mm256_set1_epi32(offset));
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) inline __m256i luma8_16_avx2(
+    const __m256i r,
+    const __m256i g,
+    const __m256i b) {
+  constexpr FixedColorMatrix m = Fixed16Arithmetic<Matrix>::coefficients();
+  return dot3_fixed16_avx2(r, g, b, m.y_r, m.y_g, m.y_b, m.y_offset);
+}
+
+// Cb and Cr of the pixels in lanes 0, 1, 4 and 5, interleaved as
+// Cb Cr Cb Cr in each 128-bit half
+template <typename Matrix>
+__attribute__((target("avx2"))) inline __m256i chroma4_16_avx2(
+    const __m256i r,
+    const __m256i g,
+    const __m256i b) {
+  constexpr FixedColorMatrix m = Fixed16Arithmetic<Matrix>::coefficients();
+  return _mm256_unpacklo_epi32(
+      dot3_fixed16_avx2(r, g, b, m.cb_r, m.cb_g, m.cb_b, kChromaOffset16),
+      dot3_fixed16_avx2(r, g, b, m.cr_r, m.cr_g, m.cr_b, kChromaOffset16));
+}
+
+// As mean2_sse() in each 128-bit half
+__attribute__((target("avx2"))) inline __m256i mean4_avx2(const __m256i v,
+                                                           const __m256i w) {
+  const __m256i sum = _mm256_add_epi32(v, w);
+  return _mm256_srai_epi32(
+      _mm256_add_epi32(_mm256_hadd_epi32(sum, sum), _mm256_set1_epi32(2)),
+      2);
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) inline void rgb8_16_avx2(const __m256i y32,
+                                                          const __m256i uv32,
+                                                          __m256i* r,
+                                                          __m256i* g,
+                                                          __m256i* b) {
+  constexpr FixedColorMatrix m = Fixed16Arithmetic<Matrix>::coefficients();
+  const __m256i chroma_offset = _mm256_set1_epi32(kChromaOffset16);
+  const __m256i c = _mm256_sub_epi32(y32, _mm256_set1_epi32(m.y_offset));
+  const __m256i d = _mm256_sub_epi32(
+      _mm256_shuffle_epi32(uv32, _MM_SHUFFLE(2, 2, 0, 0)), chroma_offset);
+  const __m256i e = _mm256_sub_epi32(
+      _mm256_shuffle_epi32(uv32, _MM_SHUFFLE(3, 3, 1, 1)), chroma_offset);
+  const __m256i round = _mm256_set1_epi32(4096);
+
+  const __m256i luma = _mm256_add_epi32(
+      _mm256_mullo_epi32(c, _mm256_set1_epi32(m.y_scale)), round);
+  *r = _mm256_srai_epi32(
+      _mm256_add_epi32(luma,
+                       _mm256_mullo_epi32(e, _mm256_set1_epi32(m.r_cr))),
+      13);
+  *g = _mm256_srai_epi32(
+      _mm256_add_epi32(
+          _mm256_add_epi32(luma,
+                           _mm256_mullo_epi32(e, _mm256_set1_epi32(m.g_cr))),
+          _mm256_mullo_epi32(d, _mm256_set1_epi32(m.g_cb))),
+      13);
+  *b = _mm256_srai_epi32(
+      _mm256_add_epi32(luma,
+                       _mm256_mullo_epi32(d, _mm256_set1_epi32(m.b_cb))),
+      13);
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) void rgb16_rows_to_p016_avx2(
+    const uint16_t* rgb0,
+    const uint16_t* rgb1,
+    const std::size_t width,
+    uint16_t* y0,
+    uint16_t* y1,
+    uint16_t* uv,
+    const SampleDepth& depth,
+    const ChromaFilter filter) {
+  const int odd = _MM_SHUFFLE(3, 1, 3, 1);
+
+  std::size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m256i r0, g0, b0, r1, g1, b1;
+    load_rgb16_8(rgb0 + x * 3, &r0, &g0, &b0);
+    load_rgb16_8(rgb1 + x * 3, &r1, &g1, &b1);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x),
+                     store_depth8(luma8_16_avx2<Matrix>(r0, g0, b0), depth));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x),
+                     store_depth8(luma8_16_avx2<Matrix>(r1, g1, b1), depth));
+
+    const __m256i c32 =
+        (filter == ChromaFilter::kBox)
+            ? chroma4_16_avx2<Matrix>(mean4_avx2(r0, r1), mean4_avx2(g0, g1),
+                                      mean4_avx2(b0, b1))
+            : chroma4_16_avx2<Matrix>(_mm256_shuffle_epi32(r1, odd),
+                                      _mm256_shuffle_epi32(g1, odd),
+                                      _mm256_shuffle_epi32(b1, odd));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(uv + x),
+                     store_depth8(c32, depth));
+  }
+
+  rgb16_rows_to_p016_scalar<Matrix>(rgb0, rgb1, x, width, y0, y1, uv, depth,
+                                    filter);
+}
+
+template <typename Matrix>
+__attribute__((target("avx2"))) void p016_row_to_rgb16_avx2(
+    const uint16_t* y,
+    const uint16_t* uv,
+    const std::size_t width,
+    uint16_t* rgb) {
+  std::size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m256i y32 = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)));
+    const __m256i uv32 = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x)));
+    __m256i r, g, b;
+    rgb8_16_avx2<Matrix>(y32, uv32, &r, &g, &b);
+    store_rgb16_4(rgb + x * 3, _mm256_castsi256_si128(r),
+                  _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+    store_rgb16_4(rgb + x * 3 + 12, _mm256_extracti128_si256(r, 1),
+                  _mm256_extracti128_si256(g, 1),
+                  _mm256_extracti128_si256(b, 1));
+  }
+
+  p016_row_to_rgb16_scalar<Matrix>(y, uv, x, width, rgb);
+}
+
+#endif  // VADEM_X86_SIMD
+
+}  // namespace
+
+template <typename Matrix>
+void rgb16_rows_to_p016(const uint16_t* rgb0,
+                        const uint16_t* rgb1,
+                        const std::size_t width,
+                        uint16_t* y0,
+                        uint16_t* y1,
+                        uint16_t* uv,
+                        const unsigned bits,
+                        const ChromaFilter filter) {
+  const SampleDepth depth(bits);
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      rgb16_rows_to_p016_avx2<Matrix>(rgb0, rgb1, width, y0, y1, uv, depth,
+                                      filter);
+      return;
+    case SimdLevel::kSse41:
+      rgb16_rows_to_p016_sse41<Matrix>(rgb0, rgb1, width, y0, y1, uv, depth,
+                                       filter);
+      return;
+#endif
+    default:
+      rgb16_rows_to_p016_scalar<Matrix>(rgb0, rgb1, 0, width, y0, y1, uv,
+                                        depth, filter);
+      return;
+  }
+}
+
+template <typename Matrix>
+void p016_row_to_rgb16(const uint16_t* y,
+                       const uint16_t* uv,
+                       const std::size_t width,
+                       uint16_t* rgb) {
+  switch (simd_level()) {
+#ifdef VADEM_X86_SIMD
+    case SimdLevel::kAvx2:
+      p016_row_to_rgb16_avx2<Matrix>(y, uv, width, rgb);
+      return;
+    case SimdLevel::kSse41:
+      p016_row_to_rgb16_sse41<Matrix>(y, uv, width, rgb);
+      return;
+#endif
+    default:
+      p016_row_to_rgb16_scalar<Matrix>(y, uv, 0, width, rgb);
+      return;
+  }
+}
+
+#define INSTANTIATE(Matrix)                                                \
+  template void rgb16_rows_to_p016<Matrix>(                                \
+      const uint16_t*, const uint16_t*, std::size_t, uint16_t*, uint16_t*, \
+      uint16_t*, unsigned, ChromaFilter);                                  \
+  template void p016_row_to_rgb16<Matrix>(                                 \
+      const uint16_t*, const uint16_t*, std::size_t, uint16_t*);
+
+VADEM_FOR_EACH_MATRIX(INSTANTIATE)
+#undef INSTANTIATE
+}
@@ -0,0 +1,188 @@
+// Copyright 2017 Neverware
+
+#include "src/dmabuf.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <va/va_drmcommon.h>
+
+#include "src/util.h"
+#include "src/va_util.h"
+
+namespace vadem {
+
+namespace {
+
+std::runtime_error errno_error(const std::string& what) {
+  return std::runtime_error(what + ": " + strerror(errno));
+}
+
+void close_objects(const VADRMPRIMESurfaceDescriptor& desc) {
+  for (uint32_t i = 0; i < desc.num_objects; i++) {
+    close(desc.objects[i].fd);
+  }
+}
+
+}  // namespace
+
+DmaBuf& DmaBuf::operator=(DmaBuf&& other) {
+  if (this != &other) {
+    reset();
+    fd_ = other.fd_;
+    layout_ = other.layout_;
+    other.fd_ = -1;
+  }
+  return *this;
+}
+
+void DmaBuf::reset() {
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+DmaBuf va_surface_export_dmabuf(VADisplay display, const VASurfaceID surface) {
+  check_status(vaSyncSurface(display, surface));
+
+  VADRMPRIMESurfaceDescriptor desc;
+  memset(&desc, 0, sizeof(desc));
+  check_status(vaExportSurfaceHandle(
+      display, surface, VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2,
+      VA_EXPORT_SURFACE_READ_WRITE | VA_EXPORT_SURFACE_COMPOSED_LAYERS,
+      &desc));
+
+  // Composed layers put every plane in one layer
+  if (desc.num_objects != 1 || desc.num_layers != 1 ||
+      desc.layers[0].num_planes > 3) {
+    close_objects(desc);
+    throw std::runtime_error("can't export surface as one DMA-BUF: " +
+                             std::to_string(desc.num_objects) +
+                             " objects, " + std::to_string(desc.num_layers) +
+                             " layers");
+  }
+
+  DmaBufLayout layout;
+  memset(&layout, 0, sizeof(layout));
+  layout.fourcc = desc.fourcc;
+  layout.drm_format = desc.layers[0].drm_format;
+  layout.width = desc.width;
+  layout.height = desc.height;
+  layout.size = desc.objects[0].size;
+  layout.modifier = desc.objects[0].drm_format_modifier;
+  layout.num_planes = desc.layers[0].num_planes;
+  for (uint32_t plane = 0; plane < layout.num_planes; plane++) {
+    layout.offsets[plane] = desc.layers[0].offset[plane];
+    layout.pitches[plane] = desc.layers[0].pitch[plane];
+  }
+  return DmaBuf(desc.objects[0].fd, layout);
+}
+
+VASurfaceID va_surface_import_dmabuf(VADisplay display, const DmaBuf& buf) {
+  const DmaBufLayout& layout = buf.layout();
+  // VASurfaceAttribExternalBuffers has nowhere to put a modifier
+  if (layout.modifier != 0) {
+    throw std::runtime_error("can't import DMA-BUF with modifier " +
+                             hex_str(layout.modifier));
+  }
+
+  uintptr_t fd = buf.fd();
+  VASurfaceAttribExternalBuffers external;
+  memset(&external, 0, sizeof(external));
+  external.pixel_format = layout.fourcc;
+  external.width = layout.width;
+  external.height = layout.height;
+  external.data_size = layout.size;
+  external.num_planes = layout.num_planes;
+  for (uint32_t plane = 0; plane < layout.num_planes; plane++) {
+    external.pitches[plane] = layout.pitches[plane];
+    external.offsets[plane] = layout.offsets[plane];
+  }
+  external.buffers = &fd;
+  external.num_buffers = 1;
+
+  VASurfaceAttrib attribs[2];
+  attribs[0].type = VASurfaceAttribMemoryType;
+  attribs[0].flags = VA_SURFACE_ATTRIB_SETTABLE;
+  attribs[0].value.type = VAGenericValueTypeInteger;
+  attribs[0].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME;
+  attribs[1].type = VASurfaceAttribExternalBufferDescriptor;
+  attribs[1].flags = VA_SURFACE_ATTRIB_SETTABLE;
+  attribs[1].value.type = VAGenericValueTypePointer;
+  attribs[1].value.value.p = &external;
+
+  VASurfaceID surface;
+  check_status(vaCreateSurfaces(display, va_surface_rt_format(layout.fourcc),
+                                layout.width, layout.height, &surface, 1,
+                                attribs, 2));
+  return surface;
+}
+
+void dmabuf_send(const int socket, const DmaBuf& buf) {
+  DmaBufLayout layout = buf.layout();
+  iovec iov;
+  iov.iov_base = &layout;
+  iov.iov_len = sizeof(layout);
+
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(control, 0, sizeof(control));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  const int fd = buf.fd();
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+  if (sendmsg(socket, &msg, MSG_NOSIGNAL) != sizeof(layout)) {
+    throw errno_error("failed to send DMA-BUF");
+  }
+}
+
+DmaBuf dmabuf_receive(const int socket) {
+  DmaBufLayout layout;
+  iovec iov;
+  iov.iov_base = &layout;
+  iov.iov_len = sizeof(layout);
+
+  char control[CMSG_SPACE(sizeof(int))];
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  const ssize_t received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+  if (received < 0) {
+    throw errno_error("failed to receive DMA-BUF");
+  }
+
+  int fd = -1;
+  const cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS &&
+      cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+  }
+  // Take ownership of the fd before checking anything else
+  DmaBuf buf(fd, layout);
+  if (fd == -1 || received != sizeof(layout) ||
+      (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+    throw std::runtime_error("malformed DMA-BUF message");
+  }
+  return buf;
+}
+}
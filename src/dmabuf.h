@@ -0,0 +1,87 @@
+// Copyright 2017 Neverware
+
+#ifndef DMABUF_H_
+#define DMABUF_H_
+
+#include <cstdint>
+
+#include <va/va.h>
+
+namespace vadem {
+
+// How a surface's pixels are laid out in its DMA-BUF
+struct DmaBufLayout {
+  // VA fourcc, and the DRM fourcc other APIs (EGL, KMS, V4L2) know it by
+  uint32_t fourcc;
+  uint32_t drm_format;
+  uint32_t width, height;
+  // Bytes in the buffer and its DRM format modifier, 0 being linear
+  uint32_t size;
+  uint64_t modifier;
+  uint32_t num_planes;
+  uint32_t offsets[3];
+  uint32_t pitches[3];
+};
+
+// Move-only owner of a DMA-BUF (PRIME) fd and its layout, for handing a
+// surface to another device or process without copying its pixels.
+//
+//   DmaBuf buf = va_surface_export_dmabuf(display, surface);
+//   dmabuf_send(socket, buf);
+//
+// and in the other process:
+//
+//   const DmaBuf buf = dmabuf_receive(socket);
+//   const VASurfaceID surface = va_surface_import_dmabuf(display, buf);
+//
+// The fd is closed on destruction; surfaces imported from it keep their
+// own reference to the memory.
+class DmaBuf {
+ public:
+  DmaBuf() : fd_(-1), layout_() {}
+
+  DmaBuf(int fd, const DmaBufLayout& layout) : fd_(fd), layout_(layout) {}
+
+  DmaBuf(DmaBuf&& other) : fd_(other.fd_), layout_(other.layout_) {
+    other.fd_ = -1;
+  }
+
+  DmaBuf& operator=(DmaBuf&& other);
+
+  DmaBuf(const DmaBuf&) = delete;
+  DmaBuf& operator=(const DmaBuf&) = delete;
+
+  ~DmaBuf() { reset(); }
+
+  // Close the fd now
+  void reset();
+
+  explicit operator bool() const { return fd_ != -1; }
+
+  int fd() const { return fd_; }
+
+  const DmaBufLayout& layout() const { return layout_; }
+
+ private:
+  int fd_;
+  DmaBufLayout layout_;
+};
+
+// Export |surface| as a single DMA-BUF with vaExportSurfaceHandle(),
+// after waiting for pending work on it. Throws if the driver can't, or
+// splits the surface over several buffers.
+DmaBuf va_surface_export_dmabuf(VADisplay display, VASurfaceID surface);
+
+// Create a surface backed by |buf|'s memory. Writes to either side show
+// up on the other. Destroy it with vaDestroySurfaces().
+VASurfaceID va_surface_import_dmabuf(VADisplay display, const DmaBuf& buf);
+
+// Pass |buf|'s fd and layout over the Unix domain socket |socket|. |buf|
+// stays open on this side.
+void dmabuf_send(int socket, const DmaBuf& buf);
+
+// Receive a DmaBuf sent with dmabuf_send()
+DmaBuf dmabuf_receive(int socket);
+}
+
+#endif  // DMABUF_H_
@@ -0,0 +1,147 @@
+// Copyright 2017 Neverware
+
+#ifndef I420_H_
+#define I420_H_
+
+#include <stdexcept>
+#include <string>
+
+#include <va/va.h>
+
+#include "color.h"
+#include "scoped_buffer_map.h"
+#include "util.h"
+#include "va_util.h"
+
+namespace vadem {
+
+// Maps a planar 4:2:0 image, I420 or YV12, for its lifetime. The two
+// only differ in which of the second and third planes holds Cb, so the
+// accessors below hide the order. |Access| works as for BasicNv12Buffer.
+template <typename Access = DefaultAccess>
+class BasicI420Buffer {
+ public:
+  using Offset = std::size_t;
+
+  BasicI420Buffer(VADisplay display, const VAImage& image)
+      : image(image),
+        bufmap(display, image.buf),
+        mem(bufmap.data()),
+        w(image.width),
+        h(image.height),
+        half_w(w / 2),
+        half_h(h / 2),
+        cb_plane(cb_plane_index(image.format.fourcc)),
+        plane_y(image.offsets[0]),
+        plane_cb(image.offsets[cb_plane]),
+        plane_cr(image.offsets[3 - cb_plane]),
+        pitch_y(image.pitches[0]),
+        pitch_cb(image.pitches[cb_plane]),
+        pitch_cr(image.pitches[3 - cb_plane]) {
+    assert_equal(image.num_planes, 3u);
+
+    // Easier to reason about
+    assert_equal(half_w * 2, w);
+    assert_equal(half_h * 2, h);
+
+    if (pitch_y < w || pitch_cb < half_w || pitch_cr < half_w) {
+      throw std::runtime_error("planar pitch smaller than width: " +
+                               std::to_string(pitch_y) + ", " +
+                               std::to_string(pitch_cb) + ", " +
+                               std::to_string(pitch_cr) + " < " +
+                               std::to_string(w));
+    }
+  }
+
+  Offset offset_Y(const Offset x, const Offset y) const {
+    return Access::check(image, plane_y + y * pitch_y + x);
+  }
+
+  Offset offset_Cb(const Offset x, const Offset y) const {
+    return Access::check(image, plane_cb + (y / 2) * pitch_cb + x / 2);
+  }
+
+  Offset offset_Cr(const Offset x, const Offset y) const {
+    return Access::check(image, plane_cr + (y / 2) * pitch_cr + x / 2);
+  }
+
+  template <typename Arithmetic = FloatArithmetic<>>
+  BasicYCbCr<Arithmetic> get_pixel(const Offset x, const Offset y) const {
+    return BasicYCbCr<Arithmetic>(mem[offset_Y(x, y)], mem[offset_Cb(x, y)],
+                                  mem[offset_Cr(x, y)]);
+  }
+
+  // As BasicNv12Buffer::set_pixel(), three single-byte stores
+  template <typename Arithmetic>
+  void set_pixel(const Offset x,
+                 const Offset y,
+                 const BasicYCbCr<Arithmetic>& color) {
+    mem[offset_Y(x, y)] = color.Y;
+    mem[offset_Cb(x, y)] = color.Cb;
+    mem[offset_Cr(x, y)] = color.Cr;
+  }
+
+  // Luma row |y|, |width()| bytes, bounds-checked once as a whole
+  uint8_t* y_row(const Offset y) {
+    return mem + check_row(plane_y + y * pitch_y, w);
+  }
+
+  const uint8_t* y_row(const Offset y) const {
+    return mem + check_row(plane_y + y * pitch_y, w);
+  }
+
+  // Cb and Cr rows shared by luma rows |y| and |y| ^ 1, |width()| / 2
+  // bytes each
+  uint8_t* u_row(const Offset y) {
+    return mem + check_row(plane_cb + (y / 2) * pitch_cb, half_w);
+  }
+
+  const uint8_t* u_row(const Offset y) const {
+    return mem + check_row(plane_cb + (y / 2) * pitch_cb, half_w);
+  }
+
+  uint8_t* v_row(const Offset y) {
+    return mem + check_row(plane_cr + (y / 2) * pitch_cr, half_w);
+  }
+
+  const uint8_t* v_row(const Offset y) const {
+    return mem + check_row(plane_cr + (y / 2) * pitch_cr, half_w);
+  }
+
+  Offset width() const { return w; }
+
+  Offset height() const { return h; }
+
+  uint8_t* data() { return mem; }
+
+ private:
+  // Plane holding Cb; Cr is in the other chroma plane
+  static uint32_t cb_plane_index(const uint32_t fourcc) {
+    switch (fourcc) {
+      case VA_FOURCC_I420:
+        return 1;
+      case VA_FOURCC_YV12:
+        return 2;
+    }
+    throw std::runtime_error("not a planar 4:2:0 fourcc: " + hex_str(fourcc));
+  }
+
+  Offset check_row(const Offset begin, const Offset size) const {
+    return va_image_check_range(image, begin, size);
+  }
+
+  const VAImage image;
+  ScopedBufferMap bufmap;
+  uint8_t* const mem;
+
+  const Offset w, h;
+  const Offset half_w, half_h;
+  const uint32_t cb_plane;
+  const Offset plane_y, plane_cb, plane_cr;
+  const Offset pitch_y, pitch_cb, pitch_cr;
+};
+
+using I420Buffer = BasicI420Buffer<>;
+}
+
+#endif  // I420_H_
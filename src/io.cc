@@ -1,103 +1,201 @@
 // Copyright 2017 Neverware
 
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <vector>
 
+#include "src/convert.h"
+#include "src/i420.h"
 #include "src/io.h"
+#include "src/map_cache.h"
 #include "src/nv12.h"
+#include "src/p016.h"
+#include "src/parallel.h"
+#include "src/png_stream.h"
+#include "src/rgb.h"
+#include "src/staging.h"
 
 namespace vadem {
 
-static png::image<png::rgb_pixel> va_image_rgb_copy_to_png(VADisplay display,
-                                                           const VAImage& src) {
-  assert_equal(src.format.fourcc, (unsigned)VA_FOURCC_RGBX);
-  assert((src.format.depth == 24u) || (src.format.depth == 32u));
+static_assert(sizeof(png::rgb_pixel) == 3, "rgb_pixel must be packed");
+static_assert(sizeof(png::rgb_pixel_16) == 6,
+              "rgb_pixel_16 must be packed");
 
-  png::image<png::rgb_pixel> dst(src.width, src.height);
+// Packed RGB bytes of row |y|, whatever the pixel buffer
+template <typename Pixbuf>
+static uint8_t* png_row(png::image<png::rgb_pixel, Pixbuf>& image,
+                        const std::size_t y) {
+  return reinterpret_cast<uint8_t*>(&image.get_row(y)[0]);
+}
+
+template <typename Pixbuf>
+static const uint8_t* png_row(const png::image<png::rgb_pixel, Pixbuf>& image,
+                              const std::size_t y) {
+  return reinterpret_cast<const uint8_t*>(&image.get_row(y)[0]);
+}
 
-  ScopedBufferMap bufmap(display, src.buf);
-  uint8_t* mem = bufmap.data();
+template <typename Pixbuf>
+static png::image<png::rgb_pixel, Pixbuf> va_image_rgb_copy_to_png(
+    VADisplay display,
+    const VAImage& src) {
+  png::image<png::rgb_pixel, Pixbuf> dst(src.width, src.height);
 
-  const int bytes_per_pixel = src.format.depth / 8;
+  const RgbBuffer buf(display, src);
 
-  for (uint32_t y = 0; y < src.height; y++) {
-    for (uint32_t x = 0; x < src.width; x++) {
-      const uint32_t offset = (y * src.width + x) * bytes_per_pixel;
-      const auto pixel = png::rgb_pixel(va_image_get_u8(src, mem, offset + 0),
-                                        va_image_get_u8(src, mem, offset + 1),
-                                        va_image_get_u8(src, mem, offset + 2));
-      dst.set_pixel(x, y, pixel);
+  parallel_for_rows(src.height, 1, [&](std::size_t begin, std::size_t end) {
+    RowReader reader(1, buf.width() * buf.pixel_size());
+    for (std::size_t y = begin; y < end; y++) {
+      rgbx_row_to_rgb(reader.fetch(0, buf.row(y)), buf.width(),
+                      png_row(dst, y));
     }
-  }
+  });
 
   return dst;
 }
 
-static png::image<png::rgb_pixel> va_image_nv12_copy_to_png(
+// NV12 through Nv12Buffer, I420 and YV12 through I420Buffer
+template <typename Arithmetic, typename Buffer, typename Pixbuf>
+static png::image<png::rgb_pixel, Pixbuf> va_image_yuv420_copy_to_png(
     VADisplay display,
     const VAImage& src) {
   const std::size_t w = src.width;
   const std::size_t h = src.height;
 
-  assert_equal(src.format.fourcc, (unsigned)VA_FOURCC_NV12);
   assert_equal(src.format.bits_per_pixel, 12u);
 
-  png::image<png::rgb_pixel> dst(w, h);
+  png::image<png::rgb_pixel, Pixbuf> dst(w, h);
 
-  Nv12Buffer buf(display, src);
+  const Buffer buf(display, src);
 
-  for (uint32_t y = 0; y < h; y++) {
-    for (uint32_t x = 0; x < w; x++) {
-      YCbCr pixel = buf.get_pixel(x, y);
-      dst.set_pixel(x, y, pixel.to_rgb());
+  // Bands start on even rows so each chroma row is read by one band, and
+  // fetched once for the pair of luma rows sharing it
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    Yuv420RowSource<Buffer> rows(buf);
+    const uint8_t* uv = nullptr;
+    for (std::size_t y = begin; y < end; y++) {
+      if ((y % 2) == 0) {
+        uv = rows.uv_row(y);
+      }
+      nv12_row_to_rgb<Arithmetic>(rows.y_row(y), uv, w, png_row(dst, y));
     }
-  }
+  });
 
   return dst;
 }
 
-void va_image_dump(VADisplay display,
-                   const VAImage& src,
-                   const std::string& filename) {
-  std::cout << "dumping VAImage to " << filename << std::endl;
-  Nv12Buffer buf(display, src);
-  FILE* file = fopen(filename.c_str(), "w");
-  const std::size_t result = fwrite(buf.data(), 1, src.data_size, file);
-  assert_equal(result, src.data_size);
-  fclose(file);
+// Whether va_image_save() and va_image_copy_to_png() can convert |image|
+// to an 8-bit RGB PNG
+static bool rgb_png_source(const VAImage& image) {
+  switch (image.format.fourcc) {
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+    case VA_FOURCC_RGBX:
+      return true;
+  }
+  return false;
+}
+
+// Matrix of an arithmetic policy, e.g. Bt601Limited for
+// FixedPointArithmetic<Bt601Limited>
+template <typename Arithmetic>
+struct MatrixOf;
+
+template <template <typename> class Arithmetic, typename Matrix>
+struct MatrixOf<Arithmetic<Matrix>> {
+  using type = Matrix;
+};
+
+static std::runtime_error unsupported_fourcc(const VAImage& image) {
+  return std::runtime_error("unsupported fourcc for an RGB PNG: " +
+                            hex_str(image.format.fourcc));
+}
+
+template <typename Arithmetic, typename Pixbuf>
+png::image<png::rgb_pixel, Pixbuf> va_image_copy_to_png(VADisplay display,
+                                                        const VAImage& src) {
+  switch (src.format.fourcc) {
+    case VA_FOURCC_NV12:
+      return va_image_yuv420_copy_to_png<Arithmetic, Nv12Buffer, Pixbuf>(
+          display, src);
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+      return va_image_yuv420_copy_to_png<Arithmetic, I420Buffer, Pixbuf>(
+          display, src);
+    case VA_FOURCC_RGBX:
+      return va_image_rgb_copy_to_png<Pixbuf>(display, src);
+  }
+  throw unsupported_fourcc(src);
 }
 
+template <typename Arithmetic>
 void va_image_save(VADisplay display,
                    const VAImage& src,
                    const std::string& filename) {
   std::cout << "writing VAImage to " << filename << std::endl;
-  auto output_png = ((src.format.fourcc == VA_FOURCC_NV12)
-                         ? va_image_nv12_copy_to_png(display, src)
-                         : va_image_rgb_copy_to_png(display, src));
-  output_png.write(filename);
+  const bool rgb16 = (src.format.fourcc == VA_FOURCC_P010 ||
+                      src.format.fourcc == VA_FOURCC_P016);
+  // Before the file is truncated
+  if (!rgb_png_source(src) && !rgb16) {
+    throw unsupported_fourcc(src);
+  }
+  std::ofstream stream(filename, std::ios::binary);
+  if (!stream) {
+    throw std::runtime_error("failed to open " + filename);
+  }
+
+  switch (src.format.fourcc) {
+    case VA_FOURCC_NV12: {
+      Nv12DownloadGenerator<Arithmetic> generator(display, src);
+      generator.write(stream);
+      return;
+    }
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12: {
+      I420DownloadGenerator<Arithmetic> generator(display, src);
+      generator.write(stream);
+      return;
+    }
+    case VA_FOURCC_RGBX: {
+      RgbDownloadGenerator generator(display, src);
+      generator.write(stream);
+      return;
+    }
+    case VA_FOURCC_P010:
+    case VA_FOURCC_P016: {
+      P016DownloadGenerator<typename MatrixOf<Arithmetic>::type> generator(
+          display, src);
+      generator.write(stream);
+      return;
+    }
+  }
 }
 
+template <typename Pixbuf>
 void va_image_rgb_copy_from_png(VADisplay display, const VAImage& dst,
-                                const png::image<png::rgb_pixel>& src) {
-  ScopedBufferMap bufmap(display, dst.buf);
-  uint8_t* mem = bufmap.data();
+                                const png::image<png::rgb_pixel, Pixbuf>& src) {
+  RgbBuffer buf(display, dst);
 
   assert_equal(src.get_width(), dst.width);
   assert_equal(src.get_height(), dst.height);
-  assert_equal(dst.format.depth, 32u);
-
-  for (uint32_t y = 0; y < dst.height; y++) {
-    for (uint32_t x = 0; x < dst.width; x++) {
-      const uint32_t offset = (y * dst.width + x) * 4;
-      const auto pixel = src.get_pixel(x, y);
-      va_image_set_u8(dst, mem, offset + 0, pixel.red);
-      va_image_set_u8(dst, mem, offset + 1, pixel.green);
-      va_image_set_u8(dst, mem, offset + 2, pixel.blue);
+
+  parallel_for_rows(dst.height, 1, [&](std::size_t begin, std::size_t end) {
+    RowWriter writer(1, buf.width() * buf.pixel_size());
+    for (std::size_t y = begin; y < end; y++) {
+      rgb_row_to_rgbx(png_row(src, y), buf.width(),
+                      writer.stage(0, buf.row(y)));
+      writer.flush();
     }
-  }
+  });
 }
 
-void va_image_nv12_copy_from_png(VADisplay display, const VAImage& dst,
-                                 const png::image<png::rgb_pixel>& src) {
+template <typename Arithmetic, typename Pixbuf>
+void va_image_nv12_copy_from_png(
+    VADisplay display,
+    const VAImage& dst,
+    const png::image<png::rgb_pixel, Pixbuf>& src,
+    const ChromaFilter filter) {
   const std::size_t w = src.get_width();
   const std::size_t h = src.get_height();
 
@@ -106,13 +204,440 @@ void va_image_nv12_copy_from_png(VADisplay display, const VAImage& dst,
 
   Nv12Buffer buf(display, dst);
 
-  for (uint32_t y = 0; y < h; y++) {
-    for (uint32_t x = 0; x < w; x++) {
-      const auto src_color = src.get_pixel(x, y);
+  // Bands start on even rows since each row pair writes a chroma row
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    RowWriter writer(3, w);
+    for (std::size_t y = begin; y < end; y += 2) {
+      rgb_rows_to_nv12<Arithmetic>(png_row(src, y), png_row(src, y + 1), w,
+                                   writer.stage(0, buf.y_row(y)),
+                                   writer.stage(1, buf.y_row(y + 1)),
+                                   writer.stage(2, buf.uv_row(y)), filter);
+      writer.flush();
+    }
+  });
+}
+
+// Packed 16-bit RGB samples of row |y|
+static uint16_t* png_row(SolidRgb16Image& image, const std::size_t y) {
+  return reinterpret_cast<uint16_t*>(&image.get_row(y)[0]);
+}
 
-      buf.set_pixel(x, y, YCbCr::from_rgb(src_color));
+static const uint16_t* png_row(const SolidRgb16Image& image,
+                               const std::size_t y) {
+  return reinterpret_cast<const uint16_t*>(&image.get_row(y)[0]);
+}
+
+// RowReader::fetch() and RowWriter::stage() for rows of 16-bit samples.
+// Scratch rows are line-aligned, so the casts are safe.
+static const uint16_t* fetch_u16(RowReader& reader,
+                                 const std::size_t index,
+                                 const uint16_t* src) {
+  return reinterpret_cast<const uint16_t*>(
+      reader.fetch(index, reinterpret_cast<const uint8_t*>(src)));
+}
+
+static uint16_t* stage_u16(RowWriter& writer,
+                           const std::size_t index,
+                           uint16_t* dst) {
+  return reinterpret_cast<uint16_t*>(
+      writer.stage(index, reinterpret_cast<uint8_t*>(dst)));
+}
+
+template <typename Pixbuf>
+static SolidRgb16Image widen_to_16_bit(
+    const png::image<png::rgb_pixel, Pixbuf>& src) {
+  const std::size_t w = src.get_width();
+  const std::size_t h = src.get_height();
+  SolidRgb16Image dst(w, h);
+
+  parallel_for_rows(h, 1, [&](std::size_t begin, std::size_t end) {
+    for (std::size_t y = begin; y < end; y++) {
+      const uint8_t* const in = png_row(src, y);
+      uint16_t* const out = png_row(dst, y);
+      for (std::size_t i = 0; i < w * 3; i++) {
+        out[i] = in[i] * 257;
+      }
     }
+  });
+
+  return dst;
+}
+
+SolidRgb16Image png_widen_to_16_bit(const SolidRgbImage& src) {
+  return widen_to_16_bit(src);
+}
+
+template <typename Matrix>
+SolidRgb16Image va_image_p016_copy_to_png(VADisplay display,
+                                          const VAImage& src) {
+  SolidRgb16Image dst(src.width, src.height);
+  va_image_p016_copy_to_png<Matrix>(display, src, dst);
+  return dst;
+}
+
+template <typename Matrix>
+void va_image_p016_copy_to_png(VADisplay display,
+                               const VAImage& src,
+                               SolidRgb16Image& dst) {
+  const P016Buffer buf(display, src);
+  const std::size_t w = buf.width();
+  const std::size_t h = buf.height();
+
+  if (dst.get_width() != w || dst.get_height() != h) {
+    dst.resize(w, h);
   }
+
+  // As va_image_yuv420_copy_to_png(), with rows of 2-byte samples
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    RowReader reader(2, w * 2);
+    const uint16_t* uv = nullptr;
+    for (std::size_t y = begin; y < end; y++) {
+      if ((y % 2) == 0) {
+        uv = fetch_u16(reader, 1, buf.uv_row(y));
+      }
+      p016_row_to_rgb16<Matrix>(fetch_u16(reader, 0, buf.y_row(y)), uv, w,
+                                png_row(dst, y));
+    }
+  });
+}
+
+template <typename Matrix>
+void va_image_p016_copy_from_png(VADisplay display,
+                                 const VAImage& dst,
+                                 const SolidRgb16Image& src,
+                                 const ChromaFilter filter) {
+  const std::size_t w = src.get_width();
+  const std::size_t h = src.get_height();
+
+  assert_equal(w, dst.width);
+  assert_equal(h, dst.height);
+
+  P016Buffer buf(display, dst);
+
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    RowWriter writer(3, w * 2);
+    for (std::size_t y = begin; y < end; y += 2) {
+      rgb16_rows_to_p016<Matrix>(png_row(src, y), png_row(src, y + 1), w,
+                                 stage_u16(writer, 0, buf.y_row(y)),
+                                 stage_u16(writer, 1, buf.y_row(y + 1)),
+                                 stage_u16(writer, 2, buf.uv_row(y)),
+                                 buf.bits(), filter);
+      writer.flush();
+    }
+  });
+}
+
+// Bytes in each chroma row of |buf|: one interleaved row for NV12, and
+// one row per plane for I420 and YV12
+static std::size_t chroma_row_size(const Nv12Buffer& buf) {
+  return buf.width();
 }
 
+static std::size_t chroma_row_size(const I420Buffer& buf) {
+  return buf.width() / 2;
+}
+
+// Chroma rows shared by luma rows |y| and |y| + 1, for each pair of
+// layouts. |reader| and |writer| have two slots each, sized by
+// chroma_row_size().
+static void yuv420_copy_chroma(RowReader& reader,
+                               RowWriter& writer,
+                               const Nv12Buffer& src,
+                               Nv12Buffer& dst,
+                               const std::size_t y) {
+  memcpy(writer.stage(0, dst.uv_row(y)), reader.fetch(0, src.uv_row(y)),
+         src.width());
+}
+
+static void yuv420_copy_chroma(RowReader& reader,
+                               RowWriter& writer,
+                               const Nv12Buffer& src,
+                               I420Buffer& dst,
+                               const std::size_t y) {
+  nv12_uv_split(reader.fetch(0, src.uv_row(y)), src.width() / 2,
+                writer.stage(0, dst.u_row(y)), writer.stage(1, dst.v_row(y)));
+}
+
+static void yuv420_copy_chroma(RowReader& reader,
+                               RowWriter& writer,
+                               const I420Buffer& src,
+                               Nv12Buffer& dst,
+                               const std::size_t y) {
+  nv12_uv_merge(reader.fetch(0, src.u_row(y)), reader.fetch(1, src.v_row(y)),
+                src.width() / 2, writer.stage(0, dst.uv_row(y)));
+}
+
+static void yuv420_copy_chroma(RowReader& reader,
+                               RowWriter& writer,
+                               const I420Buffer& src,
+                               I420Buffer& dst,
+                               const std::size_t y) {
+  const std::size_t half_w = src.width() / 2;
+  memcpy(writer.stage(0, dst.u_row(y)), reader.fetch(0, src.u_row(y)), half_w);
+  memcpy(writer.stage(1, dst.v_row(y)), reader.fetch(1, src.v_row(y)), half_w);
+}
+
+template <typename Src, typename Dst>
+static void yuv420_copy(VADisplay display,
+                        const VAImage& src_image,
+                        const VAImage& dst_image) {
+  const Src src(display, src_image);
+  Dst dst(display, dst_image);
+  const std::size_t w = src.width();
+
+  assert_equal(w, dst.width());
+  assert_equal(src.height(), dst.height());
+
+  // Bands start on even rows so each chroma row is copied by one band
+  parallel_for_rows(src.height(), 2, [&](std::size_t begin, std::size_t end) {
+    RowReader luma_reader(1, w);
+    RowWriter luma_writer(2, w);
+    RowReader chroma_reader(2, chroma_row_size(src));
+    RowWriter chroma_writer(2, chroma_row_size(dst));
+    for (std::size_t y = begin; y < end; y += 2) {
+      memcpy(luma_writer.stage(0, dst.y_row(y)),
+             luma_reader.fetch(0, src.y_row(y)), w);
+      memcpy(luma_writer.stage(1, dst.y_row(y + 1)),
+             luma_reader.fetch(0, src.y_row(y + 1)), w);
+      yuv420_copy_chroma(chroma_reader, chroma_writer, src, dst, y);
+      luma_writer.flush();
+      chroma_writer.flush();
+    }
+  });
+}
+
+void va_image_yuv420_copy(VADisplay display,
+                          const VAImage& src,
+                          const VAImage& dst) {
+  const bool src_nv12 = (src.format.fourcc == VA_FOURCC_NV12);
+  const bool dst_nv12 = (dst.format.fourcc == VA_FOURCC_NV12);
+  if (src_nv12 && dst_nv12) {
+    yuv420_copy<Nv12Buffer, Nv12Buffer>(display, src, dst);
+  } else if (src_nv12) {
+    yuv420_copy<Nv12Buffer, I420Buffer>(display, src, dst);
+  } else if (dst_nv12) {
+    yuv420_copy<I420Buffer, Nv12Buffer>(display, src, dst);
+  } else {
+    yuv420_copy<I420Buffer, I420Buffer>(display, src, dst);
+  }
+}
+
+// Open the PNG at |filename| for streaming and read its size. Only the
+// header is read, and |stream| is left rewound.
+static void png_open(const std::string& filename,
+                     std::ifstream* stream,
+                     int* width,
+                     int* height) {
+  stream->open(filename, std::ios::binary);
+  if (!*stream) {
+    throw std::runtime_error("failed to open " + filename);
+  }
+
+  png::reader<std::istream> header(*stream);
+  header.read_info();
+  *width = header.get_width();
+  *height = header.get_height();
+  stream->seekg(0);
+}
+
+template <typename Arithmetic>
+VAImage va_image_nv12_load_png(VADisplay display,
+                               const std::string& filename,
+                               const ChromaFilter filter) {
+  std::ifstream stream;
+  int width, height;
+  png_open(filename, &stream, &width, &height);
+  const VAImage image = va_image_create_nv12(display, width, height);
+
+  try {
+    Nv12UploadConsumer<Arithmetic> consumer(display, image, filter);
+    consumer.read(stream);
+  } catch (...) {
+    va_image_destroy(display, image);
+    throw;
+  }
+
+  return image;
+}
+
+template <typename Arithmetic>
+ImageLease va_image_nv12_load_png(VaPool& pool,
+                                  const std::string& filename,
+                                  const ChromaFilter filter) {
+  std::ifstream stream;
+  int width, height;
+  png_open(filename, &stream, &width, &height);
+  ImageLease image = pool.acquire_image(VA_FOURCC_NV12, width, height);
+
+  Nv12UploadConsumer<Arithmetic> consumer(pool.display(), *image, filter);
+  consumer.read(stream);
+  return image;
+}
+
+const char* upload_path_name(const UploadPath path) {
+  switch (path) {
+    case UploadPath::kDerive:
+      return "derive";
+    case UploadPath::kPutImage:
+      return "put_image";
+  }
+  return "unknown";
+}
+
+// As va_image_nv12_copy_from_png(), splitting each chroma row into the
+// planes of an I420 or YV12 image
+template <typename Arithmetic, typename Pixbuf>
+static void va_image_i420_copy_from_png(
+    VADisplay display,
+    const VAImage& dst,
+    const png::image<png::rgb_pixel, Pixbuf>& src,
+    const ChromaFilter filter) {
+  const std::size_t w = src.get_width();
+  const std::size_t h = src.get_height();
+
+  assert_equal(w, dst.width);
+  assert_equal(h, dst.height);
+
+  I420Buffer buf(display, dst);
+
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    RowWriter luma_writer(2, w);
+    RowWriter chroma_writer(2, chroma_row_size(buf));
+    std::vector<uint8_t> uv(w);
+    for (std::size_t y = begin; y < end; y += 2) {
+      rgb_rows_to_nv12<Arithmetic>(png_row(src, y), png_row(src, y + 1), w,
+                                   luma_writer.stage(0, buf.y_row(y)),
+                                   luma_writer.stage(1, buf.y_row(y + 1)),
+                                   uv.data(), filter);
+      nv12_uv_split(uv.data(), w / 2, chroma_writer.stage(0, buf.u_row(y)),
+                    chroma_writer.stage(1, buf.v_row(y)));
+      luma_writer.flush();
+      chroma_writer.flush();
+    }
+  });
+}
+
+template <typename Arithmetic, typename Pixbuf>
+void va_image_copy_from_png(VADisplay display,
+                            const VAImage& dst,
+                            const png::image<png::rgb_pixel, Pixbuf>& src,
+                            const ChromaFilter filter) {
+  switch (dst.format.fourcc) {
+    case VA_FOURCC_NV12:
+      va_image_nv12_copy_from_png<Arithmetic>(display, dst, src, filter);
+      return;
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+      va_image_i420_copy_from_png<Arithmetic>(display, dst, src, filter);
+      return;
+    case VA_FOURCC_P010:
+    case VA_FOURCC_P016:
+      va_image_p016_copy_from_png<typename MatrixOf<Arithmetic>::type>(
+          display, dst, widen_to_16_bit(src), filter);
+      return;
+    case VA_FOURCC_RGBX:
+      va_image_rgb_copy_from_png(display, dst, src);
+      return;
+  }
+  throw unsupported_fourcc(dst);
+}
+
+// Image of |surface|'s own memory. False if the driver can't derive one,
+// e.g. for tiled surfaces, or only in some other layout than the
+// surface was created for.
+static bool va_surface_derive(VADisplay display,
+                              const PooledSurface& surface,
+                              VAImage* image) {
+  if (vaDeriveImage(display, surface.id, image) != VA_STATUS_SUCCESS) {
+    return false;
+  }
+  if (image->format.fourcc != surface.fourcc ||
+      image->width != surface.width || image->height != surface.height) {
+    va_image_destroy(display, *image);
+    return false;
+  }
+  return true;
+}
+
+template <typename Arithmetic, typename Pixbuf>
+UploadPath va_surface_copy_from_png(
+    VaPool& pool,
+    const PooledSurface& dst,
+    const png::image<png::rgb_pixel, Pixbuf>& src,
+    const ChromaFilter filter,
+    const UploadPath prefer) {
+  VADisplay display = pool.display();
+  assert_equal(src.get_width(), dst.width);
+  assert_equal(src.get_height(), dst.height);
+
+  VAImage derived;
+  if (prefer == UploadPath::kDerive &&
+      va_surface_derive(display, dst, &derived)) {
+    try {
+      // Wait out any pending work on the surface before writing to it
+      check_status(vaSyncSurface(display, dst.id));
+      va_image_copy_from_png<Arithmetic>(display, derived, src, filter);
+    } catch (...) {
+      va_image_destroy(display, derived);
+      throw;
+    }
+    va_image_destroy(display, derived);
+    return UploadPath::kDerive;
+  }
+
+  const ImageLease image = pool.acquire_image(dst.fourcc, dst.width,
+                                              dst.height);
+  va_image_copy_from_png<Arithmetic>(display, *image, src, filter);
+  buffer_map_invalidate(display, image->buf);
+  check_status(vaPutImage(display, dst.id, image->image_id, 0, 0, dst.width,
+                          dst.height, 0, 0, dst.width, dst.height));
+  return UploadPath::kPutImage;
+}
+
+#define INSTANTIATE_PIXBUF(Arithmetic, Pixbuf)                         \
+  template png::image<png::rgb_pixel, Pixbuf>                           \
+  va_image_copy_to_png<Arithmetic, Pixbuf>(VADisplay, const VAImage&);  \
+  template void va_image_nv12_copy_from_png<Arithmetic, Pixbuf>(        \
+      VADisplay, const VAImage&, const png::image<png::rgb_pixel, Pixbuf>&, \
+      ChromaFilter);                                                    \
+  template void va_image_copy_from_png<Arithmetic, Pixbuf>(             \
+      VADisplay, const VAImage&, const png::image<png::rgb_pixel, Pixbuf>&, \
+      ChromaFilter);                                                    \
+  template UploadPath va_surface_copy_from_png<Arithmetic, Pixbuf>(     \
+      VaPool&, const PooledSurface&,                                    \
+      const png::image<png::rgb_pixel, Pixbuf>&, ChromaFilter, UploadPath);
+
+#define INSTANTIATE(Arithmetic)                                         \
+  template void va_image_save<Arithmetic>(VADisplay, const VAImage&,    \
+                                          const std::string&);          \
+  template VAImage va_image_nv12_load_png<Arithmetic>(                  \
+      VADisplay, const std::string&, ChromaFilter);                     \
+  template ImageLease va_image_nv12_load_png<Arithmetic>(               \
+      VaPool&, const std::string&, ChromaFilter);                       \
+  INSTANTIATE_PIXBUF(Arithmetic, png::pixel_buffer<png::rgb_pixel>)     \
+  INSTANTIATE_PIXBUF(Arithmetic, png::solid_pixel_buffer<png::rgb_pixel>)
+
+VADEM_FOR_EACH_ARITHMETIC(INSTANTIATE)
+#undef INSTANTIATE
+#undef INSTANTIATE_PIXBUF
+
+#define INSTANTIATE(Matrix)                                                \
+  template SolidRgb16Image va_image_p016_copy_to_png<Matrix>(              \
+      VADisplay, const VAImage&);                                          \
+  template void va_image_p016_copy_to_png<Matrix>(                         \
+      VADisplay, const VAImage&, SolidRgb16Image&);                        \
+  template void va_image_p016_copy_from_png<Matrix>(                       \
+      VADisplay, const VAImage&, const SolidRgb16Image&, ChromaFilter);
+
+VADEM_FOR_EACH_MATRIX(INSTANTIATE)
+#undef INSTANTIATE
+
+template void va_image_rgb_copy_from_png(
+    VADisplay,
+    const VAImage&,
+    const png::image<png::rgb_pixel, png::pixel_buffer<png::rgb_pixel>>&);
+template void va_image_rgb_copy_from_png(
+    VADisplay,
+    const VAImage&,
+    const png::image<png::rgb_pixel, png::solid_pixel_buffer<png::rgb_pixel>>&);
 }
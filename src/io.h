@@ -8,26 +8,134 @@
 #include <va/va.h>
 
 #include "png.hpp"
+#include "src/color.h"
+#include "src/convert.h"
+#include "src/pool.h"
 
 namespace vadem {
 
-// ImageMagick can display a raw NV12 file like so:
-//
-// display -size 512x512 -depth 8 -sample 4:2:0 -interlace plane
-// yuv:coolfile.raw
-//
-// or try: http://rawpixels.net/
-void va_image_dump(VADisplay display,
-                   const VAImage& src,
-                   const std::string& filename);
+// The png::image functions below take any of png++'s pixel buffers.
+// solid_pixel_buffer keeps the whole image in one allocation instead of
+// one per row, so it's the default and the better choice for large
+// images. Instantiated for png::pixel_buffer and png::solid_pixel_buffer.
+using SolidRgbImage =
+    png::image<png::rgb_pixel, png::solid_pixel_buffer<png::rgb_pixel>>;
 
+// Write an NV12, I420, YV12 or RGBX image as an RGB PNG. The 4:2:0
+// formats are converted to RGB with |Arithmetic|, which also picks the
+// color matrix, see color.h. P010 and P016 images are written as 16-bit
+// RGB PNGs, converted as by va_image_p016_copy_to_png() with
+// |Arithmetic|'s matrix. Other fourccs throw before |filename| is
+// opened. Instantiated for every policy in VADEM_FOR_EACH_ARITHMETIC.
+template <typename Arithmetic = FloatArithmetic<>>
 void va_image_save(VADisplay display, const VAImage& src, const std::string& filename);
 
+// Copy an NV12, I420, YV12 or RGBX image to a new PNG image, converting
+// as for va_image_save(). Other fourccs throw.
+template <typename Arithmetic = FloatArithmetic<>,
+          typename Pixbuf = png::solid_pixel_buffer<png::rgb_pixel>>
+png::image<png::rgb_pixel, Pixbuf> va_image_copy_to_png(VADisplay display,
+                                                        const VAImage& src);
+
+template <typename Pixbuf>
 void va_image_rgb_copy_from_png(VADisplay display, const VAImage& dst,
-                                const png::image<png::rgb_pixel>& src);
+                                const png::image<png::rgb_pixel, Pixbuf>& src);
+
+// Chroma is decimated with |filter|, see convert.h. Instantiated for
+// every policy in VADEM_FOR_EACH_ARITHMETIC.
+template <typename Arithmetic = FloatArithmetic<>, typename Pixbuf>
+void va_image_nv12_copy_from_png(
+    VADisplay display,
+    const VAImage& dst,
+    const png::image<png::rgb_pixel, Pixbuf>& src,
+    ChromaFilter filter = ChromaFilter::kBox);
+
+// Copy |src| into an NV12, I420, YV12, P010, P016 or RGBX image,
+// converting as va_image_nv12_copy_from_png() does for the 4:2:0
+// fourccs. P010 and P016 go through png_widen_to_16_bit() and
+// va_image_p016_copy_from_png() with |Arithmetic|'s matrix. Other
+// fourccs throw before |dst| is touched.
+template <typename Arithmetic = FloatArithmetic<>, typename Pixbuf>
+void va_image_copy_from_png(VADisplay display,
+                            const VAImage& dst,
+                            const png::image<png::rgb_pixel, Pixbuf>& src,
+                            ChromaFilter filter = ChromaFilter::kBox);
+
+// Copy between 8-bit 4:2:0 images of the same size, each NV12, I420 or
+// YV12, interleaving or splitting chroma as needed. Nothing goes
+// through RGB, so the pixels come out exactly as they went in.
+void va_image_yuv420_copy(VADisplay display,
+                          const VAImage& src,
+                          const VAImage& dst);
+
+// 16-bit RGB for P010 and P016 images
+using SolidRgb16Image =
+    png::image<png::rgb_pixel_16, png::solid_pixel_buffer<png::rgb_pixel_16>>;
+
+// |src| with every sample scaled from 8 to 16 bits, 255 to 65535
+SolidRgb16Image png_widen_to_16_bit(const SolidRgbImage& src);
+
+// Copy a P010 or P016 image to a new 16-bit PNG image with the
+// rgb16_rows_to_p016() arithmetic for |Matrix|. Instantiated for every
+// matrix in VADEM_FOR_EACH_MATRIX.
+template <typename Matrix = Bt2020Limited>
+SolidRgb16Image va_image_p016_copy_to_png(VADisplay display,
+                                          const VAImage& src);
+
+// As above, into |dst|, which is resized to match |src| if need be.
+// Reusing one image across calls saves allocating and faulting in the
+// pages of a new one each time, some 50MB for 4K.
+template <typename Matrix = Bt2020Limited>
+void va_image_p016_copy_to_png(VADisplay display,
+                               const VAImage& src,
+                               SolidRgb16Image& dst);
+
+// The reverse, rounding each sample to the depth of |dst|'s fourcc and
+// decimating chroma with |filter|
+template <typename Matrix = Bt2020Limited>
+void va_image_p016_copy_from_png(VADisplay display,
+                                 const VAImage& dst,
+                                 const SolidRgb16Image& src,
+                                 ChromaFilter filter = ChromaFilter::kBox);
+
+// Create an NV12 image the size of the PNG at |filename| and decode the
+// PNG into it with Nv12UploadConsumer, without holding the decoded RGB
+// image in memory. Instantiated for every policy in
+// VADEM_FOR_EACH_ARITHMETIC.
+template <typename Arithmetic = FloatArithmetic<>>
+VAImage va_image_nv12_load_png(VADisplay display,
+                               const std::string& filename,
+                               ChromaFilter filter = ChromaFilter::kBox);
+
+// As above, into an image leased from |pool|
+template <typename Arithmetic = FloatArithmetic<>>
+ImageLease va_image_nv12_load_png(VaPool& pool,
+                                  const std::string& filename,
+                                  ChromaFilter filter = ChromaFilter::kBox);
+
+// How va_surface_copy_from_png() got the pixels into the surface
+enum class UploadPath {
+  // Converted straight into the surface's memory through vaDeriveImage()
+  kDerive,
+  // Converted into a separate image, then copied over with vaPutImage()
+  kPutImage,
+};
+
+const char* upload_path_name(UploadPath path);
 
-void va_image_nv12_copy_from_png(VADisplay display, const VAImage& dst,
-                                 const png::image<png::rgb_pixel>& src);
+// Convert |src| into |dst|, an NV12 or RGBX surface of the same size,
+// and return the path taken. With |prefer| kDerive the conversion writes
+// straight into the surface if the driver can derive an image of the
+// surface's fourcc from it, saving a full-frame copy; otherwise, or with
+// |prefer| kPutImage, it goes through an image leased from |pool|.
+// Instantiated for every policy in VADEM_FOR_EACH_ARITHMETIC.
+template <typename Arithmetic = FloatArithmetic<>, typename Pixbuf>
+UploadPath va_surface_copy_from_png(
+    VaPool& pool,
+    const PooledSurface& dst,
+    const png::image<png::rgb_pixel, Pixbuf>& src,
+    ChromaFilter filter = ChromaFilter::kBox,
+    UploadPath prefer = UploadPath::kDerive);
 
 }
 
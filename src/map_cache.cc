@@ -0,0 +1,119 @@
+// Copyright 2017 Neverware
+
+#include "src/map_cache.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "src/util.h"
+#include "src/va_util.h"
+
+namespace vadem {
+
+namespace {
+
+std::mutex registry_mutex;
+std::map<VADisplay, BufferMapCache*> registry;
+
+}  // namespace
+
+BufferMapCache::BufferMapCache(VADisplay display)
+    : display_(display), stats_() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  if (!registry.emplace(display, this).second) {
+    throw std::runtime_error("display already has a buffer map cache");
+  }
+}
+
+BufferMapCache::~BufferMapCache() {
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.erase(display_);
+  }
+  // Best effort, since a destructor can't throw: log what's still in use
+  // or fails to unmap and carry on with the rest
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& mapping : mappings_) {
+    if (mapping.second.users > 0) {
+      std::cerr << "buffer " << mapping.first
+                << " still in use when its map cache was destroyed"
+                << std::endl;
+    }
+    const VAStatus status = vaUnmapBuffer(display_, mapping.first);
+    if (status != VA_STATUS_SUCCESS) {
+      std::cerr << "failed to unmap buffer " << mapping.first
+                << ", VAStatus: " << hex_str(status) << std::endl;
+    }
+  }
+  mappings_.clear();
+}
+
+uint8_t* BufferMapCache::acquire(const VABufferID buf) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = mappings_.find(buf);
+  if (it != mappings_.end()) {
+    stats_.hits++;
+  } else {
+    stats_.misses++;
+    void* mem = nullptr;
+    check_status(vaMapBuffer(display_, buf, &mem));
+    it = mappings_.emplace(buf, Mapping{static_cast<uint8_t*>(mem), 0}).first;
+  }
+  it->second.users++;
+  return it->second.mem;
+}
+
+void BufferMapCache::release(const VABufferID buf) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = mappings_.find(buf);
+  if (it != mappings_.end() && it->second.users > 0) {
+    it->second.users--;
+  }
+}
+
+void BufferMapCache::invalidate(const VABufferID buf) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = mappings_.find(buf);
+  if (it != mappings_.end()) {
+    stats_.invalidations++;
+    unmap(it);
+  }
+}
+
+void BufferMapCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!mappings_.empty()) {
+    stats_.invalidations++;
+    unmap(mappings_.begin());
+  }
+}
+
+BufferMapCache::Stats BufferMapCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+BufferMapCache* BufferMapCache::find(VADisplay display) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  const auto it = registry.find(display);
+  return (it != registry.end()) ? it->second : nullptr;
+}
+
+void BufferMapCache::unmap(const std::map<VABufferID, Mapping>::iterator it) {
+  if (it->second.users > 0) {
+    throw std::runtime_error("buffer " + std::to_string(it->first) +
+                             " invalidated while mapped");
+  }
+  const VABufferID buf = it->first;
+  mappings_.erase(it);
+  check_status(vaUnmapBuffer(display_, buf));
+}
+
+void buffer_map_invalidate(VADisplay display, const VABufferID buf) {
+  BufferMapCache* const cache = BufferMapCache::find(display);
+  if (cache) {
+    cache->invalidate(buf);
+  }
+}
+}
@@ -0,0 +1,85 @@
+// Copyright 2017 Neverware
+
+#ifndef MAP_CACHE_H_
+#define MAP_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+#include <va/va.h>
+
+namespace vadem {
+
+// Keeps buffers mapped from their first ScopedBufferMap until invalidated
+// or the cache is destroyed, so back-to-back operations on one image,
+// e.g. va_image_save() then va_image_dump(), call vaMapBuffer() once.
+// While a cache exists for a display, every ScopedBufferMap on that
+// display goes through it.
+//
+// Mappings must be invalidated before the driver touches the buffer
+// itself, i.e. before vaPutImage() or vaGetImage() on its image and
+// before destroying it (va_image_destroy() does the latter):
+//
+//   BufferMapCache cache(display);
+//   va_image_save(display, image, "a.png");   // maps
+//   va_image_dump(display, image, "a.raw");   // cache hit
+//   buffer_map_invalidate(display, image.buf);
+//   vaPutImage(display, surface, image.image_id, ...);
+//
+// Thread safe. At most one cache per display at a time.
+class BufferMapCache {
+ public:
+  struct Stats {
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t invalidations;
+  };
+
+  explicit BufferMapCache(VADisplay display);
+
+  // Unmaps every buffer, logging failures to stderr rather than throwing.
+  // No ScopedBufferMap on |display| may outlive it.
+  ~BufferMapCache();
+
+  BufferMapCache(const BufferMapCache&) = delete;
+  BufferMapCache& operator=(const BufferMapCache&) = delete;
+
+  // Mapping of |buf|, mapping it if it isn't already, which stays valid
+  // until a matching release(). Used by ScopedBufferMap.
+  uint8_t* acquire(VABufferID buf);
+
+  void release(VABufferID buf);
+
+  // Unmap |buf| if it's mapped. Throws if it's still in use.
+  void invalidate(VABufferID buf);
+
+  // Unmap every buffer. Throws if any is still in use.
+  void clear();
+
+  Stats stats() const;
+
+  // Cache registered for |display|, or null
+  static BufferMapCache* find(VADisplay display);
+
+ private:
+  struct Mapping {
+    uint8_t* mem;
+    std::size_t users;
+  };
+
+  // Called with |mutex_| held
+  void unmap(std::map<VABufferID, Mapping>::iterator it);
+
+  VADisplay display_;
+  mutable std::mutex mutex_;
+  std::map<VABufferID, Mapping> mappings_;
+  Stats stats_;
+};
+
+// Invalidate |buf| in |display|'s cache, if it has one
+void buffer_map_invalidate(VADisplay display, VABufferID buf);
+}
+
+#endif  // MAP_CACHE_H_
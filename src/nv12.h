@@ -3,6 +3,9 @@
 #ifndef NV12_H_
 #define NV12_H_
 
+#include <stdexcept>
+#include <string>
+
 #include <va/va.h>
 
 #include "color.h"
@@ -11,11 +14,15 @@
 
 namespace vadem {
 
-class Nv12Buffer {
+// Maps an NV12 image for its lifetime. |Access| decides whether the
+// per-byte accessors are bounds-checked, see va_util.h; the row accessors
+// always check the whole row once.
+template <typename Access = DefaultAccess>
+class BasicNv12Buffer {
  public:
   using Offset = std::size_t;
 
-  Nv12Buffer(VADisplay display, const VAImage& image)
+  BasicNv12Buffer(VADisplay display, const VAImage& image)
       : image(image),
         bufmap(display, image.buf),
         mem(bufmap.data()),
@@ -23,41 +30,82 @@ class Nv12Buffer {
         h(image.height),
         half_w(w / 2),
         half_h(h / 2),
-        plane2(w * h) {
+        plane1(image.offsets[0]),
+        plane2(image.offsets[1]),
+        pitch1(image.pitches[0]),
+        pitch2(image.pitches[1]) {
     assert_equal(image.format.fourcc, (unsigned)VA_FOURCC_NV12);
     assert_equal(image.num_planes, 2u);
 
     // Easier to reason about
     assert_equal(half_w * 2, w);
     assert_equal(half_h * 2, h);
+
+    // Drivers may pad rows, but never below the visible width
+    if (pitch1 < w || pitch2 < w) {
+      throw std::runtime_error("NV12 pitch smaller than width: " +
+                               std::to_string(pitch1) + ", " +
+                               std::to_string(pitch2) + " < " +
+                               std::to_string(w));
+    }
   }
 
   Offset offset_Y(const Offset x, const Offset y) const {
-    return va_image_check_offset(image, y * w + x);
+    return Access::check(image, raw_offset_Y(x, y));
   }
 
   Offset offset_Cb(const Offset x, const Offset y) const {
-    return va_image_check_offset(image, plane2 + ((y / 2) * half_w + (x / 2)));
+    return Access::check(image, raw_offset_Cb(x, y));
   }
 
   Offset offset_Cr(const Offset x, const Offset y) const {
-    return va_image_check_offset(image, offset_Cb(x, y) + 1);
+    return Access::check(image, raw_offset_Cb(x, y) + 1);
+  }
+
+  template <typename Arithmetic = FloatArithmetic<>>
+  BasicYCbCr<Arithmetic> get_pixel(const Offset x, const Offset y) const {
+    return BasicYCbCr<Arithmetic>(mem[offset_Y(x, y)], mem[offset_Cb(x, y)],
+                                  mem[offset_Cr(x, y)]);
+  }
+
+  // Three single-byte stores. For anything bigger than a few pixels,
+  // build whole rows with y_row()/uv_row() and a RowWriter instead, since
+  // mapped buffers are often write-combined.
+  template <typename Arithmetic>
+  void set_pixel(const Offset x,
+                 const Offset y,
+                 const BasicYCbCr<Arithmetic>& color) {
+    mem[offset_Y(x, y)] = color.Y;
+    mem[offset_Cb(x, y)] = color.Cb;
+    mem[offset_Cr(x, y)] = color.Cr;
+  }
+
+  // Luma row |y|, |width()| bytes. The whole row is bounds-checked once
+  // so callers can work on it directly.
+  uint8_t* y_row(const Offset y) {
+    return mem + check_row(raw_offset_Y(0, y));
+  }
+
+  const uint8_t* y_row(const Offset y) const {
+    return mem + check_row(raw_offset_Y(0, y));
   }
 
-  YCbCr get_pixel(const Offset x, const Offset y) const {
-    return YCbCr(va_image_get_u8(image, mem, offset_Y(x, y)),
-                 va_image_get_u8(image, mem, offset_Cb(x, y)),
-                 va_image_get_u8(image, mem, offset_Cr(x, y)));
+  // Interleaved CbCr row shared by luma rows |y| and |y| ^ 1, |width()|
+  // bytes. Bounds-checked like y_row().
+  uint8_t* uv_row(const Offset y) {
+    return mem + check_row(raw_offset_Cb(0, y));
   }
 
-  void set_pixel(const Offset x, const Offset y, const YCbCr& color) {
-    va_image_set_u8(image, mem, offset_Y(x, y), color.Y);
-    va_image_set_u8(image, mem, offset_Cb(x, y), color.Cb);
-    va_image_set_u8(image, mem, offset_Cr(x, y), color.Cr);
+  const uint8_t* uv_row(const Offset y) const {
+    return mem + check_row(raw_offset_Cb(0, y));
   }
 
+  Offset width() const { return w; }
+
+  Offset height() const { return h; }
+
   void set_u8(const Offset offset, const uint8_t val) {
-    va_image_set_u8(image, mem, offset, val);
+    va_image_set_u8<Access>(image, mem, offset, val);
   }
 
   void fill_u8(const uint8_t val) { memset(mem, val, image.data_size); }
@@ -65,14 +113,31 @@ class Nv12Buffer {
   uint8_t* data() { return mem; }
 
  private:
+  Offset raw_offset_Y(const Offset x, const Offset y) const {
+    return plane1 + y * pitch1 + x;
+  }
+
+  // Cb and Cr are interleaved in the second plane, one pair per 2x2
+  // block of luma.
+  Offset raw_offset_Cb(const Offset x, const Offset y) const {
+    return plane2 + (y / 2) * pitch2 + (x / 2) * 2;
+  }
+
+  Offset check_row(const Offset begin) const {
+    return va_image_check_range(image, begin, w);
+  }
+
   const VAImage image;
   ScopedBufferMap bufmap;
   uint8_t* const mem;
 
   const Offset w, h;
   const Offset half_w, half_h;
-  const Offset plane2;
+  const Offset plane1, plane2;
+  const Offset pitch1, pitch2;
 };
+
+using Nv12Buffer = BasicNv12Buffer<>;
 }
 
 #endif  // NV12_H_
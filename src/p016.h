@@ -0,0 +1,136 @@
+// Copyright 2017 Neverware
+
+#ifndef P016_H_
+#define P016_H_
+
+#include <stdexcept>
+#include <string>
+
+#include <va/va.h>
+
+#include "scoped_buffer_map.h"
+#include "util.h"
+#include "va_util.h"
+
+namespace vadem {
+
+// Maps a 16-bit 4:2:0 image, P010 or P016, for its lifetime. Both lay
+// out like NV12 with every sample widened to a little-endian uint16_t;
+// P010 only uses the top 10 bits of each. |Access| works as for
+// BasicNv12Buffer.
+template <typename Access = DefaultAccess>
+class BasicP016Buffer {
+ public:
+  using Offset = std::size_t;
+
+  BasicP016Buffer(VADisplay display, const VAImage& image)
+      : image(image),
+        bufmap(display, image.buf),
+        mem(bufmap.data()),
+        w(image.width),
+        h(image.height),
+        half_w(w / 2),
+        half_h(h / 2),
+        depth(sample_bits(image.format.fourcc)),
+        plane1(image.offsets[0]),
+        plane2(image.offsets[1]),
+        pitch1(image.pitches[0]),
+        pitch2(image.pitches[1]) {
+    assert_equal(image.num_planes, 2u);
+
+    // Easier to reason about
+    assert_equal(half_w * 2, w);
+    assert_equal(half_h * 2, h);
+
+    // Samples are accessed as uint16_t, so every row must start on one
+    if ((plane1 | plane2 | pitch1 | pitch2) % 2) {
+      throw std::runtime_error("16-bit plane not 2-byte aligned");
+    }
+    if (pitch1 < w * 2 || pitch2 < w * 2) {
+      throw std::runtime_error("16-bit pitch smaller than width: " +
+                               std::to_string(pitch1) + ", " +
+                               std::to_string(pitch2) + " < " +
+                               std::to_string(w * 2));
+    }
+  }
+
+  // Byte offsets of the samples of pixel (|x|, |y|)
+  Offset offset_Y(const Offset x, const Offset y) const {
+    return Access::check(image, plane1 + y * pitch1 + x * 2);
+  }
+
+  Offset offset_Cb(const Offset x, const Offset y) const {
+    return Access::check(image, raw_offset_Cb(x, y));
+  }
+
+  Offset offset_Cr(const Offset x, const Offset y) const {
+    return Access::check(image, raw_offset_Cb(x, y) + 2);
+  }
+
+  uint16_t get_u16(const Offset offset) const {
+    return *reinterpret_cast<const uint16_t*>(mem + offset);
+  }
+
+  // Luma row |y|, |width()| samples, bounds-checked once as a whole
+  uint16_t* y_row(const Offset y) {
+    return sample_row(plane1 + y * pitch1);
+  }
+
+  const uint16_t* y_row(const Offset y) const {
+    return sample_row(plane1 + y * pitch1);
+  }
+
+  // Interleaved CbCr row shared by luma rows |y| and |y| ^ 1, |width()|
+  // samples
+  uint16_t* uv_row(const Offset y) {
+    return sample_row(raw_offset_Cb(0, y));
+  }
+
+  const uint16_t* uv_row(const Offset y) const {
+    return sample_row(raw_offset_Cb(0, y));
+  }
+
+  Offset width() const { return w; }
+
+  Offset height() const { return h; }
+
+  // Significant bits of each sample: 10 for P010, 16 for P016
+  unsigned bits() const { return depth; }
+
+  uint8_t* data() { return mem; }
+
+ private:
+  static unsigned sample_bits(const uint32_t fourcc) {
+    switch (fourcc) {
+      case VA_FOURCC_P010:
+        return 10;
+      case VA_FOURCC_P016:
+        return 16;
+    }
+    throw std::runtime_error("not a 16-bit 4:2:0 fourcc: " + hex_str(fourcc));
+  }
+
+  Offset raw_offset_Cb(const Offset x, const Offset y) const {
+    return plane2 + (y / 2) * pitch2 + (x / 2) * 4;
+  }
+
+  uint16_t* sample_row(const Offset begin) const {
+    return reinterpret_cast<uint16_t*>(
+        mem + va_image_check_range(image, begin, w * 2));
+  }
+
+  const VAImage image;
+  ScopedBufferMap bufmap;
+  uint8_t* const mem;
+
+  const Offset w, h;
+  const Offset half_w, half_h;
+  const unsigned depth;
+  const Offset plane1, plane2;
+  const Offset pitch1, pitch2;
+};
+
+using P016Buffer = BasicP016Buffer<>;
+}
+
+#endif  // P016_H_
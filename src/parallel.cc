@@ -0,0 +1,193 @@
+// Copyright 2017 Neverware
+
+#include "src/parallel.h"
+
+#include <exception>
+#include <memory>
+
+namespace vadem {
+
+ThreadPool::ThreadPool(const std::size_t threads) : stopping(false) {
+  for (std::size_t i = 0; i < threads; i++) {
+    workers.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  task_ready.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::run(const std::size_t count,
+                     const std::function<void(std::size_t)>& fn) {
+  std::size_t remaining = count;
+  std::exception_ptr error;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  for (std::size_t i = 0; i < count; i++) {
+    tasks.emplace_back([this, i, &fn, &remaining, &error]() {
+      std::exception_ptr task_error;
+      try {
+        fn(i);
+      } catch (...) {
+        task_error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (task_error && !error) {
+        error = task_error;
+      }
+      remaining--;
+    });
+  }
+  lock.unlock();
+  task_ready.notify_all();
+  lock.lock();
+
+  // Help out rather than block, which also keeps nested calls from
+  // deadlocking when every worker is waiting on a run() of its own
+  while (remaining > 0) {
+    if (!run_one(lock)) {
+      task_done.wait(lock);
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+bool ThreadPool::run_one(std::unique_lock<std::mutex>& lock) {
+  if (tasks.empty()) {
+    return false;
+  }
+
+  std::function<void()> task = std::move(tasks.front());
+  tasks.pop_front();
+  lock.unlock();
+  task();
+  lock.lock();
+  task_done.notify_all();
+  return true;
+}
+
+void ThreadPool::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    if (run_one(lock)) {
+      continue;
+    }
+    if (stopping) {
+      return;
+    }
+    task_ready.wait(lock);
+  }
+}
+
+TaskQueue::TaskQueue() : stopping(false), worker(&TaskQueue::work, this) {}
+
+TaskQueue::~TaskQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  task_ready.notify_all();
+  worker.join();
+}
+
+void TaskQueue::push(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  task_ready.notify_all();
+}
+
+void TaskQueue::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    if (!tasks.empty()) {
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+      continue;
+    }
+    if (stopping) {
+      return;
+    }
+    task_ready.wait(lock);
+  }
+}
+
+namespace {
+
+std::size_t default_thread_count() {
+  const std::size_t count = std::thread::hardware_concurrency();
+  return (count > 0) ? count : 1;
+}
+
+std::mutex pool_mutex;
+std::size_t requested_threads = 0;
+std::shared_ptr<ThreadPool> pool;
+
+// Pool for the current thread_count(), less the calling thread, which
+// runs tasks too. Held by shared_ptr so that a concurrent
+// thread_count_set() doesn't destroy it mid-run.
+std::shared_ptr<ThreadPool> current_pool(const std::size_t threads) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  if (!pool || pool->size() != threads - 1) {
+    pool = std::make_shared<ThreadPool>(threads - 1);
+  }
+  return pool;
+}
+
+}  // namespace
+
+std::size_t thread_count() {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  return (requested_threads > 0) ? requested_threads : default_thread_count();
+}
+
+void thread_count_set(const std::size_t count) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+  requested_threads = count;
+}
+
+void parallel_for_rows(
+    const std::size_t rows,
+    const std::size_t align,
+    const std::function<void(std::size_t, std::size_t)>& fn) {
+  const std::size_t units = (rows + align - 1) / align;
+  const std::size_t threads = thread_count();
+  const std::size_t bands = (units < threads) ? units : threads;
+
+  if (bands <= 1) {
+    if (rows > 0) {
+      fn(0, rows);
+    }
+    return;
+  }
+
+  // Spread the remainder over the first bands so none is more than one
+  // unit longer than another
+  const std::size_t per_band = units / bands;
+  const std::size_t extra = units % bands;
+  auto band_begin = [=](const std::size_t band) -> std::size_t {
+    const std::size_t unit =
+        band * per_band + ((band < extra) ? band : extra);
+    return (unit * align < rows) ? unit * align : rows;
+  };
+
+  current_pool(threads)->run(bands, [&](const std::size_t band) {
+    fn(band_begin(band), band_begin(band + 1));
+  });
+}
+}
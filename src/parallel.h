@@ -0,0 +1,91 @@
+// Copyright 2017 Neverware
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vadem {
+
+// Fixed set of worker threads running queued tasks. run() also executes
+// queued tasks on the calling thread while it waits, so it's safe to call
+// from several threads at once and from inside a task.
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t threads);
+
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Call |fn(i)| for every i in [0, count) and wait for all of them. The
+  // first exception thrown by |fn| is rethrown here once every call has
+  // finished.
+  void run(std::size_t count, const std::function<void(std::size_t)>& fn);
+
+  std::size_t size() const { return workers.size(); }
+
+ private:
+  void work();
+
+  // Run one queued task if there is one. Called with |lock| held.
+  bool run_one(std::unique_lock<std::mutex>& lock);
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_ready;
+  std::condition_variable task_done;
+  bool stopping;
+};
+
+// Runs tasks one at a time, in the order they were pushed, on a thread of
+// its own. Tasks must not throw. Destruction waits for every queued task
+// to finish.
+class TaskQueue {
+ public:
+  TaskQueue();
+
+  ~TaskQueue();
+
+  TaskQueue(const TaskQueue&) = delete;
+  TaskQueue& operator=(const TaskQueue&) = delete;
+
+  void push(std::function<void()> task);
+
+ private:
+  void work();
+
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_ready;
+  bool stopping;
+  // Last, so everything it uses is set up before it starts
+  std::thread worker;
+};
+
+// Number of threads parallel_for_rows() spreads work over. Defaults to
+// std::thread::hardware_concurrency().
+std::size_t thread_count();
+
+// Use |count| threads from now on, or the default if |count| is 0.
+void thread_count_set(std::size_t count);
+
+// Split rows [0, |rows|) into at most thread_count() contiguous bands
+// whose boundaries are multiples of |align| (e.g. 2 so NV12 row pairs
+// sharing a chroma row stay together) and call |fn(begin, end)| for each
+// band in parallel, returning once all of them have.
+void parallel_for_rows(
+    std::size_t rows,
+    std::size_t align,
+    const std::function<void(std::size_t, std::size_t)>& fn);
+}
+
+#endif  // PARALLEL_H_
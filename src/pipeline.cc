@@ -0,0 +1,151 @@
+// Copyright 2017 Neverware
+
+#include "src/pipeline.h"
+
+#include <exception>
+#include <memory>
+#include <stdexcept>
+
+#include "src/map_cache.h"
+#include "src/va_util.h"
+
+namespace vadem {
+
+SlotRing::SlotRing(const std::size_t size) : busy(size, false), next(0) {
+  if (size == 0) {
+    throw std::invalid_argument("pipeline depth must be at least 1");
+  }
+}
+
+std::size_t SlotRing::acquire() {
+  std::unique_lock<std::mutex> lock(mutex);
+  const std::size_t slot = next;
+  released.wait(lock, [&]() { return !busy[slot]; });
+  busy[slot] = true;
+  next = (slot + 1) % busy.size();
+  return slot;
+}
+
+void SlotRing::release(const std::size_t slot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    busy[slot] = false;
+  }
+  released.notify_all();
+}
+
+void SlotRing::wait_idle() {
+  std::unique_lock<std::mutex> lock(mutex);
+  released.wait(lock, [&]() {
+    for (const bool used : busy) {
+      if (used) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+UploadPipeline::UploadPipeline(VaPool& pool,
+                               const uint32_t fourcc,
+                               const int width,
+                               const int height,
+                               const std::size_t depth,
+                               const ChromaFilter filter)
+    : display(pool.display()), filter(filter), ring(depth) {
+  for (std::size_t i = 0; i < depth; i++) {
+    slots.push_back({pool.acquire_image(fourcc, width, height),
+                     pool.acquire_surface(fourcc, width, height)});
+  }
+}
+
+UploadPipeline::~UploadPipeline() {
+  flush();
+}
+
+std::future<void> UploadPipeline::submit(const SolidRgbImage& src,
+                                         Callback done) {
+  const std::size_t index = ring.acquire();
+  const Slot& slot = slots[index];
+  try {
+    va_image_copy_from_png(display, *slot.image, src, filter);
+  } catch (...) {
+    ring.release(index);
+    throw;
+  }
+
+  auto promise = std::make_shared<std::promise<void>>();
+  std::future<void> future = promise->get_future();
+  transfer.push([this, index, promise, done]() {
+    const Slot& slot = slots[index];
+    const PooledSurface& surface = *slot.surface;
+    try {
+      buffer_map_invalidate(display, slot.image->buf);
+      check_status(vaPutImage(display, surface.id, slot.image->image_id, 0, 0,
+                              surface.width, surface.height, 0, 0,
+                              surface.width, surface.height));
+      check_status(vaSyncSurface(display, surface.id));
+      done(surface);
+      promise->set_value();
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+    ring.release(index);
+  });
+  return future;
+}
+
+void UploadPipeline::flush() {
+  ring.wait_idle();
+}
+
+ReadbackPipeline::ReadbackPipeline(VaPool& pool,
+                                   const uint32_t fourcc,
+                                   const int width,
+                                   const int height,
+                                   const std::size_t depth)
+    : display(pool.display()), width(width), height(height), ring(depth) {
+  for (std::size_t i = 0; i < depth; i++) {
+    images.push_back(pool.acquire_image(fourcc, width, height));
+  }
+}
+
+ReadbackPipeline::~ReadbackPipeline() {
+  flush();
+}
+
+std::future<SolidRgbImage> ReadbackPipeline::submit(
+    const VASurfaceID surface) {
+  const std::size_t index = ring.acquire();
+  auto promise = std::make_shared<std::promise<SolidRgbImage>>();
+  std::future<SolidRgbImage> future = promise->get_future();
+
+  transfer.push([this, index, promise, surface]() {
+    const VAImage& image = *images[index];
+    try {
+      check_status(vaSyncSurface(display, surface));
+      buffer_map_invalidate(display, image.buf);
+      check_status(vaGetImage(display, surface, 0, 0, width, height,
+                              image.image_id));
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+      ring.release(index);
+      return;
+    }
+
+    convert.push([this, index, promise, &image]() {
+      try {
+        promise->set_value(va_image_copy_to_png(display, image));
+      } catch (...) {
+        promise->set_exception(std::current_exception());
+      }
+      ring.release(index);
+    });
+  });
+  return future;
+}
+
+void ReadbackPipeline::flush() {
+  ring.wait_idle();
+}
+}
@@ -0,0 +1,155 @@
+// Copyright 2017 Neverware
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+#include <va/va.h>
+
+#include "src/convert.h"
+#include "src/io.h"
+#include "src/parallel.h"
+#include "src/pool.h"
+
+namespace vadem {
+
+// Hands out |size| slots round-robin, waiting for the next one to be
+// released if it's still in use. Used by the pipelines below to bound
+// the frames in flight.
+class SlotRing {
+ public:
+  explicit SlotRing(std::size_t size);
+
+  std::size_t acquire();
+
+  void release(std::size_t slot);
+
+  // Wait until every slot has been released
+  void wait_idle();
+
+  std::size_t size() const { return busy.size(); }
+
+ private:
+  std::vector<bool> busy;
+  std::size_t next;
+  std::mutex mutex;
+  std::condition_variable released;
+};
+
+// Uploads a stream of same-size PNG frames into surfaces, overlapping the
+// CPU conversion of each frame with the vaPutImage() and vaSyncSurface()
+// of the ones before it, so a steady stream runs at the slower of the two
+// rather than their sum.
+//
+// Each of |depth| slots owns a staging image and a surface leased from
+// |pool|. submit() converts a frame into the next free slot's image on
+// the calling thread, then queues the transfer to a thread of its own,
+// which calls |done| with the surface once vaSyncSurface() says it holds
+// the frame. The slot, and with it the surface, is reused once |done|
+// returns. A |depth| of 1 makes every step wait for the one before.
+//
+//   UploadPipeline pipeline(pool, VA_FOURCC_NV12, 1920, 1080);
+//   for (const SolidRgbImage& frame : frames) {
+//     pipeline.submit(frame, [&](const PooledSurface& surface) {
+//       encode(surface);
+//     });
+//   }
+//   pipeline.flush();
+//
+// Frames are converted with the default arithmetic. The pool must
+// outlive the pipeline.
+class UploadPipeline {
+ public:
+  // Called on the transfer thread
+  using Callback = std::function<void(const PooledSurface&)>;
+
+  UploadPipeline(VaPool& pool,
+                 uint32_t fourcc,
+                 int width,
+                 int height,
+                 std::size_t depth = 2,
+                 ChromaFilter filter = ChromaFilter::kBox);
+
+  // Waits for frames in flight
+  ~UploadPipeline();
+
+  UploadPipeline(const UploadPipeline&) = delete;
+  UploadPipeline& operator=(const UploadPipeline&) = delete;
+
+  // Queue |src| for upload, blocking while every slot is in use. Errors
+  // converting |src| are thrown from here; errors transferring it, or
+  // thrown by |done|, are delivered through the future, which is ready
+  // once |done| has returned.
+  std::future<void> submit(const SolidRgbImage& src, Callback done);
+
+  // Wait until every submitted frame is done
+  void flush();
+
+ private:
+  struct Slot {
+    ImageLease image;
+    SurfaceLease surface;
+  };
+
+  VADisplay display;
+  const ChromaFilter filter;
+  std::vector<Slot> slots;
+  SlotRing ring;
+  // Last, so it finishes queued transfers before the slots go away
+  TaskQueue transfer;
+};
+
+// The reverse of UploadPipeline: reads surfaces back and converts them
+// to PNG images, overlapping the vaGetImage() of each frame with the
+// conversion of the one before it on two threads of its own. Each of
+// |depth| slots owns a staging image leased from |pool|.
+//
+//   ReadbackPipeline pipeline(pool, VA_FOURCC_NV12, 1920, 1080);
+//   std::vector<std::future<SolidRgbImage>> frames;
+//   for (const VASurfaceID surface : surfaces) {
+//     frames.push_back(pipeline.submit(surface));
+//   }
+//
+// NV12 frames are converted with the default arithmetic. The pool must
+// outlive the pipeline.
+class ReadbackPipeline {
+ public:
+  ReadbackPipeline(VaPool& pool,
+                   uint32_t fourcc,
+                   int width,
+                   int height,
+                   std::size_t depth = 2);
+
+  // Waits for frames in flight
+  ~ReadbackPipeline();
+
+  ReadbackPipeline(const ReadbackPipeline&) = delete;
+  ReadbackPipeline& operator=(const ReadbackPipeline&) = delete;
+
+  // Queue |surface| for readback once pending work on it is done,
+  // blocking while every slot is in use. |surface| mustn't be written to
+  // again until the returned future is ready.
+  std::future<SolidRgbImage> submit(VASurfaceID surface);
+
+  // Wait until every submitted frame is done
+  void flush();
+
+ private:
+  VADisplay display;
+  const int width, height;
+  std::vector<ImageLease> images;
+  SlotRing ring;
+  // Transfers queue conversions, so they're finished first
+  TaskQueue convert;
+  TaskQueue transfer;
+};
+}
+
+#endif  // PIPELINE_H_
@@ -0,0 +1,263 @@
+// Copyright 2017 Neverware
+
+#ifndef PNG_STREAM_H_
+#define PNG_STREAM_H_
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <va/va.h>
+
+#include "color.h"
+#include "convert.h"
+#include "i420.h"
+#include "nv12.h"
+#include "p016.h"
+#include "png.hpp"
+#include "rgb.h"
+#include "staging.h"
+
+namespace vadem {
+
+// png++ consumer that decodes an RGB PNG straight into a mapped NV12
+// VAImage of the same size. Rows are decoded into a two-row staging
+// buffer and converted a pair at a time as the next pair comes in, so the
+// RGB image is never held in memory as a whole. Converted rows are
+// written to |dst| through a RowWriter.
+//
+//   Nv12UploadConsumer<> consumer(display, image);
+//   consumer.read(stream);
+//
+// Interlaced PNGs aren't supported, since their rows don't arrive in
+// order.
+template <typename Arithmetic = FloatArithmetic<>>
+class Nv12UploadConsumer
+    : public png::consumer<png::rgb_pixel, Nv12UploadConsumer<Arithmetic>> {
+ public:
+  using Base = png::consumer<png::rgb_pixel, Nv12UploadConsumer<Arithmetic>>;
+
+  Nv12UploadConsumer(VADisplay display,
+                     const VAImage& dst,
+                     const ChromaFilter filter = ChromaFilter::kBox)
+      : Base(info_template()),
+        buf(display, dst),
+        filter(filter),
+        writer(3, buf.width()),
+        row_bytes(buf.width() * 3),
+        staging(row_bytes * 2) {}
+
+  // Like png::image, converts grayscale, palette and alpha PNGs to RGB
+  template <typename Stream>
+  void read(Stream& stream) {
+    Base::read(stream, png::convert_color_space<png::rgb_pixel>());
+    // The last pair has no successor to trigger its conversion
+    convert_pair(buf.height() - 2);
+  }
+
+  // Called by png::consumer once the header has been read
+  void reset(const std::size_t /*pass*/) {
+    const png::image_info& info = this->get_info();
+    assert_equal(info.get_width(), buf.width());
+    assert_equal(info.get_height(), buf.height());
+    if (info.get_interlace_type() != png::interlace_none) {
+      throw std::runtime_error("can't stream an interlaced PNG");
+    }
+  }
+
+  // Called by png::consumer for the buffer to decode row |pos| into
+  png::byte* get_next_row(const std::size_t pos) {
+    if ((pos % 2) == 0 && pos > 0) {
+      convert_pair(pos - 2);
+    }
+    return &staging[(pos % 2) * row_bytes];
+  }
+
+ private:
+  // Only copied by the base class, which fills it in from the header
+  static png::image_info& info_template() {
+    static png::image_info info = png::make_image_info<png::rgb_pixel>();
+    return info;
+  }
+
+  void convert_pair(const std::size_t y) {
+    rgb_rows_to_nv12<Arithmetic>(&staging[0], &staging[row_bytes],
+                                 buf.width(), writer.stage(0, buf.y_row(y)),
+                                 writer.stage(1, buf.y_row(y + 1)),
+                                 writer.stage(2, buf.uv_row(y)), filter);
+    writer.flush();
+  }
+
+  Nv12Buffer buf;
+  const ChromaFilter filter;
+  RowWriter writer;
+  const std::size_t row_bytes;
+  std::vector<png::byte> staging;
+};
+
+// Reads the rows of a mapped 8-bit 4:2:0 image, |Buffer| being
+// Nv12Buffer or I420Buffer, in the form nv12_row_to_rgb() takes them:
+// luma rows as they are and chroma rows interleaved. Planar chroma is
+// merged into scratch memory as it's read. Rows go through RowReaders,
+// and each returned row stays valid until the next call for the same
+// plane. Not thread safe; use one per thread.
+template <typename Buffer>
+class Yuv420RowSource;
+
+template <>
+class Yuv420RowSource<Nv12Buffer> {
+ public:
+  explicit Yuv420RowSource(const Nv12Buffer& buf)
+      : buf(buf), reader(2, buf.width()) {}
+
+  const uint8_t* y_row(const std::size_t y) {
+    return reader.fetch(0, buf.y_row(y));
+  }
+
+  // Chroma shared by luma rows |y| and |y| ^ 1
+  const uint8_t* uv_row(const std::size_t y) {
+    return reader.fetch(1, buf.uv_row(y));
+  }
+
+ private:
+  const Nv12Buffer& buf;
+  RowReader reader;
+};
+
+template <>
+class Yuv420RowSource<I420Buffer> {
+ public:
+  explicit Yuv420RowSource(const I420Buffer& buf)
+      : buf(buf),
+        luma_reader(1, buf.width()),
+        chroma_reader(2, buf.width() / 2),
+        merged(buf.width()) {}
+
+  const uint8_t* y_row(const std::size_t y) {
+    return luma_reader.fetch(0, buf.y_row(y));
+  }
+
+  const uint8_t* uv_row(const std::size_t y) {
+    nv12_uv_merge(chroma_reader.fetch(0, buf.u_row(y)),
+                  chroma_reader.fetch(1, buf.v_row(y)), buf.width() / 2,
+                  &merged[0]);
+    return &merged[0];
+  }
+
+ private:
+  const I420Buffer& buf;
+  RowReader luma_reader;
+  RowReader chroma_reader;
+  std::vector<uint8_t> merged;
+};
+
+// png++ generator that encodes a mapped 8-bit 4:2:0 VAImage as an RGB
+// PNG, converting each row just before it's compressed. |Buffer| is
+// Nv12Buffer for NV12 images, or I420Buffer for I420 and YV12 ones.
+// Source rows are read through a Yuv420RowSource, and only one RGB row of
+// scratch memory is needed.
+//
+//   Nv12DownloadGenerator<> generator(display, image);
+//   generator.write(stream);
+template <typename Arithmetic = FloatArithmetic<>,
+          typename Buffer = Nv12Buffer>
+class Yuv420DownloadGenerator
+    : public png::generator<png::rgb_pixel,
+                            Yuv420DownloadGenerator<Arithmetic, Buffer>> {
+ public:
+  using Base = png::generator<png::rgb_pixel,
+                              Yuv420DownloadGenerator<Arithmetic, Buffer>>;
+
+  Yuv420DownloadGenerator(VADisplay display, const VAImage& src)
+      : Base(src.width, src.height),
+        buf(display, src),
+        rows(buf),
+        uv(nullptr),
+        scratch(buf.width() * 3) {}
+
+  // Called by png::generator for the contents of row |pos|, in order
+  png::byte* get_next_row(const std::size_t pos) {
+    if ((pos % 2) == 0) {
+      uv = rows.uv_row(pos);
+    }
+    nv12_row_to_rgb<Arithmetic>(rows.y_row(pos), uv, buf.width(),
+                                &scratch[0]);
+    return &scratch[0];
+  }
+
+ private:
+  const Buffer buf;
+  Yuv420RowSource<Buffer> rows;
+  const uint8_t* uv;
+  std::vector<png::byte> scratch;
+};
+
+template <typename Arithmetic = FloatArithmetic<>>
+using Nv12DownloadGenerator = Yuv420DownloadGenerator<Arithmetic, Nv12Buffer>;
+
+template <typename Arithmetic = FloatArithmetic<>>
+using I420DownloadGenerator = Yuv420DownloadGenerator<Arithmetic, I420Buffer>;
+
+// Yuv420DownloadGenerator for P010 and P016 images, as a 16-bit RGB PNG
+// converted with the p016_row_to_rgb16() arithmetic for |Matrix|.
+// png++ swaps the host-order samples to big-endian as it writes.
+template <typename Matrix = Bt2020Limited>
+class P016DownloadGenerator
+    : public png::generator<png::rgb_pixel_16, P016DownloadGenerator<Matrix>> {
+ public:
+  using Base =
+      png::generator<png::rgb_pixel_16, P016DownloadGenerator<Matrix>>;
+
+  P016DownloadGenerator(VADisplay display, const VAImage& src)
+      : Base(src.width, src.height),
+        buf(display, src),
+        reader(2, buf.width() * 2),
+        uv(nullptr),
+        scratch(buf.width() * 3) {}
+
+  png::byte* get_next_row(const std::size_t pos) {
+    if ((pos % 2) == 0) {
+      uv = fetch(1, buf.uv_row(pos));
+    }
+    p016_row_to_rgb16<Matrix>(fetch(0, buf.y_row(pos)), uv, buf.width(),
+                              &scratch[0]);
+    return reinterpret_cast<png::byte*>(&scratch[0]);
+  }
+
+ private:
+  const uint16_t* fetch(const std::size_t index, const uint16_t* src) {
+    return reinterpret_cast<const uint16_t*>(
+        reader.fetch(index, reinterpret_cast<const uint8_t*>(src)));
+  }
+
+  const P016Buffer buf;
+  RowReader reader;
+  const uint16_t* uv;
+  std::vector<uint16_t> scratch;
+};
+
+// Nv12DownloadGenerator for RGBX images
+class RgbDownloadGenerator
+    : public png::generator<png::rgb_pixel, RgbDownloadGenerator> {
+ public:
+  using Base = png::generator<png::rgb_pixel, RgbDownloadGenerator>;
+
+  RgbDownloadGenerator(VADisplay display, const VAImage& src)
+      : Base(src.width, src.height),
+        buf(display, src),
+        reader(1, buf.width() * buf.pixel_size()),
+        scratch(buf.width() * 3) {}
+
+  png::byte* get_next_row(const std::size_t pos) {
+    rgbx_row_to_rgb(reader.fetch(0, buf.row(pos)), buf.width(), &scratch[0]);
+    return &scratch[0];
+  }
+
+ private:
+  const RgbBuffer buf;
+  RowReader reader;
+  std::vector<png::byte> scratch;
+};
+}
+
+#endif  // PNG_STREAM_H_
@@ -0,0 +1,231 @@
+// Copyright 2017 Neverware
+
+#include "src/pool.h"
+
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include "src/util.h"
+#include "src/va_util.h"
+
+namespace vadem {
+
+namespace {
+
+// Bytes of a |width| x |height| surface holding |fourcc|, ignoring
+// whatever padding the driver adds
+std::size_t surface_bytes(const uint32_t fourcc,
+                          const unsigned int width,
+                          const unsigned int height) {
+  const std::size_t pixels = static_cast<std::size_t>(width) * height;
+  switch (fourcc) {
+    case VA_FOURCC_RGBX:
+      return pixels * 4;
+    case VA_FOURCC_P010:
+    case VA_FOURCC_P016:
+      return pixels * 3;
+  }
+  return pixels * 3 / 2;
+}
+
+}  // namespace
+
+VaPool::VaPool(VADisplay display, const std::size_t max_bytes)
+    : display_(display), max_bytes_(max_bytes), stats_() {}
+
+VaPool::~VaPool() {
+  clear();
+}
+
+ImageLease VaPool::acquire_image(const uint32_t fourcc,
+                                 const int width,
+                                 const int height) {
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (take_idle(true, fourcc, width, height, &entry)) {
+      stats_.hits++;
+      stats_.leased_bytes += entry.bytes;
+      return ImageLease(this, entry.image);
+    }
+    stats_.misses++;
+  }
+
+  VAImage image;
+  switch (fourcc) {
+    case VA_FOURCC_NV12:
+      image = va_image_create_nv12(display_, width, height);
+      break;
+    case VA_FOURCC_I420:
+      image = va_image_create_i420(display_, width, height);
+      break;
+    case VA_FOURCC_YV12:
+      image = va_image_create_yv12(display_, width, height);
+      break;
+    case VA_FOURCC_P010:
+      image = va_image_create_p010(display_, width, height);
+      break;
+    case VA_FOURCC_P016:
+      image = va_image_create_p016(display_, width, height);
+      break;
+    case VA_FOURCC_RGBX:
+      image = va_image_create_rgb(display_, width, height);
+      break;
+    default:
+      throw std::runtime_error("no pooled images for fourcc " +
+                               hex_str(fourcc));
+  }
+
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    make_room(image.data_size, &evicted);
+    stats_.leased_bytes += image.data_size;
+  }
+  for (const Entry& old : evicted) {
+    destroy(old);
+  }
+  return ImageLease(this, image);
+}
+
+SurfaceLease VaPool::acquire_surface(const uint32_t fourcc,
+                                     const int width,
+                                     const int height) {
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (take_idle(false, fourcc, width, height, &entry)) {
+      stats_.hits++;
+      stats_.leased_bytes += entry.bytes;
+      return SurfaceLease(this, {entry.surface, fourcc, entry.width,
+                                 entry.height});
+    }
+    stats_.misses++;
+  }
+
+  VASurfaceAttrib attrib;
+  attrib.type = VASurfaceAttribPixelFormat;
+  attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+  attrib.value.type = VAGenericValueTypeInteger;
+  attrib.value.value.i = fourcc;
+
+  PooledSurface surface{VA_INVALID_SURFACE, fourcc,
+                        static_cast<unsigned int>(width),
+                        static_cast<unsigned int>(height)};
+  check_status(vaCreateSurfaces(display_, va_surface_rt_format(fourcc), width,
+                                height, &surface.id, 1, &attrib, 1));
+
+  const std::size_t bytes = surface_bytes(fourcc, width, height);
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    make_room(bytes, &evicted);
+    stats_.leased_bytes += bytes;
+  }
+  for (const Entry& old : evicted) {
+    destroy(old);
+  }
+  return SurfaceLease(this, surface);
+}
+
+void VaPool::clear() {
+  std::list<Entry> idle;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle.swap(idle_);
+    stats_.idle_bytes = 0;
+  }
+  for (const Entry& entry : idle) {
+    destroy(entry);
+  }
+}
+
+VaPool::Stats VaPool::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+bool VaPool::take_idle(const bool is_image,
+                       const uint32_t fourcc,
+                       const unsigned int width,
+                       const unsigned int height,
+                       Entry* entry) {
+  // Most recently released first, since it's the likeliest to still be
+  // in cache
+  for (auto it = idle_.rbegin(); it != idle_.rend(); ++it) {
+    if (it->is_image == is_image && it->fourcc == fourcc &&
+        it->width == width && it->height == height) {
+      *entry = *it;
+      stats_.idle_bytes -= it->bytes;
+      idle_.erase(std::next(it).base());
+      return true;
+    }
+  }
+  return false;
+}
+
+void VaPool::make_room(const std::size_t extra, std::list<Entry>* evicted) {
+  while (!idle_.empty() &&
+         stats_.leased_bytes + stats_.idle_bytes + extra > max_bytes_) {
+    stats_.idle_bytes -= idle_.front().bytes;
+    stats_.evictions++;
+    evicted->splice(evicted->end(), idle_, idle_.begin());
+  }
+}
+
+void VaPool::destroy(const Entry& entry) {
+  if (entry.is_image) {
+    va_image_destroy(display_, entry.image);
+  } else {
+    VASurfaceID surface = entry.surface;
+    check_status(vaDestroySurfaces(display_, &surface, 1));
+  }
+}
+
+void VaPool::release(const VAImage& image) {
+  Entry entry{};
+  entry.is_image = true;
+  entry.fourcc = image.format.fourcc;
+  entry.width = image.width;
+  entry.height = image.height;
+  entry.bytes = image.data_size;
+  entry.image = image;
+  entry.surface = VA_INVALID_SURFACE;
+  release(entry);
+}
+
+void VaPool::release(const PooledSurface& surface) {
+  Entry entry{};
+  entry.is_image = false;
+  entry.fourcc = surface.fourcc;
+  entry.width = surface.width;
+  entry.height = surface.height;
+  entry.bytes = surface_bytes(surface.fourcc, surface.width, surface.height);
+  entry.surface = surface.id;
+  release(entry);
+}
+
+void VaPool::release(Entry entry) {
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.leased_bytes -= entry.bytes;
+    // An entry over the ceiling on its own would flush the pool and still
+    // not fit
+    if (entry.bytes <= max_bytes_) {
+      make_room(entry.bytes, &evicted);
+    }
+    if (stats_.leased_bytes + stats_.idle_bytes + entry.bytes > max_bytes_) {
+      stats_.evictions++;
+      evicted.push_back(entry);
+    } else {
+      stats_.idle_bytes += entry.bytes;
+      idle_.push_back(entry);
+    }
+  }
+  for (const Entry& old : evicted) {
+    destroy(old);
+  }
+}
+}
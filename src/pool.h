@@ -0,0 +1,171 @@
+// Copyright 2017 Neverware
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+
+#include <va/va.h>
+
+namespace vadem {
+
+class VaPool;
+
+// Surface handed out by VaPool, with what it was created for
+struct PooledSurface {
+  VASurfaceID id;
+  uint32_t fourcc;
+  unsigned int width, height;
+};
+
+// Move-only handle to a VAImage or PooledSurface borrowed from a VaPool,
+// which gets it back when the lease is reset or destroyed. The pool must
+// outlive its leases.
+template <typename Resource>
+class Lease {
+ public:
+  Lease() : pool(nullptr), resource() {}
+
+  Lease(Lease&& other) : pool(other.pool), resource(other.resource) {
+    other.pool = nullptr;
+  }
+
+  Lease& operator=(Lease&& other) {
+    if (this != &other) {
+      reset();
+      pool = other.pool;
+      resource = other.resource;
+      other.pool = nullptr;
+    }
+    return *this;
+  }
+
+  Lease(const Lease&) = delete;
+  Lease& operator=(const Lease&) = delete;
+
+  ~Lease() { reset(); }
+
+  // Return the resource to the pool now
+  void reset();
+
+  explicit operator bool() const { return pool != nullptr; }
+
+  const Resource& get() const { return resource; }
+
+  const Resource& operator*() const { return resource; }
+
+  const Resource* operator->() const { return &resource; }
+
+ private:
+  friend class VaPool;
+
+  Lease(VaPool* pool, const Resource& resource)
+      : pool(pool), resource(resource) {}
+
+  VaPool* pool;
+  Resource resource;
+};
+
+using ImageLease = Lease<VAImage>;
+using SurfaceLease = Lease<PooledSurface>;
+
+// Recycles VAImages and surfaces by (fourcc, width, height), so a frame
+// loop at one resolution allocates once instead of every frame. Released
+// resources wait in the pool until a matching acquire takes them, or
+// until they're evicted, least recently released first, to keep the
+// pool's memory under |max_bytes|. Leases that would go over the ceiling
+// are still granted, but destroyed on release instead of kept.
+//
+//   VaPool pool(display, 256 << 20);
+//   ImageLease image = pool.acquire_image(VA_FOURCC_NV12, 1920, 1080);
+//   va_image_nv12_copy_from_png(display, *image, png);
+//
+// Thread safe.
+class VaPool {
+ public:
+  struct Stats {
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t evictions;
+    // Estimated memory in the pool, leased or waiting to be
+    std::size_t leased_bytes;
+    std::size_t idle_bytes;
+  };
+
+  VaPool(VADisplay display, std::size_t max_bytes);
+
+  // Destroys every idle resource. Outstanding leases must already have
+  // been released.
+  ~VaPool();
+
+  VaPool(const VaPool&) = delete;
+  VaPool& operator=(const VaPool&) = delete;
+
+  // NV12, I420, YV12, P010, P016 or RGBX image, see
+  // va_image_create_nv12() and its siblings
+  ImageLease acquire_image(uint32_t fourcc, int width, int height);
+
+  // Surface holding |fourcc|, see va_surface_rt_format()
+  SurfaceLease acquire_surface(uint32_t fourcc, int width, int height);
+
+  // Destroy every idle resource
+  void clear();
+
+  Stats stats() const;
+
+  VADisplay display() const { return display_; }
+
+ private:
+  friend class Lease<VAImage>;
+  friend class Lease<PooledSurface>;
+
+  struct Entry {
+    bool is_image;
+    uint32_t fourcc;
+    unsigned int width, height;
+    std::size_t bytes;
+    VAImage image;
+    VASurfaceID surface;
+  };
+
+  // Remove and return an idle entry matching the key, if there is one.
+  // Called with |mutex| held.
+  bool take_idle(bool is_image,
+                 uint32_t fourcc,
+                 unsigned int width,
+                 unsigned int height,
+                 Entry* entry);
+
+  // Evict idle entries, oldest first, until |extra| more bytes fit under
+  // the ceiling or nothing idle is left, moving them to |evicted| for the
+  // caller to destroy once it has unlocked |mutex|. Called with |mutex|
+  // held.
+  void make_room(std::size_t extra, std::list<Entry>* evicted);
+
+  void destroy(const Entry& entry);
+
+  void release(const VAImage& image);
+  void release(const PooledSurface& surface);
+  void release(Entry entry);
+
+  VADisplay display_;
+  const std::size_t max_bytes_;
+  mutable std::mutex mutex_;
+  std::list<Entry> idle_;
+  Stats stats_;
+};
+
+template <typename Resource>
+void Lease<Resource>::reset() {
+  if (pool) {
+    VaPool* const owner = pool;
+    pool = nullptr;
+    owner->release(resource);
+  }
+}
+}
+
+#endif  // POOL_H_
@@ -0,0 +1,204 @@
+// Copyright 2017 Neverware
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace vadem {
+
+// Bounded multi-producer, multi-consumer queue without locks, after
+// Dmitry Vyukov's: each cell carries a sequence number saying whether
+// it's ready to be written or read on the current lap, so producers and
+// consumers only contend on their own position counter.
+//
+// push() and pop() wait while the queue is full or empty, yielding for
+// a while before backing off to sleeps so that idle stages don't burn a
+// core. Once close() has been called, pop() drains what's left and then
+// returns false.
+//
+// Also records how full the queue was at each push and how often either
+// side had to wait, to show which end of it is the bottleneck.
+template <typename T>
+class BoundedQueue {
+ public:
+  struct Stats {
+    std::size_t capacity;
+    // Items in the queue just after each push
+    double mean_occupancy;
+    std::size_t peak_occupancy;
+    // Pushes that found the queue full, and pops that found it empty
+    std::size_t full_waits;
+    std::size_t empty_waits;
+  };
+
+  // |capacity| is rounded up to a power of two
+  explicit BoundedQueue(std::size_t capacity)
+      : mask(round_up_pow2(capacity) - 1),
+        cells(new Cell[mask + 1]),
+        enqueue(0),
+        dequeue(0),
+        closed(false),
+        pushes(0),
+        occupancy_sum(0),
+        peak(0),
+        full_waits(0),
+        empty_waits(0) {
+    for (std::size_t i = 0; i <= mask; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Moves from |value| and returns true if there was room
+  bool try_push(T& value) {
+    std::size_t pos = enqueue.value.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[pos & mask];
+      const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const std::intptr_t diff = static_cast<std::intptr_t>(seq) -
+                                 static_cast<std::intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue.value.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          record_push(pos + 1);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue.value.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T* value) {
+    std::size_t pos = dequeue.value.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[pos & mask];
+      const std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+      const std::intptr_t diff = static_cast<std::intptr_t>(seq) -
+                                 static_cast<std::intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue.value.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+          *value = std::move(cell.value);
+          cell.sequence.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue.value.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(T value) {
+    if (try_push(value)) {
+      return;
+    }
+    full_waits.fetch_add(1, std::memory_order_relaxed);
+    for (unsigned attempt = 0; !try_push(value); attempt++) {
+      backoff(attempt);
+    }
+  }
+
+  // Next item, or false once the queue is closed and empty
+  bool pop(T* value) {
+    if (try_pop(value)) {
+      return true;
+    }
+    empty_waits.fetch_add(1, std::memory_order_relaxed);
+    for (unsigned attempt = 0;; attempt++) {
+      // Check before trying again, so nothing pushed before close() is
+      // missed
+      const bool was_closed = closed.load(std::memory_order_acquire);
+      if (try_pop(value)) {
+        return true;
+      }
+      if (was_closed) {
+        return false;
+      }
+      backoff(attempt);
+    }
+  }
+
+  // No more pushes will follow
+  void close() { closed.store(true, std::memory_order_release); }
+
+  Stats stats() const {
+    const std::size_t count = pushes.load(std::memory_order_relaxed);
+    return {mask + 1,
+            count ? static_cast<double>(occupancy_sum.load()) / count : 0.0,
+            peak.load(), full_waits.load(), empty_waits.load()};
+  }
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  // Padded to a cache line so producers and consumers don't share one
+  struct Position {
+    std::atomic<std::size_t> value;
+    char pad[64 - sizeof(std::atomic<std::size_t>)];
+
+    explicit Position(const std::size_t pos) : value(pos) {}
+  };
+
+  static std::size_t round_up_pow2(const std::size_t n) {
+    std::size_t pow2 = 1;
+    while (pow2 < n) {
+      pow2 *= 2;
+    }
+    return pow2;
+  }
+
+  static void backoff(const unsigned attempt) {
+    if (attempt < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  // Called after claiming position |end| - 1
+  void record_push(const std::size_t end) {
+    const std::size_t begin = dequeue.value.load(std::memory_order_relaxed);
+    const std::size_t size = (end > begin) ? end - begin : 0;
+    pushes.fetch_add(1, std::memory_order_relaxed);
+    occupancy_sum.fetch_add(size, std::memory_order_relaxed);
+    std::size_t old_peak = peak.load(std::memory_order_relaxed);
+    while (size > old_peak &&
+           !peak.compare_exchange_weak(old_peak, size,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  const std::size_t mask;
+  const std::unique_ptr<Cell[]> cells;
+  Position enqueue;
+  Position dequeue;
+  std::atomic<bool> closed;
+
+  std::atomic<std::size_t> pushes;
+  std::atomic<uint64_t> occupancy_sum;
+  std::atomic<std::size_t> peak;
+  std::atomic<std::size_t> full_waits;
+  std::atomic<std::size_t> empty_waits;
+};
+}
+
+#endif  // QUEUE_H_
@@ -0,0 +1,354 @@
+// Copyright 2017 Neverware
+
+#include "src/raw.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "src/convert.h"
+#include "src/i420.h"
+#include "src/nv12.h"
+#include "src/parallel.h"
+#include "src/staging.h"
+#include "src/util.h"
+#include "src/va_util.h"
+
+namespace vadem {
+
+namespace {
+
+std::runtime_error file_error(const std::string& filename,
+                              const std::string& what) {
+  return std::runtime_error(what + " " + filename + ": " + strerror(errno));
+}
+
+// Where each plane of a packed frame starts. NV12 has its chroma all in
+// |u| and leaves |v| unused.
+struct PackedPlanes {
+  std::size_t y, u, v;
+  bool interleaved;
+};
+
+PackedPlanes packed_planes(const uint32_t fourcc,
+                           const std::size_t width,
+                           const std::size_t height) {
+  const std::size_t luma = width * height;
+  const std::size_t chroma = luma / 4;
+  switch (fourcc) {
+    case VA_FOURCC_NV12:
+      return {0, luma, 0, true};
+    case VA_FOURCC_I420:
+      return {0, luma, luma + chroma, false};
+    case VA_FOURCC_YV12:
+      return {0, luma + chroma, luma, false};
+  }
+  throw std::runtime_error("no raw layout for fourcc " + hex_str(fourcc));
+}
+
+// A file mapped for its lifetime
+class MappedFile {
+ public:
+  // Map all of an existing file for reading, or create (or truncate) one
+  // of |size| bytes for writing
+  MappedFile(const std::string& filename, bool write, std::size_t size = 0)
+      : fd(open(filename.c_str(),
+                write ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY,
+                0644)),
+        mem(nullptr),
+        length(size) {
+    if (fd == -1) {
+      throw file_error(filename, "failed to open");
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      fail(filename, "failed to stat");
+    }
+    // Character devices and pipes can't be mapped; data() stays null
+    // and writers fall back to write()
+    if (!S_ISREG(info.st_mode)) {
+      if (!write) {
+        close(fd);
+        throw std::runtime_error("not a regular file: " + filename);
+      }
+      return;
+    }
+
+    if (write) {
+      if (ftruncate(fd, length) != 0) {
+        fail(filename, "failed to resize");
+      }
+    } else {
+      length = info.st_size;
+    }
+    if (length == 0) {
+      return;
+    }
+
+    void* const addr =
+        mmap(nullptr, length, write ? (PROT_READ | PROT_WRITE) : PROT_READ,
+             write ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      fail(filename, "failed to map");
+    }
+    mem = static_cast<uint8_t*>(addr);
+  }
+
+  ~MappedFile() {
+    if (mem) {
+      munmap(mem, length);
+    }
+    close(fd);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  uint8_t* data() const { return mem; }
+
+  std::size_t size() const { return length; }
+
+  int descriptor() const { return fd; }
+
+ private:
+  // Closes the file, keeping errno for the message
+  [[noreturn]] void fail(const std::string& filename, const char* what) {
+    const std::runtime_error error = file_error(filename, what);
+    close(fd);
+    throw error;
+  }
+
+  const int fd;
+  uint8_t* mem;
+  std::size_t length;
+};
+
+// Chroma rows shared by luma rows |y| and |y| + 1 of |buf|, into the
+// packed frame at |dst|. |reader| has two slots sized by
+// chroma_row_size().
+void pack_chroma(RowReader& reader,
+                 const Nv12Buffer& buf,
+                 const std::size_t y,
+                 const PackedPlanes& planes,
+                 uint8_t* dst) {
+  const std::size_t w = buf.width();
+  const uint8_t* const uv = reader.fetch(0, buf.uv_row(y));
+  if (planes.interleaved) {
+    memcpy(dst + planes.u + (y / 2) * w, uv, w);
+  } else {
+    const std::size_t offset = (y / 2) * (w / 2);
+    nv12_uv_split(uv, w / 2, dst + planes.u + offset, dst + planes.v + offset);
+  }
+}
+
+void pack_chroma(RowReader& reader,
+                 const I420Buffer& buf,
+                 const std::size_t y,
+                 const PackedPlanes& planes,
+                 uint8_t* dst) {
+  const std::size_t half_w = buf.width() / 2;
+  const uint8_t* const u = reader.fetch(0, buf.u_row(y));
+  const uint8_t* const v = reader.fetch(1, buf.v_row(y));
+  if (planes.interleaved) {
+    nv12_uv_merge(u, v, half_w, dst + planes.u + (y / 2) * buf.width());
+  } else {
+    const std::size_t offset = (y / 2) * half_w;
+    memcpy(dst + planes.u + offset, u, half_w);
+    memcpy(dst + planes.v + offset, v, half_w);
+  }
+}
+
+std::size_t chroma_row_size(const Nv12Buffer& buf) {
+  return buf.width();
+}
+
+std::size_t chroma_row_size(const I420Buffer& buf) {
+  return buf.width() / 2;
+}
+
+template <typename Buffer>
+void pack_planes(VADisplay display,
+                 const VAImage& src,
+                 const uint32_t fourcc,
+                 uint8_t* dst) {
+  const Buffer buf(display, src);
+  const std::size_t w = buf.width();
+  const std::size_t h = buf.height();
+  const PackedPlanes planes = packed_planes(fourcc, w, h);
+
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    RowReader luma_reader(1, w);
+    RowReader chroma_reader(2, chroma_row_size(buf));
+    for (std::size_t y = begin; y < end; y += 2) {
+      memcpy(dst + planes.y + y * w, luma_reader.fetch(0, buf.y_row(y)), w);
+      memcpy(dst + planes.y + (y + 1) * w,
+             luma_reader.fetch(0, buf.y_row(y + 1)), w);
+      pack_chroma(chroma_reader, buf, y, planes, dst);
+    }
+  });
+}
+
+// Throws unless |src| is in one of the layouts above, whose planes can be
+// copied as they are
+void check_packable(const VAImage& src) {
+  switch (src.format.fourcc) {
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+      return;
+  }
+  throw std::runtime_error("can't pack fourcc " + hex_str(src.format.fourcc) +
+                           " as a raw frame");
+}
+
+// Throws unless both dimensions are even, since every chroma sample
+// covers a 2x2 block of luma
+void check_even_size(const int width, const int height) {
+  if (width % 2 || height % 2) {
+    throw std::runtime_error("raw frames need an even size, not " +
+                             std::to_string(width) + "x" +
+                             std::to_string(height));
+  }
+}
+
+}  // namespace
+
+std::size_t raw_frame_size(const std::size_t width, const std::size_t height) {
+  return width * height * 3 / 2;
+}
+
+void va_image_pack_planes(VADisplay display,
+                          const VAImage& src,
+                          const uint32_t fourcc,
+                          uint8_t* dst) {
+  check_packable(src);
+  check_even_size(src.width, src.height);
+  if (src.format.fourcc == VA_FOURCC_NV12) {
+    pack_planes<Nv12Buffer>(display, src, fourcc, dst);
+  } else {
+    pack_planes<I420Buffer>(display, src, fourcc, dst);
+  }
+}
+
+void va_image_unpack_planes(VADisplay display,
+                            const VAImage& dst,
+                            const uint32_t fourcc,
+                            const uint8_t* src) {
+  check_even_size(dst.width, dst.height);
+  Nv12Buffer buf(display, dst);
+  const std::size_t w = buf.width();
+  const std::size_t h = buf.height();
+  const PackedPlanes planes = packed_planes(fourcc, w, h);
+
+  parallel_for_rows(h, 2, [&](std::size_t begin, std::size_t end) {
+    RowWriter writer(3, w);
+    for (std::size_t y = begin; y < end; y += 2) {
+      memcpy(writer.stage(0, buf.y_row(y)), src + planes.y + y * w, w);
+      memcpy(writer.stage(1, buf.y_row(y + 1)), src + planes.y + (y + 1) * w,
+             w);
+      uint8_t* const uv = writer.stage(2, buf.uv_row(y));
+      if (planes.interleaved) {
+        memcpy(uv, src + planes.u + (y / 2) * w, w);
+      } else {
+        const std::size_t offset = (y / 2) * (w / 2);
+        nv12_uv_merge(src + planes.u + offset, src + planes.v + offset, w / 2,
+                      uv);
+      }
+      writer.flush();
+    }
+  });
+}
+
+void va_image_dump(VADisplay display,
+                   const VAImage& src,
+                   const std::string& filename,
+                   const uint32_t fourcc) {
+  std::cout << "dumping VAImage to " << filename << std::endl;
+  // Before the file is truncated
+  check_packable(src);
+  check_even_size(src.width, src.height);
+  packed_planes(fourcc, src.width, src.height);
+  const std::size_t size = raw_frame_size(src.width, src.height);
+  MappedFile file(filename, true, size);
+
+  if (file.data()) {
+    va_image_pack_planes(display, src, fourcc, file.data());
+    return;
+  }
+
+  std::vector<uint8_t> frame(size);
+  va_image_pack_planes(display, src, fourcc, frame.data());
+  std::size_t written = 0;
+  while (written < size) {
+    const ssize_t count =
+        write(file.descriptor(), frame.data() + written, size - written);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw file_error(filename, "failed to write");
+    }
+    written += count;
+  }
+}
+
+void va_image_load_raw(VADisplay display,
+                       const VAImage& dst,
+                       const std::string& filename,
+                       const uint32_t fourcc,
+                       const std::size_t frame) {
+  check_even_size(dst.width, dst.height);
+  const std::size_t size = raw_frame_size(dst.width, dst.height);
+  const MappedFile file(filename, false);
+  if (file.size() < (frame + 1) * size) {
+    throw std::runtime_error(filename + " has no frame " +
+                             std::to_string(frame) + " of " +
+                             std::to_string(dst.width) + "x" +
+                             std::to_string(dst.height));
+  }
+
+  // Read ahead through the frame rather than faulting in a page at a
+  // time. madvise() wants a page-aligned start.
+  const std::size_t page = sysconf(_SC_PAGESIZE);
+  const std::size_t begin = frame * size / page * page;
+  madvise(file.data() + begin, (frame + 1) * size - begin, MADV_WILLNEED);
+
+  const uint8_t* const src = file.data() + frame * size;
+  va_image_unpack_planes(display, dst, fourcc, src);
+}
+
+VAImage va_image_nv12_load_raw(VADisplay display,
+                               const std::string& filename,
+                               const int width,
+                               const int height,
+                               const uint32_t fourcc,
+                               const std::size_t frame) {
+  const VAImage image = va_image_create_nv12(display, width, height);
+  try {
+    va_image_load_raw(display, image, filename, fourcc, frame);
+  } catch (...) {
+    va_image_destroy(display, image);
+    throw;
+  }
+  return image;
+}
+
+ImageLease va_image_nv12_load_raw(VaPool& pool,
+                                  const std::string& filename,
+                                  const int width,
+                                  const int height,
+                                  const uint32_t fourcc,
+                                  const std::size_t frame) {
+  ImageLease image = pool.acquire_image(VA_FOURCC_NV12, width, height);
+  va_image_load_raw(pool.display(), *image, filename, fourcc, frame);
+  return image;
+}
+}
@@ -0,0 +1,92 @@
+// Copyright 2017 Neverware
+
+#ifndef RAW_H_
+#define RAW_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <va/va.h>
+
+#include "src/pool.h"
+
+namespace vadem {
+
+// Raw 4:2:0 frames: the planes of each frame packed back to back with no
+// row padding and no header, in one of three layouts picked by fourcc:
+//
+//   VA_FOURCC_NV12  Y, then interleaved CbCr
+//   VA_FOURCC_I420  Y, then Cb, then Cr
+//   VA_FOURCC_YV12  Y, then Cr, then Cb
+//
+// Frames must have an even width and height; the functions below throw
+// for any other size before touching a file.
+//
+// Files of several frames are just frames back to back. Pixels are only
+// ever copied, never converted, so moving frames between files and NV12
+// images costs a memcpy() per plane row, plus a split or merge of chroma
+// for the planar layouts.
+
+// Bytes of one |width| x |height| frame, in any of the layouts
+std::size_t raw_frame_size(std::size_t width, std::size_t height);
+
+// Copy |src|, an NV12, I420 or YV12 image, to |dst| in the |fourcc|
+// layout, dropping any row padding. Throws for any other source fourcc.
+void va_image_pack_planes(VADisplay display,
+                          const VAImage& src,
+                          uint32_t fourcc,
+                          uint8_t* dst);
+
+// The reverse: copy a frame in the |fourcc| layout at |src| into |dst|,
+// an NV12 image of the frame's size
+void va_image_unpack_planes(VADisplay display,
+                            const VAImage& dst,
+                            uint32_t fourcc,
+                            const uint8_t* src);
+
+// Write |src|, an NV12, I420 or YV12 image, as a raw frame. Other source
+// fourccs throw before |filename| is opened. Regular files are sized up
+// front and written through a shared mapping, so the frame goes from the
+// image to the page cache in a single copy; anything else (/dev/null, a
+// pipe) is written from a scratch copy. ImageMagick can display an NV12
+// file like so:
+//
+// display -size 512x512 -depth 8 -sample 4:2:0 -interlace plane
+// yuv:coolfile.raw
+//
+// or try: http://rawpixels.net/
+void va_image_dump(VADisplay display,
+                   const VAImage& src,
+                   const std::string& filename,
+                   uint32_t fourcc = VA_FOURCC_NV12);
+
+// Copy frame |frame| of the raw file at |filename| into |dst|, an NV12
+// image whose size says how big the file's frames are. The file is
+// mapped rather than read, so only the pages of that frame are touched,
+// and they are read ahead together.
+// Throws if the file can't be mapped or is too short.
+void va_image_load_raw(VADisplay display,
+                       const VAImage& dst,
+                       const std::string& filename,
+                       uint32_t fourcc = VA_FOURCC_NV12,
+                       std::size_t frame = 0);
+
+// As above, into a new NV12 image of |width| x |height|
+VAImage va_image_nv12_load_raw(VADisplay display,
+                               const std::string& filename,
+                               int width,
+                               int height,
+                               uint32_t fourcc = VA_FOURCC_NV12,
+                               std::size_t frame = 0);
+
+// As above, into an image leased from |pool|
+ImageLease va_image_nv12_load_raw(VaPool& pool,
+                                  const std::string& filename,
+                                  int width,
+                                  int height,
+                                  uint32_t fourcc = VA_FOURCC_NV12,
+                                  std::size_t frame = 0);
+}
+
+#endif  // RAW_H_
@@ -0,0 +1,85 @@
+// Copyright 2017 Neverware
+
+#ifndef RGB_H_
+#define RGB_H_
+
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+#include <va/va.h>
+
+#include "scoped_buffer_map.h"
+#include "va_util.h"
+
+namespace vadem {
+
+// Packed RGB counterpart of Nv12Buffer: maps an RGBX image for its
+// lifetime and hands out rows honoring the image's pitch and offset.
+//
+// RGBX pixels are always four bytes. Drivers disagree on whether that
+// shows up as the format's depth or its bits_per_pixel, so neither is
+// used for addressing. |Access| is as for BasicNv12Buffer.
+template <typename Access = DefaultAccess>
+class BasicRgbBuffer {
+ public:
+  using Offset = std::size_t;
+
+  BasicRgbBuffer(VADisplay display, const VAImage& image)
+      : image(image),
+        bufmap(display, image.buf),
+        mem(bufmap.data()),
+        w(image.width),
+        h(image.height),
+        bytes_per_pixel(4),
+        plane1(image.offsets[0]),
+        pitch1(image.pitches[0]) {
+    assert_equal(image.format.fourcc, (unsigned)VA_FOURCC_RGBX);
+    assert((image.format.depth == 24u) || (image.format.depth == 32u));
+
+    if (pitch1 < w * bytes_per_pixel) {
+      throw std::runtime_error("RGB pitch smaller than row: " +
+                               std::to_string(pitch1) + " < " +
+                               std::to_string(w * bytes_per_pixel));
+    }
+  }
+
+  Offset offset(const Offset x, const Offset y) const {
+    return Access::check(image, raw_offset(x, y));
+  }
+
+  // Row |y|, |width()| * |pixel_size()| bytes. The whole row is
+  // bounds-checked once so callers can work on it directly.
+  uint8_t* row(const Offset y) { return mem + offset_row(y); }
+
+  const uint8_t* row(const Offset y) const { return mem + offset_row(y); }
+
+  Offset width() const { return w; }
+
+  Offset height() const { return h; }
+
+  Offset pixel_size() const { return bytes_per_pixel; }
+
+ private:
+  Offset raw_offset(const Offset x, const Offset y) const {
+    return plane1 + y * pitch1 + x * bytes_per_pixel;
+  }
+
+  Offset offset_row(const Offset y) const {
+    return va_image_check_range(image, raw_offset(0, y), w * bytes_per_pixel);
+  }
+
+  const VAImage image;
+  ScopedBufferMap bufmap;
+  uint8_t* const mem;
+
+  const Offset w, h;
+  const Offset bytes_per_pixel;
+  const Offset plane1;
+  const Offset pitch1;
+};
+
+using RgbBuffer = BasicRgbBuffer<>;
+}
+
+#endif  // RGB_H_
@@ -5,25 +5,39 @@
 
 #include <va/va.h>
 
+#include "map_cache.h"
 #include "va_util.h"
 
 namespace vadem {
 
+// Maps |buf| for the object's lifetime, or borrows the mapping from the
+// display's BufferMapCache if it has one.
 class ScopedBufferMap {
  public:
   ScopedBufferMap(VADisplay display, const VABufferID buf)
-      : display_(display), buf_(buf) {
-    void** vmem = reinterpret_cast<void**>(&mem_);
-    check_status(vaMapBuffer(display_, buf_, vmem));
+      : display_(display), buf_(buf), cache_(BufferMapCache::find(display)) {
+    if (cache_) {
+      mem_ = cache_->acquire(buf_);
+    } else {
+      void** vmem = reinterpret_cast<void**>(&mem_);
+      check_status(vaMapBuffer(display_, buf_, vmem));
+    }
   }
 
-  ~ScopedBufferMap() { check_status(vaUnmapBuffer(display_, buf_)); }
+  ~ScopedBufferMap() {
+    if (cache_) {
+      cache_->release(buf_);
+    } else {
+      check_status(vaUnmapBuffer(display_, buf_));
+    }
+  }
 
   uint8_t* data() { return mem_; }
 
  private:
   VADisplay display_;
   const VABufferID buf_;
+  BufferMapCache* const cache_;
   uint8_t* mem_;
 };
 }
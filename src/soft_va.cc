@@ -0,0 +1,849 @@
+// Copyright 2017 Neverware
+
+#include "src/soft_va.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <va/va.h>
+#include <va/va_drm.h>
+#include <va/va_drmcommon.h>
+
+#include "src/color.h"
+
+namespace vadem {
+
+namespace {
+
+// Real mappings are page aligned, which the line-sized copies in
+// staging.cc depend on to take their fast paths
+const std::size_t kPageSize = 4096;
+
+// Image or surface memory, shared by a surface and any images derived
+// from it. Surface memory lives in a memfd, standing in for the DMA-BUF
+// vaExportSurfaceHandle() hands out, or in an imported fd.
+class Storage {
+ public:
+  explicit Storage(const std::size_t size)
+      : bytes(size + kPageSize), mem(page_align(&bytes[0])), fd(-1),
+        mapped(0) {}
+
+  // |size| bytes of |shared_fd| mapped shared, keeping a duplicate of it
+  // open for export
+  Storage(const int shared_fd, const std::size_t size)
+      : mem(nullptr), fd(fcntl(shared_fd, F_DUPFD_CLOEXEC, 0)), mapped(size) {
+    if (fd == -1) {
+      return;
+    }
+    void* addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      fd = -1;
+      return;
+    }
+    mem = static_cast<uint8_t*>(addr);
+  }
+
+  ~Storage() {
+    if (mem && mapped) {
+      munmap(mem, mapped);
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  Storage(const Storage&) = delete;
+  Storage& operator=(const Storage&) = delete;
+
+  // Null if an fd couldn't be mapped
+  uint8_t* data() { return mem; }
+
+  // -1 for plain memory
+  int shared_fd() const { return fd; }
+
+ private:
+  static uint8_t* page_align(uint8_t* mem) {
+    const std::size_t address = reinterpret_cast<std::uintptr_t>(mem);
+    return mem + (kPageSize - address % kPageSize) % kPageSize;
+  }
+
+  std::vector<uint8_t> bytes;
+  uint8_t* mem;
+  int fd;
+  std::size_t mapped;
+};
+
+using StoragePtr = std::shared_ptr<Storage>;
+
+struct Layout {
+  uint32_t num_planes;
+  uint32_t pitches[3];
+  uint32_t offsets[3];
+  uint32_t data_size;
+};
+
+struct Surface {
+  VAImageFormat format;
+  unsigned int width, height;
+  Layout layout;
+  StoragePtr storage;
+};
+
+struct Display {
+  std::mutex mutex;
+  VAGenericID next_id = 1;
+  std::map<VABufferID, StoragePtr> buffers;
+  std::map<VAImageID, VAImage> images;
+  std::map<VASurfaceID, Surface> surfaces;
+};
+
+Display* get_display(VADisplay display) {
+  return static_cast<Display*>(display);
+}
+
+std::size_t env_size(const char* name, const std::size_t fallback) {
+  const char* value = getenv(name);
+  return value ? strtoul(value, nullptr, 10) : fallback;
+}
+
+std::mutex config_mutex;
+
+SoftVaConfig& current_config() {
+  static SoftVaConfig config{
+      env_size("VADEM_SOFT_VA_PITCH_ALIGN", 1),
+      std::chrono::microseconds(env_size("VADEM_SOFT_VA_MAP_LATENCY_US", 0)),
+      env_size("VADEM_SOFT_VA_DERIVE", 1) != 0};
+  return config;
+}
+
+// Spin rather than sleep, since sleeps are far coarser than the
+// microseconds a map takes
+void busy_wait(const std::chrono::nanoseconds duration) {
+  const auto deadline = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < deadline) {
+  }
+}
+
+uint32_t align_up(const uint32_t val, const uint32_t align) {
+  return (val + align - 1) / align * align;
+}
+
+bool is_rgb(const uint32_t fourcc) {
+  return fourcc == VA_FOURCC_RGBX || fourcc == VA_FOURCC_BGRX;
+}
+
+bool is_16_bit(const uint32_t fourcc) {
+#ifdef VA_FOURCC_P010
+  if (fourcc == VA_FOURCC_P010) {
+    return true;
+  }
+#endif
+#ifdef VA_FOURCC_P016
+  if (fourcc == VA_FOURCC_P016) {
+    return true;
+  }
+#endif
+  return false;
+}
+
+bool is_semi_planar(const uint32_t fourcc) {
+  return fourcc == VA_FOURCC_NV12 || is_16_bit(fourcc);
+}
+
+bool is_planar(const uint32_t fourcc) {
+  return fourcc == VA_FOURCC_I420 || fourcc == VA_FOURCC_YV12;
+}
+
+// Byte offset of pixel column |x| in |plane|, and the bytes a row of
+// |width| pixels covers there
+void plane_span(const uint32_t fourcc,
+                const uint32_t plane,
+                const uint32_t x,
+                const uint32_t width,
+                uint32_t* begin,
+                uint32_t* size) {
+  const uint32_t bytes_per_sample = is_16_bit(fourcc) ? 2 : 1;
+  if (is_rgb(fourcc)) {
+    *begin = x * 4;
+    *size = width * 4;
+  } else if (plane == 0) {
+    *begin = x * bytes_per_sample;
+    *size = width * bytes_per_sample;
+  } else if (is_semi_planar(fourcc)) {
+    *begin = (x / 2) * 2 * bytes_per_sample;
+    *size = ((x + width + 1) / 2 - x / 2) * 2 * bytes_per_sample;
+  } else {
+    *begin = x / 2;
+    *size = (x + width + 1) / 2 - x / 2;
+  }
+}
+
+bool compute_layout(const uint32_t fourcc,
+                    const uint32_t width,
+                    const uint32_t height,
+                    Layout* layout) {
+  const std::size_t pitch_align = soft_va_config().pitch_align;
+  const uint32_t align = (pitch_align > 0) ? pitch_align : 1;
+  const uint32_t gap = (align > 1) ? align : 0;
+  const uint32_t chroma_height = (height + 1) / 2;
+
+  if (is_rgb(fourcc)) {
+    layout->num_planes = 1;
+  } else if (is_semi_planar(fourcc)) {
+    layout->num_planes = 2;
+  } else if (is_planar(fourcc)) {
+    layout->num_planes = 3;
+  } else {
+    return false;
+  }
+
+  uint32_t end = 0;
+  for (uint32_t plane = 0; plane < 3; plane++) {
+    if (plane >= layout->num_planes) {
+      layout->pitches[plane] = 0;
+      layout->offsets[plane] = 0;
+      continue;
+    }
+    uint32_t begin, size;
+    plane_span(fourcc, plane, 0, width, &begin, &size);
+    layout->pitches[plane] = align_up(size, align);
+    layout->offsets[plane] = end + gap;
+    end = layout->offsets[plane] +
+          layout->pitches[plane] * (plane ? chroma_height : height);
+  }
+  layout->data_size = end;
+  return true;
+}
+
+VAImage make_image(const VAImageID id,
+                   const VABufferID buf,
+                   const VAImageFormat& format,
+                   const uint32_t width,
+                   const uint32_t height,
+                   const Layout& layout) {
+  VAImage image;
+  memset(&image, 0, sizeof(image));
+  image.image_id = id;
+  image.format = format;
+  image.buf = buf;
+  image.width = width;
+  image.height = height;
+  image.data_size = layout.data_size;
+  image.num_planes = layout.num_planes;
+  for (uint32_t plane = 0; plane < 3; plane++) {
+    image.pitches[plane] = layout.pitches[plane];
+    image.offsets[plane] = layout.offsets[plane];
+  }
+  return image;
+}
+
+// Memory and layout on either side of a vaPutImage() or vaGetImage()
+struct Region {
+  uint8_t* mem;
+  uint32_t fourcc;
+  const uint32_t* pitches;
+  const uint32_t* offsets;
+  uint32_t num_planes;
+  uint32_t x, y;
+
+  uint8_t* row(const uint32_t plane, const uint32_t row) const {
+    return mem + offsets[plane] + row * pitches[plane];
+  }
+};
+
+void copy_planes(const Region& src,
+                 const Region& dst,
+                 const uint32_t width,
+                 const uint32_t height) {
+  for (uint32_t plane = 0; plane < src.num_planes; plane++) {
+    const uint32_t scale = plane ? 2 : 1;
+    const uint32_t src_rows =
+        (src.y + height + scale - 1) / scale - src.y / scale;
+    const uint32_t dst_rows =
+        (dst.y + height + scale - 1) / scale - dst.y / scale;
+    const uint32_t rows = (src_rows < dst_rows) ? src_rows : dst_rows;
+    uint32_t src_begin, src_size, dst_begin, dst_size;
+    plane_span(src.fourcc, plane, src.x, width, &src_begin, &src_size);
+    plane_span(dst.fourcc, plane, dst.x, width, &dst_begin, &dst_size);
+    const uint32_t size = (src_size < dst_size) ? src_size : dst_size;
+    for (uint32_t row = 0; row < rows; row++) {
+      memcpy(dst.row(plane, dst.y / scale + row) + dst_begin,
+             src.row(plane, src.y / scale + row) + src_begin, size);
+    }
+  }
+}
+
+void nv12_to_rgbx(const Region& src,
+                  const Region& dst,
+                  const uint32_t width,
+                  const uint32_t height) {
+  for (uint32_t row = 0; row < height; row++) {
+    const uint32_t y = src.y + row;
+    const uint8_t* luma = src.row(0, y);
+    const uint8_t* chroma = src.row(1, y / 2);
+    uint8_t* out = dst.row(0, dst.y + row);
+    for (uint32_t col = 0; col < width; col++) {
+      const uint32_t x = src.x + col;
+      const uint32_t c = (x / 2) * 2;
+      const png::rgb_pixel pixel =
+          FixedPointYCbCr(luma[x], chroma[c], chroma[c + 1]).to_rgb();
+      uint8_t* px = out + (dst.x + col) * 4;
+      px[0] = pixel.red;
+      px[1] = pixel.green;
+      px[2] = pixel.blue;
+      px[3] = 0xff;
+    }
+  }
+}
+
+void rgbx_to_nv12(const Region& src,
+                  const Region& dst,
+                  const uint32_t width,
+                  const uint32_t height) {
+  for (uint32_t row = 0; row < height; row++) {
+    const uint8_t* in = src.row(0, src.y + row);
+    const uint32_t y = dst.y + row;
+    uint8_t* luma = dst.row(0, y);
+    uint8_t* chroma = dst.row(1, y / 2);
+    for (uint32_t col = 0; col < width; col++) {
+      const uint8_t* px = in + (src.x + col) * 4;
+      const auto color = FixedPointYCbCr::from_rgb(px[0], px[1], px[2]);
+      const uint32_t x = dst.x + col;
+      luma[x] = color.Y;
+      if ((x % 2) == 0 && (y % 2) == 0) {
+        chroma[x] = color.Cb;
+        chroma[x + 1] = color.Cr;
+      }
+    }
+  }
+}
+
+// Cb (or Cr, with |cr|) of chroma column |col| in chroma row |row|
+uint8_t* chroma_sample(const Region& region,
+                       const uint32_t row,
+                       const uint32_t col,
+                       const bool cr) {
+  if (region.fourcc == VA_FOURCC_NV12) {
+    return region.row(1, row) + col * 2 + (cr ? 1 : 0);
+  }
+  // YV12 stores Cr before Cb
+  const bool first = (region.fourcc == VA_FOURCC_I420) != cr;
+  return region.row(first ? 1 : 2, row) + col;
+}
+
+// Between NV12, I420 and YV12, as drivers do on vaPutImage() and
+// vaGetImage(): luma is copied and chroma interleaved or split
+void yuv420_convert(const Region& src,
+                    const Region& dst,
+                    const uint32_t width,
+                    const uint32_t height) {
+  for (uint32_t row = 0; row < height; row++) {
+    memcpy(dst.row(0, dst.y + row) + dst.x, src.row(0, src.y + row) + src.x,
+           width);
+  }
+  for (uint32_t row = 0; row < (height + 1) / 2; row++) {
+    for (uint32_t col = 0; col < (width + 1) / 2; col++) {
+      for (const bool cr : {false, true}) {
+        *chroma_sample(dst, dst.y / 2 + row, dst.x / 2 + col, cr) =
+            *chroma_sample(src, src.y / 2 + row, src.x / 2 + col, cr);
+      }
+    }
+  }
+}
+
+bool is_yuv420(const uint32_t fourcc) {
+  return fourcc == VA_FOURCC_NV12 || is_planar(fourcc);
+}
+
+VAStatus transfer(const Region& src,
+                  const Region& dst,
+                  const uint32_t width,
+                  const uint32_t height) {
+  if (src.fourcc == dst.fourcc) {
+    copy_planes(src, dst, width, height);
+  } else if (src.fourcc == VA_FOURCC_NV12 && dst.fourcc == VA_FOURCC_RGBX) {
+    nv12_to_rgbx(src, dst, width, height);
+  } else if (src.fourcc == VA_FOURCC_RGBX && dst.fourcc == VA_FOURCC_NV12) {
+    rgbx_to_nv12(src, dst, width, height);
+  } else if (is_yuv420(src.fourcc) && is_yuv420(dst.fourcc)) {
+    yuv420_convert(src, dst, width, height);
+  } else {
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+  }
+  return VA_STATUS_SUCCESS;
+}
+
+// Format vaDeriveImage() reports for surfaces holding |fourcc|
+bool surface_image_format(const uint32_t fourcc, VAImageFormat* format) {
+  memset(format, 0, sizeof(*format));
+  format->fourcc = fourcc;
+  format->byte_order = VA_LSB_FIRST;
+  if (is_rgb(fourcc)) {
+    // As the i965 driver reports derived RGBX images
+    format->bits_per_pixel = 32;
+    format->depth = 24;
+    format->red_mask = (fourcc == VA_FOURCC_RGBX) ? 0xff : 0xff0000;
+    format->green_mask = 0xff00;
+    format->blue_mask = (fourcc == VA_FOURCC_RGBX) ? 0xff0000 : 0xff;
+  } else if (fourcc == VA_FOURCC_NV12 || is_planar(fourcc)) {
+    format->bits_per_pixel = 12;
+  } else if (is_16_bit(fourcc)) {
+    format->bits_per_pixel = 24;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool fits(const uint32_t x,
+          const uint32_t y,
+          const uint32_t width,
+          const uint32_t height,
+          const uint32_t max_width,
+          const uint32_t max_height) {
+  return x <= max_width && width <= max_width - x && y <= max_height &&
+         height <= max_height - y;
+}
+
+// Memory for a new surface, in a memfd so that it can be exported
+StoragePtr make_shared_storage(const std::size_t size) {
+  const int fd = memfd_create("vadem-soft-va", MFD_CLOEXEC);
+  if (fd == -1) {
+    return nullptr;
+  }
+  StoragePtr storage;
+  if (ftruncate(fd, size) == 0) {
+    storage = std::make_shared<Storage>(fd, size);
+  }
+  close(fd);
+  return (storage && storage->data()) ? storage : nullptr;
+}
+
+// Layout described by |external| for a |fourcc| surface, if every plane
+// fits in its buffer
+bool external_layout(const VASurfaceAttribExternalBuffers& external,
+                     const uint32_t fourcc,
+                     const uint32_t width,
+                     const uint32_t height,
+                     Layout* layout) {
+  Layout expected;
+  if (!compute_layout(fourcc, width, height, &expected) ||
+      external.num_planes != expected.num_planes ||
+      external.width != width || external.height != height) {
+    return false;
+  }
+  layout->num_planes = external.num_planes;
+  layout->data_size = external.data_size;
+  for (uint32_t plane = 0; plane < 3; plane++) {
+    layout->pitches[plane] = 0;
+    layout->offsets[plane] = 0;
+    if (plane >= layout->num_planes) {
+      continue;
+    }
+    uint32_t begin, size;
+    plane_span(fourcc, plane, 0, width, &begin, &size);
+    const uint64_t rows = plane ? (height + 1) / 2 : height;
+    const uint32_t pitch = external.pitches[plane];
+    const uint32_t offset = external.offsets[plane];
+    if (pitch < size ||
+        offset + pitch * (rows - 1) + size > external.data_size) {
+      return false;
+    }
+    layout->pitches[plane] = pitch;
+    layout->offsets[plane] = offset;
+  }
+  return true;
+}
+
+// DRM fourcc of a surface holding |fourcc|, composed into one layer
+uint32_t drm_format(const uint32_t fourcc) {
+  switch (fourcc) {
+    case VA_FOURCC_RGBX:
+      return VA_FOURCC('X', 'B', '2', '4');
+    case VA_FOURCC_BGRX:
+      return VA_FOURCC('X', 'R', '2', '4');
+    case VA_FOURCC_I420:
+      return VA_FOURCC('Y', 'U', '1', '2');
+    default:
+      // NV12, YV12, P010 and P016 share their VA names
+      return fourcc;
+  }
+}
+
+}  // namespace
+
+SoftVaConfig soft_va_config() {
+  std::lock_guard<std::mutex> lock(config_mutex);
+  return current_config();
+}
+
+void soft_va_config_set(const SoftVaConfig& config) {
+  std::lock_guard<std::mutex> lock(config_mutex);
+  current_config() = config;
+}
+}
+
+using namespace vadem;
+
+extern "C" {
+
+VADisplay vaGetDisplayDRM(int /*fd*/) {
+  return new Display;
+}
+
+VAStatus vaInitialize(VADisplay display, int* major, int* minor) {
+  if (!display) {
+    return VA_STATUS_ERROR_INVALID_DISPLAY;
+  }
+  *major = VA_MAJOR_VERSION;
+  *minor = VA_MINOR_VERSION;
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaTerminate(VADisplay display) {
+  delete get_display(display);
+  return VA_STATUS_SUCCESS;
+}
+
+const char* vaErrorStr(VAStatus status) {
+  return (status == VA_STATUS_SUCCESS) ? "success" : "soft VA error";
+}
+
+VAStatus vaCreateImage(VADisplay display,
+                       VAImageFormat* format,
+                       int width,
+                       int height,
+                       VAImage* image) {
+  Display* d = get_display(display);
+  Layout layout;
+  if (width <= 0 || height <= 0 ||
+      !compute_layout(format->fourcc, width, height, &layout)) {
+    return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+  }
+
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const VABufferID buf = d->next_id++;
+  const VAImageID id = d->next_id++;
+  d->buffers[buf] = std::make_shared<Storage>(layout.data_size);
+  *image = make_image(id, buf, *format, width, height, layout);
+  d->images[id] = *image;
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaDestroyImage(VADisplay display, VAImageID id) {
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto it = d->images.find(id);
+  if (it == d->images.end()) {
+    return VA_STATUS_ERROR_INVALID_IMAGE;
+  }
+  d->buffers.erase(it->second.buf);
+  d->images.erase(it);
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaMapBuffer(VADisplay display, VABufferID buf, void** mem) {
+  busy_wait(soft_va_config().map_latency);
+
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto it = d->buffers.find(buf);
+  if (it == d->buffers.end()) {
+    return VA_STATUS_ERROR_INVALID_BUFFER;
+  }
+  *mem = it->second->data();
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaUnmapBuffer(VADisplay display, VABufferID buf) {
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->buffers.count(buf) ? VA_STATUS_SUCCESS
+                               : VA_STATUS_ERROR_INVALID_BUFFER;
+}
+
+VAStatus vaCreateSurfaces(VADisplay display,
+                          unsigned int format,
+                          unsigned int width,
+                          unsigned int height,
+                          VASurfaceID* surfaces,
+                          unsigned int num_surfaces,
+                          VASurfaceAttrib* attrib_list,
+                          unsigned int num_attribs) {
+  uint32_t fourcc = 0;
+  switch (format) {
+    case VA_RT_FORMAT_YUV420:
+      fourcc = VA_FOURCC_NV12;
+      break;
+#if defined(VA_RT_FORMAT_YUV420_10) && defined(VA_FOURCC_P010)
+    case VA_RT_FORMAT_YUV420_10:
+      fourcc = VA_FOURCC_P010;
+      break;
+#endif
+#if defined(VA_RT_FORMAT_YUV420_12) && defined(VA_FOURCC_P016)
+    case VA_RT_FORMAT_YUV420_12:
+      fourcc = VA_FOURCC_P016;
+      break;
+#endif
+    case VA_RT_FORMAT_RGB32:
+      fourcc = VA_FOURCC_RGBX;
+      break;
+    default:
+      return VA_STATUS_ERROR_UNSUPPORTED_RT_FORMAT;
+  }
+  uint32_t mem_type = VA_SURFACE_ATTRIB_MEM_TYPE_VA;
+  const VASurfaceAttribExternalBuffers* external = nullptr;
+  for (unsigned int i = 0; i < num_attribs; i++) {
+    const VASurfaceAttrib& attrib = attrib_list[i];
+    if (!(attrib.flags & VA_SURFACE_ATTRIB_SETTABLE)) {
+      continue;
+    }
+    if (attrib.type == VASurfaceAttribPixelFormat) {
+      fourcc = attrib.value.value.i;
+    } else if (attrib.type == VASurfaceAttribMemoryType) {
+      mem_type = attrib.value.value.i;
+    } else if (attrib.type == VASurfaceAttribExternalBufferDescriptor) {
+      external = static_cast<const VASurfaceAttribExternalBuffers*>(
+          attrib.value.value.p);
+    }
+  }
+  if (mem_type != VA_SURFACE_ATTRIB_MEM_TYPE_VA &&
+      mem_type != VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME) {
+    return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+  }
+  const bool import = (mem_type == VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME);
+  if (import) {
+    if (!external || external->num_buffers != num_surfaces) {
+      return VA_STATUS_ERROR_INVALID_PARAMETER;
+    }
+    fourcc = external->pixel_format;
+  }
+
+  VAImageFormat image_format;
+  if (!surface_image_format(fourcc, &image_format)) {
+    return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+  }
+
+  Surface surface;
+  surface.format = image_format;
+  surface.width = width;
+  surface.height = height;
+  if (width == 0 || height == 0 ||
+      !(import ? external_layout(*external, fourcc, width, height,
+                                 &surface.layout)
+               : compute_layout(fourcc, width, height, &surface.layout))) {
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+  }
+
+  std::vector<StoragePtr> storage(num_surfaces);
+  for (unsigned int i = 0; i < num_surfaces; i++) {
+    if (import) {
+      storage[i] = std::make_shared<Storage>(
+          static_cast<int>(external->buffers[i]), surface.layout.data_size);
+      if (!storage[i]->data()) {
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+      }
+    } else {
+      storage[i] = make_shared_storage(surface.layout.data_size);
+      if (!storage[i]) {
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+      }
+    }
+  }
+
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  for (unsigned int i = 0; i < num_surfaces; i++) {
+    surface.storage = storage[i];
+    surfaces[i] = d->next_id++;
+    d->surfaces[surfaces[i]] = surface;
+  }
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaExportSurfaceHandle(VADisplay display,
+                               VASurfaceID surface,
+                               uint32_t mem_type,
+                               uint32_t flags,
+                               void* descriptor) {
+  if (mem_type != VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2) {
+    return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+  }
+  if (!(flags & VA_EXPORT_SURFACE_COMPOSED_LAYERS)) {
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+  }
+
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto it = d->surfaces.find(surface);
+  if (it == d->surfaces.end()) {
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+  }
+  const Surface& s = it->second;
+  const int fd = fcntl(s.storage->shared_fd(), F_DUPFD_CLOEXEC, 0);
+  if (fd == -1) {
+    return VA_STATUS_ERROR_OPERATION_FAILED;
+  }
+
+  VADRMPRIMESurfaceDescriptor* desc =
+      static_cast<VADRMPRIMESurfaceDescriptor*>(descriptor);
+  memset(desc, 0, sizeof(*desc));
+  desc->fourcc = s.format.fourcc;
+  desc->width = s.width;
+  desc->height = s.height;
+  desc->num_objects = 1;
+  desc->objects[0].fd = fd;
+  desc->objects[0].size = s.layout.data_size;
+  desc->objects[0].drm_format_modifier = 0;
+  desc->num_layers = 1;
+  desc->layers[0].drm_format = drm_format(s.format.fourcc);
+  desc->layers[0].num_planes = s.layout.num_planes;
+  for (uint32_t plane = 0; plane < s.layout.num_planes; plane++) {
+    desc->layers[0].object_index[plane] = 0;
+    desc->layers[0].offset[plane] = s.layout.offsets[plane];
+    desc->layers[0].pitch[plane] = s.layout.pitches[plane];
+  }
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaDestroySurfaces(VADisplay display,
+                           VASurfaceID* surfaces,
+                           int num_surfaces) {
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  for (int i = 0; i < num_surfaces; i++) {
+    d->surfaces.erase(surfaces[i]);
+  }
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaSyncSurface(VADisplay display, VASurfaceID surface) {
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->surfaces.count(surface) ? VA_STATUS_SUCCESS
+                                    : VA_STATUS_ERROR_INVALID_SURFACE;
+}
+
+VAStatus vaDeriveImage(VADisplay display, VASurfaceID surface, VAImage* image) {
+  if (!soft_va_config().derive) {
+    return VA_STATUS_ERROR_OPERATION_FAILED;
+  }
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto it = d->surfaces.find(surface);
+  if (it == d->surfaces.end()) {
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+  }
+  const Surface& s = it->second;
+  const VABufferID buf = d->next_id++;
+  const VAImageID id = d->next_id++;
+  d->buffers[buf] = s.storage;
+  *image = make_image(id, buf, s.format, s.width, s.height, s.layout);
+  d->images[id] = *image;
+  return VA_STATUS_SUCCESS;
+}
+
+VAStatus vaPutImage(VADisplay display,
+                    VASurfaceID surface,
+                    VAImageID image,
+                    int src_x,
+                    int src_y,
+                    unsigned int src_width,
+                    unsigned int src_height,
+                    int dest_x,
+                    int dest_y,
+                    unsigned int dest_width,
+                    unsigned int dest_height) {
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto surface_it = d->surfaces.find(surface);
+  if (surface_it == d->surfaces.end()) {
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+  }
+  const auto image_it = d->images.find(image);
+  if (image_it == d->images.end()) {
+    return VA_STATUS_ERROR_INVALID_IMAGE;
+  }
+  if (src_width != dest_width || src_height != dest_height) {
+    return VA_STATUS_ERROR_UNIMPLEMENTED;
+  }
+
+  const VAImage& i = image_it->second;
+  const Surface& s = surface_it->second;
+  if (src_x < 0 || src_y < 0 || dest_x < 0 || dest_y < 0 ||
+      !fits(src_x, src_y, src_width, src_height, i.width, i.height) ||
+      !fits(dest_x, dest_y, src_width, src_height, s.width, s.height)) {
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+  }
+
+  const Region src{d->buffers[i.buf]->data(),
+                   i.format.fourcc,
+                   i.pitches,
+                   i.offsets,
+                   i.num_planes,
+                   static_cast<uint32_t>(src_x),
+                   static_cast<uint32_t>(src_y)};
+  const Region dst{s.storage->data(),
+                   s.format.fourcc,
+                   s.layout.pitches,
+                   s.layout.offsets,
+                   s.layout.num_planes,
+                   static_cast<uint32_t>(dest_x),
+                   static_cast<uint32_t>(dest_y)};
+  return transfer(src, dst, src_width, src_height);
+}
+
+VAStatus vaGetImage(VADisplay display,
+                    VASurfaceID surface,
+                    int x,
+                    int y,
+                    unsigned int width,
+                    unsigned int height,
+                    VAImageID image) {
+  Display* d = get_display(display);
+  std::lock_guard<std::mutex> lock(d->mutex);
+  const auto surface_it = d->surfaces.find(surface);
+  if (surface_it == d->surfaces.end()) {
+    return VA_STATUS_ERROR_INVALID_SURFACE;
+  }
+  const auto image_it = d->images.find(image);
+  if (image_it == d->images.end()) {
+    return VA_STATUS_ERROR_INVALID_IMAGE;
+  }
+
+  const VAImage& i = image_it->second;
+  const Surface& s = surface_it->second;
+  if (x < 0 || y < 0 || !fits(x, y, width, height, s.width, s.height) ||
+      !fits(0, 0, width, height, i.width, i.height)) {
+    return VA_STATUS_ERROR_INVALID_PARAMETER;
+  }
+
+  const Region src{s.storage->data(),
+                   s.format.fourcc,
+                   s.layout.pitches,
+                   s.layout.offsets,
+                   s.layout.num_planes,
+                   static_cast<uint32_t>(x),
+                   static_cast<uint32_t>(y)};
+  const Region dst{d->buffers[i.buf]->data(),
+                   i.format.fourcc,
+                   i.pitches,
+                   i.offsets,
+                   i.num_planes,
+                   0,
+                   0};
+  return transfer(src, dst, width, height);
+}
+
+}  // extern "C"
@@ -0,0 +1,51 @@
+// Copyright 2017 Neverware
+
+#ifndef SOFT_VA_H_
+#define SOFT_VA_H_
+
+#include <chrono>
+#include <cstddef>
+
+namespace vadem {
+
+// soft_va.cc implements the parts of libva vadem uses in process, on
+// plain memory, for building and benchmarking without a GPU. It's linked
+// in place of libva when configured with -DVADEM_SOFT_VA=ON, which also
+// defines VADEM_SOFT_VA. vaGetDisplayDRM() ignores its fd.
+//
+// vaPutImage() and vaGetImage() convert between NV12 and RGBX with
+// FixedPointYCbCr, taking chroma from the top-left pixel of each 2x2
+// block, and copy any other matching formats. vaCreateSurfaces() honors a
+// VASurfaceAttribPixelFormat attribute.
+//
+// Surface memory is a memfd, which vaExportSurfaceHandle() hands out in
+// place of a DMA-BUF (linear, composed layers only). vaCreateSurfaces()
+// imports any mappable fd through VASurfaceAttribExternalBuffers with
+// VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME, so frames can be shared between
+// processes as with a real driver.
+
+struct SoftVaConfig {
+  // Row pitches are rounded up to a multiple of this, and planes are
+  // separated by a gap of the same size, so that code ignoring pitches[]
+  // or offsets[] shows up. 1 packs images tightly.
+  std::size_t pitch_align;
+
+  // How long vaMapBuffer() busy-waits before returning, standing in for
+  // a driver syncing and mapping the buffer.
+  std::chrono::nanoseconds map_latency;
+
+  // Whether vaDeriveImage() works. Drivers that keep surfaces tiled or
+  // compressed refuse it, which callers have to cope with.
+  bool derive;
+};
+
+// Settings for images and surfaces created from now on, and for every
+// vaMapBuffer() and vaDeriveImage() call. Initially read from the
+// VADEM_SOFT_VA_PITCH_ALIGN, VADEM_SOFT_VA_MAP_LATENCY_US and
+// VADEM_SOFT_VA_DERIVE environment variables, defaulting to 1, 0 and 1.
+SoftVaConfig soft_va_config();
+
+void soft_va_config_set(const SoftVaConfig& config);
+}
+
+#endif  // SOFT_VA_H_
@@ -0,0 +1,275 @@
+// Copyright 2017 Neverware
+
+#include "src/staging.h"
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VADEM_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "src/convert.h"
+
+namespace vadem {
+
+namespace {
+
+const std::size_t kLineSize = 64;
+
+std::atomic<int> current_write_mode(static_cast<int>(WriteMode::kStaged));
+std::atomic<int> current_read_mode(static_cast<int>(ReadMode::kStreaming));
+
+std::size_t round_up(const std::size_t val, const std::size_t align) {
+  return (val + align - 1) / align * align;
+}
+
+// First 64-byte aligned byte of |storage|, which must have a line to
+// spare
+uint8_t* align_line(std::vector<uint8_t>& storage) {
+  if (storage.empty()) {
+    return nullptr;
+  }
+  const std::size_t address = reinterpret_cast<std::uintptr_t>(&storage[0]);
+  return &storage[round_up(address, kLineSize) - address];
+}
+
+// Split [|address|, |address| + |size|) into the bytes before the first
+// 64-byte line boundary, a number of whole lines and the bytes after
+// them. Returns false if no whole line fits.
+bool split_lines(const uint8_t* address,
+                 const std::size_t size,
+                 std::size_t* head,
+                 std::size_t* lines) {
+  const std::size_t begin = reinterpret_cast<std::uintptr_t>(address);
+  *head = round_up(begin, kLineSize) - begin;
+  if (*head >= size) {
+    return false;
+  }
+  *lines = (size - *head) / kLineSize;
+  return true;
+}
+
+#ifdef VADEM_X86_SIMD
+
+// Write |lines| whole 64-byte lines to the line-aligned |dst|
+template <bool NonTemporal>
+__attribute__((target("sse2"))) void flush_lines(uint8_t* dst,
+                                                 const uint8_t* src,
+                                                 const std::size_t lines) {
+  __m128i* out = reinterpret_cast<__m128i*>(dst);
+  const __m128i* in = reinterpret_cast<const __m128i*>(src);
+  for (std::size_t i = 0; i < lines; i++, out += 4, in += 4) {
+    const __m128i a = _mm_loadu_si128(in);
+    const __m128i b = _mm_loadu_si128(in + 1);
+    const __m128i c = _mm_loadu_si128(in + 2);
+    const __m128i d = _mm_loadu_si128(in + 3);
+    if (NonTemporal) {
+      _mm_stream_si128(out, a);
+      _mm_stream_si128(out + 1, b);
+      _mm_stream_si128(out + 2, c);
+      _mm_stream_si128(out + 3, d);
+    } else {
+      _mm_store_si128(out, a);
+      _mm_store_si128(out + 1, b);
+      _mm_store_si128(out + 2, c);
+      _mm_store_si128(out + 3, d);
+    }
+  }
+  if (NonTemporal) {
+    _mm_sfence();
+  }
+}
+
+// Read |lines| whole 64-byte lines from the line-aligned |src|
+__attribute__((target("sse4.1"))) void stream_lines(uint8_t* dst,
+                                                    const uint8_t* src,
+                                                    const std::size_t lines) {
+  __m128i* out = reinterpret_cast<__m128i*>(dst);
+  __m128i* in = reinterpret_cast<__m128i*>(const_cast<uint8_t*>(src));
+  for (std::size_t i = 0; i < lines; i++, out += 4, in += 4) {
+    const __m128i a = _mm_stream_load_si128(in);
+    const __m128i b = _mm_stream_load_si128(in + 1);
+    const __m128i c = _mm_stream_load_si128(in + 2);
+    const __m128i d = _mm_stream_load_si128(in + 3);
+    _mm_storeu_si128(out, a);
+    _mm_storeu_si128(out + 1, b);
+    _mm_storeu_si128(out + 2, c);
+    _mm_storeu_si128(out + 3, d);
+  }
+}
+
+__attribute__((target("sse2"))) void fetch_lines(uint8_t* dst,
+                                                 const uint8_t* src,
+                                                 const std::size_t lines) {
+  __m128i* out = reinterpret_cast<__m128i*>(dst);
+  const __m128i* in = reinterpret_cast<const __m128i*>(src);
+  for (std::size_t i = 0; i < lines; i++, out += 4, in += 4) {
+    const __m128i a = _mm_load_si128(in);
+    const __m128i b = _mm_load_si128(in + 1);
+    const __m128i c = _mm_load_si128(in + 2);
+    const __m128i d = _mm_load_si128(in + 3);
+    _mm_storeu_si128(out, a);
+    _mm_storeu_si128(out + 1, b);
+    _mm_storeu_si128(out + 2, c);
+    _mm_storeu_si128(out + 3, d);
+  }
+}
+
+#else
+
+template <bool NonTemporal>
+void flush_lines(uint8_t* dst, const uint8_t* src, const std::size_t lines) {
+  memcpy(dst, src, lines * kLineSize);
+}
+
+void fetch_lines(uint8_t* dst, const uint8_t* src, const std::size_t lines) {
+  memcpy(dst, src, lines * kLineSize);
+}
+
+#endif  // VADEM_X86_SIMD
+
+}  // namespace
+
+WriteMode write_mode() {
+  return static_cast<WriteMode>(
+      current_write_mode.load(std::memory_order_relaxed));
+}
+
+void write_mode_set(const WriteMode mode) {
+  current_write_mode.store(static_cast<int>(mode), std::memory_order_relaxed);
+}
+
+const char* write_mode_name(const WriteMode mode) {
+  switch (mode) {
+    case WriteMode::kDirect:
+      return "direct";
+    case WriteMode::kStaged:
+      return "staged";
+    case WriteMode::kStreaming:
+      return "streaming";
+  }
+  return "unknown";
+}
+
+void row_flush(uint8_t* dst,
+               const uint8_t* src,
+               const std::size_t size,
+               const bool non_temporal) {
+  std::size_t head, lines;
+  if (!split_lines(dst, size, &head, &lines)) {
+    memcpy(dst, src, size);
+    return;
+  }
+  const std::size_t body = lines * kLineSize;
+
+  memcpy(dst, src, head);
+  if (non_temporal) {
+    flush_lines<true>(dst + head, src + head, lines);
+  } else {
+    flush_lines<false>(dst + head, src + head, lines);
+  }
+  memcpy(dst + head + body, src + head + body, size - head - body);
+}
+
+RowWriter::RowWriter(const std::size_t rows,
+                     const std::size_t row_size,
+                     const WriteMode mode)
+    : mode_(mode),
+      row_size_(row_size),
+      stride_(round_up(row_size, kLineSize)),
+      storage_((mode == WriteMode::kDirect) ? 0 : rows * stride_ + kLineSize),
+      scratch_(align_line(storage_)),
+      dst_(rows, nullptr) {}
+
+uint8_t* RowWriter::stage(const std::size_t index, uint8_t* dst) {
+  if (mode_ == WriteMode::kDirect) {
+    return dst;
+  }
+  dst_.at(index) = dst;
+  return scratch_ + index * stride_;
+}
+
+void RowWriter::flush() {
+  if (mode_ == WriteMode::kDirect) {
+    return;
+  }
+  for (std::size_t i = 0; i < dst_.size(); i++) {
+    if (dst_[i]) {
+      row_flush(dst_[i], scratch_ + i * stride_, row_size_,
+                mode_ == WriteMode::kStreaming);
+      dst_[i] = nullptr;
+    }
+  }
+}
+
+ReadMode read_mode() {
+  return static_cast<ReadMode>(
+      current_read_mode.load(std::memory_order_relaxed));
+}
+
+void read_mode_set(const ReadMode mode) {
+  current_read_mode.store(static_cast<int>(mode), std::memory_order_relaxed);
+}
+
+const char* read_mode_name(const ReadMode mode) {
+  switch (mode) {
+    case ReadMode::kDirect:
+      return "direct";
+    case ReadMode::kBuffered:
+      return "buffered";
+    case ReadMode::kStreaming:
+      return "streaming";
+  }
+  return "unknown";
+}
+
+void row_fetch(uint8_t* dst,
+               const uint8_t* src,
+               const std::size_t size,
+               const bool streaming) {
+  std::size_t head, lines;
+  if (!split_lines(src, size, &head, &lines)) {
+    memcpy(dst, src, size);
+    return;
+  }
+  const std::size_t body = lines * kLineSize;
+
+  memcpy(dst, src, head);
+#ifdef VADEM_X86_SIMD
+  if (streaming && simd_level() >= SimdLevel::kSse41) {
+    stream_lines(dst + head, src + head, lines);
+  } else {
+    fetch_lines(dst + head, src + head, lines);
+  }
+#else
+  fetch_lines(dst + head, src + head, lines);
+#endif
+  memcpy(dst + head + body, src + head + body, size - head - body);
+}
+
+RowReader::RowReader(const std::size_t rows,
+                     const std::size_t row_size,
+                     const ReadMode mode)
+    : mode_(mode),
+      rows_(rows),
+      row_size_(row_size),
+      stride_(round_up(row_size, kLineSize)),
+      storage_((mode == ReadMode::kDirect) ? 0 : rows * stride_ + kLineSize),
+      scratch_(align_line(storage_)) {}
+
+const uint8_t* RowReader::fetch(const std::size_t index, const uint8_t* src) {
+  if (mode_ == ReadMode::kDirect) {
+    return src;
+  }
+  if (index >= rows_) {
+    throw std::out_of_range("RowReader row " + std::to_string(index));
+  }
+  uint8_t* row = scratch_ + index * stride_;
+  row_fetch(row, src, row_size_, mode_ == ReadMode::kStreaming);
+  return row;
+}
+}
@@ -0,0 +1,146 @@
+// Copyright 2017 Neverware
+
+#ifndef STAGING_H_
+#define STAGING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vadem {
+
+// How bulk row writes reach memory returned by vaMapBuffer(), which real
+// drivers often map write-combined or uncached. Such memory only performs
+// well when written a whole cache line at a time.
+enum class WriteMode {
+  // Kernels store straight into the mapping, as many small stores
+  kDirect,
+  // Rows are assembled in cached scratch memory and copied over in whole
+  // 64-byte lines
+  kStaged,
+  // As kStaged, but with non-temporal stores that bypass the cache
+  kStreaming,
+};
+
+// Mode RowWriter uses by default. Defaults to kStaged.
+WriteMode write_mode();
+
+void write_mode_set(WriteMode mode);
+
+const char* write_mode_name(WriteMode mode);
+
+// Copy |size| bytes from |src| to |dst|, writing every 64-byte line of
+// |dst| that is wholly covered with consecutive 16-byte stores, and only
+// the partial lines at either end with smaller ones. With |non_temporal|
+// the full lines are written with streaming stores, followed by a store
+// fence.
+void row_flush(uint8_t* dst,
+               const uint8_t* src,
+               std::size_t size,
+               bool non_temporal);
+
+// Stages up to |rows| rows of at most |row_size| bytes for writing into
+// a mapped buffer:
+//
+//   RowWriter writer(2, buf.width());
+//   uint8_t* y0 = writer.stage(0, buf.y_row(y));
+//   uint8_t* y1 = writer.stage(1, buf.y_row(y + 1));
+//   ... fill y0 and y1 ...
+//   writer.flush();
+//
+// With kDirect stage() just returns |dst|. Scratch rows start zeroed and
+// are not cleared between flushes, so bytes a kernel skips (e.g. RGBX
+// padding) are written as whatever they last held. Not thread safe; use
+// one per thread.
+class RowWriter {
+ public:
+  RowWriter(std::size_t rows,
+            std::size_t row_size,
+            WriteMode mode = write_mode());
+
+  RowWriter(const RowWriter&) = delete;
+  RowWriter& operator=(const RowWriter&) = delete;
+
+  // Buffer to build the |row_size| bytes bound for |dst| in. Row |index|
+  // replaces whatever was staged there since the last flush().
+  uint8_t* stage(std::size_t index, uint8_t* dst);
+
+  // Copy every staged row to its destination
+  void flush();
+
+  WriteMode mode() const { return mode_; }
+
+ private:
+  const WriteMode mode_;
+  const std::size_t row_size_;
+  const std::size_t stride_;
+  std::vector<uint8_t> storage_;
+  uint8_t* scratch_;
+  std::vector<uint8_t*> dst_;
+};
+
+// How bulk row reads come out of a mapped buffer. Loads from uncached
+// memory each wait on the bus, so reading it a byte or pixel at a time
+// is latency-bound.
+enum class ReadMode {
+  // Kernels load straight from the mapping
+  kDirect,
+  // Rows are copied to cached scratch memory in whole 64-byte lines
+  // first
+  kBuffered,
+  // As kBuffered, but with SSE4.1 streaming loads (MOVNTDQA), which fetch
+  // write-combined memory a line at a time. Falls back to kBuffered when
+  // simd_level() is below kSse41.
+  kStreaming,
+};
+
+// Mode RowReader uses by default. Defaults to kStreaming.
+ReadMode read_mode();
+
+void read_mode_set(ReadMode mode);
+
+const char* read_mode_name(ReadMode mode);
+
+// Copy |size| bytes from |src| to |dst|, reading every 64-byte line of
+// |src| that is wholly covered with consecutive 16-byte loads, streaming
+// ones if |streaming|.
+void row_fetch(uint8_t* dst,
+               const uint8_t* src,
+               std::size_t size,
+               bool streaming);
+
+// Bounce buffer of up to |rows| rows of at most |row_size| bytes for
+// reading from a mapped buffer:
+//
+//   RowReader reader(2, buf.width());
+//   const uint8_t* y = reader.fetch(0, buf.y_row(row));
+//   const uint8_t* uv = reader.fetch(1, buf.uv_row(row));
+//
+// With kDirect fetch() just returns |src|. Not thread safe; use one per
+// thread.
+class RowReader {
+ public:
+  RowReader(std::size_t rows,
+            std::size_t row_size,
+            ReadMode mode = read_mode());
+
+  RowReader(const RowReader&) = delete;
+  RowReader& operator=(const RowReader&) = delete;
+
+  // Copy of the |row_size| bytes at |src|, valid until the next fetch()
+  // into the same |index|
+  const uint8_t* fetch(std::size_t index, const uint8_t* src);
+
+  ReadMode mode() const { return mode_; }
+
+ private:
+  const ReadMode mode_;
+  const std::size_t rows_;
+  const std::size_t row_size_;
+  const std::size_t stride_;
+  std::vector<uint8_t> storage_;
+  uint8_t* scratch_;
+};
+}
+
+#endif  // STAGING_H_
@@ -0,0 +1,1013 @@
+// Copyright 2017 Neverware
+
+// Checks the claims the conversion kernels, image I/O and batch pipeline
+// document against the references they name:
+//
+//   vadem_test [--filter=SUBSTRING]
+//
+// Every SimdLevel the CPU supports is checked, at widths that leave each
+// vector loop a tail. Prints one line per test to stderr and exits
+// non-zero if any fails.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <va/va_drm.h>
+
+#include "src/batch.h"
+#include "src/color.h"
+#include "src/convert.h"
+#include "src/io.h"
+#include "src/nv12.h"
+#include "src/queue.h"
+#include "src/raw.h"
+#include "src/util.h"
+#include "src/va_util.h"
+#include "src/y4m.h"
+
+namespace vadem {
+
+namespace {
+
+// Only builds the message on failure, which matters to the exhaustive
+// checks
+#define EXPECT(ok, what)               \
+  do {                                 \
+    if (!(ok)) {                       \
+      throw std::runtime_error(what);  \
+    }                                  \
+  } while (0)
+
+std::string where(const std::string& name,
+                  const SimdLevel level,
+                  const std::size_t width,
+                  const std::size_t x) {
+  return name + " at " + simd_level_name(level) + ", width " +
+         std::to_string(width) + ", x " + std::to_string(x);
+}
+
+// Every level the running CPU supports, scalar first
+std::vector<SimdLevel> simd_levels() {
+  std::vector<SimdLevel> levels;
+  for (const SimdLevel level :
+       {SimdLevel::kScalar, SimdLevel::kSse41, SimdLevel::kAvx2}) {
+    if (level <= simd_level_detect()) {
+      levels.push_back(level);
+    }
+  }
+  return levels;
+}
+
+// Every even width up to past two 32-byte vectors of pixels, so each
+// kernel runs its tail at every length, plus a full HD row
+std::vector<std::size_t> test_widths() {
+  std::vector<std::size_t> widths;
+  for (std::size_t w = 2; w <= 70; w += 2) {
+    widths.push_back(w);
+  }
+  widths.push_back(1920);
+  return widths;
+}
+
+// Random samples, with the extremes over-represented since that is where
+// clamping happens
+template <typename T>
+std::vector<T> random_samples(std::mt19937& rng,
+                              const std::size_t count,
+                              const T max) {
+  std::uniform_int_distribution<unsigned> dist(0, max);
+  std::uniform_int_distribution<unsigned> pick(0, 7);
+  std::vector<T> samples(count);
+  for (T& sample : samples) {
+    switch (pick(rng)) {
+      case 0:
+        sample = 0;
+        break;
+      case 1:
+        sample = max;
+        break;
+      default:
+        sample = dist(rng);
+        break;
+    }
+  }
+  return samples;
+}
+
+template <typename Arithmetic>
+void test_rgb_rows_to_nv12(const std::string& name) {
+  using YCbCr = BasicYCbCr<Arithmetic>;
+  std::mt19937 rng(1);
+  for (const std::size_t w : test_widths()) {
+    const auto rgb0 = random_samples<uint8_t>(rng, w * 3, 255);
+    const auto rgb1 = random_samples<uint8_t>(rng, w * 3, 255);
+    for (const SimdLevel level : simd_levels()) {
+      simd_level_set(level);
+      for (const ChromaFilter filter :
+           {ChromaFilter::kSample, ChromaFilter::kBox}) {
+        std::vector<uint8_t> y0(w), y1(w), uv(w);
+        rgb_rows_to_nv12<Arithmetic>(rgb0.data(), rgb1.data(), w, y0.data(),
+                                     y1.data(), uv.data(), filter);
+        for (std::size_t x = 0; x < w; x++) {
+          const uint8_t* p = &rgb0[x * 3];
+          const uint8_t* q = &rgb1[x * 3];
+          EXPECT(y0[x] == static_cast<uint8_t>(
+                              YCbCr::from_rgb(p[0], p[1], p[2]).Y) &&
+                     y1[x] == static_cast<uint8_t>(
+                                  YCbCr::from_rgb(q[0], q[1], q[2]).Y),
+                 "luma of " + where(name, level, w, x));
+          if (x & 1) {
+            continue;
+          }
+          const YCbCr chroma =
+              (filter == ChromaFilter::kSample)
+                  ? YCbCr::from_rgb(q[3], q[4], q[5])
+                  : YCbCr::from_rgb(Arithmetic::mean(p[0], p[3], q[0], q[3]),
+                                    Arithmetic::mean(p[1], p[4], q[1], q[4]),
+                                    Arithmetic::mean(p[2], p[5], q[2], q[5]));
+          EXPECT(uv[x] == static_cast<uint8_t>(chroma.Cb) &&
+                     uv[x + 1] == static_cast<uint8_t>(chroma.Cr),
+                 std::string("chroma (") +
+                     (filter == ChromaFilter::kSample ? "sample" : "box") +
+                     ") of " + where(name, level, w, x));
+        }
+      }
+    }
+  }
+}
+
+// Every one of the 2^24 colours through rgb_rows_to_nv12() at every
+// level, a row of all green and blue values per red value. Chroma is
+// sampled (ChromaFilter::kSample) from every other pixel, so each row goes
+// through twice: once as it is, and once with the bottom row's pixels
+// swapped in pairs.
+void test_rgb_rows_to_nv12_all_colours() {
+  const std::size_t w = 256 * 256;
+  std::vector<uint8_t> row(w * 3), swapped(w * 3);
+  std::vector<YCbCr> expected(w);
+  std::vector<uint8_t> y0(w), y1(w), uv(w);
+  for (int red = 0; red < 256; red++) {
+    for (std::size_t x = 0; x < w; x++) {
+      const uint8_t pixel[3] = {static_cast<uint8_t>(red),
+                                static_cast<uint8_t>(x >> 8),
+                                static_cast<uint8_t>(x & 255)};
+      std::copy(pixel, pixel + 3, &row[x * 3]);
+      std::copy(pixel, pixel + 3, &swapped[(x ^ 1) * 3]);
+      expected[x] = YCbCr::from_rgb(pixel[0], pixel[1], pixel[2]);
+    }
+    for (const SimdLevel level : simd_levels()) {
+      simd_level_set(level);
+      rgb_rows_to_nv12(row.data(), row.data(), w, y0.data(), y1.data(),
+                       uv.data(), ChromaFilter::kSample);
+      for (std::size_t x = 0; x < w; x++) {
+        EXPECT(y0[x] == static_cast<uint8_t>(expected[x].Y),
+               "luma of red " + std::to_string(red) + " " +
+                   where("rgb_rows_to_nv12", level, w, x));
+        if (x & 1) {
+          EXPECT(uv[x - 1] == static_cast<uint8_t>(expected[x].Cb) &&
+                     uv[x] == static_cast<uint8_t>(expected[x].Cr),
+                 "chroma of red " + std::to_string(red) + " " +
+                     where("rgb_rows_to_nv12", level, w, x));
+        }
+      }
+      rgb_rows_to_nv12(row.data(), swapped.data(), w, y0.data(), y1.data(),
+                       uv.data(), ChromaFilter::kSample);
+      for (std::size_t x = 0; x < w; x += 2) {
+        EXPECT(uv[x] == static_cast<uint8_t>(expected[x].Cb) &&
+                   uv[x + 1] == static_cast<uint8_t>(expected[x].Cr),
+               "chroma of red " + std::to_string(red) + " " +
+                   where("rgb_rows_to_nv12", level, w, x));
+      }
+    }
+  }
+}
+
+template <typename Arithmetic>
+void test_nv12_row_to_rgb(const std::string& name) {
+  std::mt19937 rng(2);
+  for (const std::size_t w : test_widths()) {
+    const auto y = random_samples<uint8_t>(rng, w, 255);
+    const auto uv = random_samples<uint8_t>(rng, w, 255);
+    for (const SimdLevel level : simd_levels()) {
+      simd_level_set(level);
+      std::vector<uint8_t> rgb(w * 3);
+      nv12_row_to_rgb<Arithmetic>(y.data(), uv.data(), w, rgb.data());
+      for (std::size_t x = 0; x < w; x++) {
+        const std::size_t c = x & ~static_cast<std::size_t>(1);
+        const png::rgb_pixel expected =
+            BasicYCbCr<Arithmetic>(y[x], uv[c], uv[c + 1]).to_rgb();
+        EXPECT(rgb[x * 3] == expected.red &&
+                   rgb[x * 3 + 1] == expected.green &&
+                   rgb[x * 3 + 2] == expected.blue,
+               where(name, level, w, x));
+      }
+    }
+  }
+}
+
+void test_nv12_uv_split_merge() {
+  std::mt19937 rng(3);
+  for (std::size_t pairs = 0; pairs <= 70; pairs++) {
+    const auto uv = random_samples<uint8_t>(rng, pairs * 2, 255);
+    for (const SimdLevel level : simd_levels()) {
+      simd_level_set(level);
+      std::vector<uint8_t> u(pairs), v(pairs), merged(pairs * 2);
+      nv12_uv_split(uv.data(), pairs, u.data(), v.data());
+      for (std::size_t x = 0; x < pairs; x++) {
+        EXPECT(u[x] == uv[x * 2] && v[x] == uv[x * 2 + 1],
+               "split " + where("pair", level, pairs, x));
+      }
+      nv12_uv_merge(u.data(), v.data(), pairs, merged.data());
+      EXPECT(merged == uv, "merge " + where("pair", level, pairs, 0));
+    }
+  }
+}
+
+// Every level of the 16-bit kernels matches kScalar, whose values
+// test_p016_reference() checks
+template <typename Matrix>
+void test_rgb16_rows_to_p016(const std::string& name) {
+  std::mt19937 rng(4);
+  for (const std::size_t w : test_widths()) {
+    const auto rgb0 = random_samples<uint16_t>(rng, w * 3, 65535);
+    const auto rgb1 = random_samples<uint16_t>(rng, w * 3, 65535);
+    for (const unsigned bits : {10u, 12u, 16u}) {
+      for (const ChromaFilter filter :
+           {ChromaFilter::kSample, ChromaFilter::kBox}) {
+        std::vector<uint16_t> expected;
+        for (const SimdLevel level : simd_levels()) {
+          simd_level_set(level);
+          std::vector<uint16_t> out(w * 3);
+          rgb16_rows_to_p016<Matrix>(rgb0.data(), rgb1.data(), w, &out[0],
+                                     &out[w], &out[w * 2], bits, filter);
+          if (level == SimdLevel::kScalar) {
+            expected = out;
+            const uint16_t low = (1u << (16 - bits)) - 1;
+            for (std::size_t i = 0; i < out.size(); i++) {
+              EXPECT(!(out[i] & low),
+                     "low bits of " + std::to_string(bits) + "-bit " +
+                         where(name, level, w, i % w));
+            }
+            continue;
+          }
+          for (std::size_t i = 0; i < out.size(); i++) {
+            EXPECT(out[i] == expected[i],
+                   std::to_string(bits) + "-bit " +
+                       where(name, level, w, i % w));
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Matrix>
+void test_p016_row_to_rgb16(const std::string& name) {
+  std::mt19937 rng(5);
+  for (const std::size_t w : test_widths()) {
+    const auto y = random_samples<uint16_t>(rng, w, 65535);
+    const auto uv = random_samples<uint16_t>(rng, w, 65535);
+    std::vector<uint16_t> expected;
+    for (const SimdLevel level : simd_levels()) {
+      simd_level_set(level);
+      std::vector<uint16_t> rgb(w * 3);
+      p016_row_to_rgb16<Matrix>(y.data(), uv.data(), w, rgb.data());
+      if (level == SimdLevel::kScalar) {
+        expected = rgb;
+        continue;
+      }
+      for (std::size_t i = 0; i < rgb.size(); i++) {
+        EXPECT(rgb[i] == expected[i], where(name, level, w, i / 3));
+      }
+    }
+  }
+}
+
+// Largest difference the 16-bit kernels may have from ColorMatrix
+// applied in double precision, in 16-bit LSBs. Each coefficient is
+// rounded to 1/8192, off by up to 4 at full scale, so three terms can
+// be off by 12, and rounding the result adds one more.
+const double kP016Tolerance = 13;
+
+double clamp_65535(const double val) {
+  return clamp(val, 0.0, 65535.0);
+}
+
+// rgb16_rows_to_p016() and p016_row_to_rgb16() against ColorMatrix in
+// double precision, with the offsets scaled from 8 to 16 bits
+template <typename Matrix>
+void test_p016_reference(const std::string& name) {
+  constexpr ColorMatrix m = Matrix::coefficients();
+  const double y_offset = m.y_offset * 256;
+  const double c_offset = 32768;
+  std::mt19937 rng(12);
+  const std::size_t w = 1920;
+  const auto rgb0 = random_samples<uint16_t>(rng, w * 3, 65535);
+  const auto rgb1 = random_samples<uint16_t>(rng, w * 3, 65535);
+  const auto y = random_samples<uint16_t>(rng, w, 65535);
+  const auto uv = random_samples<uint16_t>(rng, w, 65535);
+  for (const SimdLevel level : simd_levels()) {
+    simd_level_set(level);
+    for (const ChromaFilter filter :
+         {ChromaFilter::kSample, ChromaFilter::kBox}) {
+      std::vector<uint16_t> out(w * 3);
+      rgb16_rows_to_p016<Matrix>(rgb0.data(), rgb1.data(), w, &out[0],
+                                 &out[w], &out[w * 2], 16, filter);
+      for (std::size_t x = 0; x < w; x++) {
+        for (const std::size_t row : {0, 1}) {
+          const uint16_t* px = (row ? rgb1 : rgb0).data() + x * 3;
+          const double luma = clamp_65535(m.y_r * px[0] + m.y_g * px[1] +
+                                          m.y_b * px[2] + y_offset);
+          EXPECT(std::fabs(out[row * w + x] - luma) <= kP016Tolerance,
+                 "luma " + where(name, level, w, x));
+        }
+        if (x & 1) {
+          continue;
+        }
+
+        // kSample takes the right pixel of the lower row, kBox the mean
+        // of all four
+        const uint16_t* p = rgb0.data() + x * 3;
+        const uint16_t* q = rgb1.data() + x * 3;
+        double rgb[3];
+        for (std::size_t c = 0; c < 3; c++) {
+          rgb[c] = (filter == ChromaFilter::kSample)
+                       ? q[3 + c]
+                       : (p[c] + p[3 + c] + q[c] + q[3 + c]) / 4.0;
+        }
+        const double cb = clamp_65535(m.cb_r * rgb[0] + m.cb_g * rgb[1] +
+                                      m.cb_b * rgb[2] + c_offset);
+        const double cr = clamp_65535(m.cr_r * rgb[0] + m.cr_g * rgb[1] +
+                                      m.cr_b * rgb[2] + c_offset);
+        EXPECT(std::fabs(out[w * 2 + x] - cb) <= kP016Tolerance &&
+                   std::fabs(out[w * 2 + x + 1] - cr) <= kP016Tolerance,
+               "chroma " + where(name, level, w, x));
+      }
+    }
+
+    std::vector<uint16_t> rgb(w * 3);
+    p016_row_to_rgb16<Matrix>(y.data(), uv.data(), w, rgb.data());
+    for (std::size_t x = 0; x < w; x++) {
+      const double luma = m.y_scale * (y[x] - y_offset);
+      const double cb = uv[x & ~1u] - c_offset;
+      const double cr = uv[x | 1u] - c_offset;
+      const double expected[] = {
+          clamp_65535(luma + m.r_cr * cr),
+          clamp_65535(luma + m.g_cr * cr + m.g_cb * cb),
+          clamp_65535(luma + m.b_cb * cb)};
+      for (std::size_t c = 0; c < 3; c++) {
+        EXPECT(std::fabs(rgb[x * 3 + c] - expected[c]) <= kP016Tolerance,
+               "RGB " + where(name, level, w, x));
+      }
+    }
+  }
+}
+
+int distance(const uint8_t a, const uint8_t b) {
+  return std::abs(static_cast<int>(a) - static_cast<int>(b));
+}
+
+// FixedPointArithmetic is documented to stay within 1 of FloatArithmetic
+// over every possible input
+template <typename Matrix>
+void test_fixed_point_error(const std::string& name) {
+  using Float = BasicYCbCr<FloatArithmetic<Matrix>>;
+  using Fixed = BasicYCbCr<FixedPointArithmetic<Matrix>>;
+  for (int a = 0; a < 256; a++) {
+    for (int b = 0; b < 256; b++) {
+      for (int c = 0; c < 256; c++) {
+        const Float f = Float::from_rgb(a, b, c);
+        const Fixed i = Fixed::from_rgb(a, b, c);
+        EXPECT(distance(f.Y, i.Y) <= 1 && distance(f.Cb, i.Cb) <= 1 &&
+                   distance(f.Cr, i.Cr) <= 1,
+               name + " from RGB " + std::to_string(a) + "," +
+                   std::to_string(b) + "," + std::to_string(c));
+
+        const png::rgb_pixel f_rgb = Float(a, b, c).to_rgb();
+        const png::rgb_pixel i_rgb = Fixed(a, b, c).to_rgb();
+        EXPECT(distance(f_rgb.red, i_rgb.red) <= 1 &&
+                   distance(f_rgb.green, i_rgb.green) <= 1 &&
+                   distance(f_rgb.blue, i_rgb.blue) <= 1,
+               name + " to RGB from YCbCr " + std::to_string(a) + "," +
+                   std::to_string(b) + "," + std::to_string(c));
+      }
+    }
+  }
+}
+
+// The software VA backend's display, initialized on first use
+VADisplay test_display() {
+  static VADisplay display = [] {
+    VADisplay display = vaGetDisplayDRM(-1);
+    int major = 0;
+    int minor = 0;
+    check_status(vaInitialize(display, &major, &minor));
+    return display;
+  }();
+  return display;
+}
+
+// Destroys an image when it goes out of scope
+class ScopedImage {
+ public:
+  explicit ScopedImage(const VAImage& image) : image(image) {}
+
+  ~ScopedImage() { va_image_destroy(test_display(), image); }
+
+  ScopedImage(const ScopedImage&) = delete;
+  ScopedImage& operator=(const ScopedImage&) = delete;
+
+  const VAImage& operator*() const { return image; }
+
+ private:
+  const VAImage image;
+};
+
+VAImage random_nv12_image(std::mt19937& rng,
+                          const int width,
+                          const int height) {
+  const VAImage image = va_image_create_nv12(test_display(), width, height);
+  Nv12Buffer buf(test_display(), image);
+  for (std::size_t y = 0; y < buf.height(); y++) {
+    const auto luma = random_samples<uint8_t>(rng, width, 255);
+    std::copy(luma.begin(), luma.end(), buf.y_row(y));
+    if (!(y & 1)) {
+      const auto chroma = random_samples<uint8_t>(rng, width, 255);
+      std::copy(chroma.begin(), chroma.end(), buf.uv_row(y));
+    }
+  }
+  return image;
+}
+
+std::string temp_file() {
+  std::string filename =
+      std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") +
+      "/vadem_test_XXXXXX";
+  const int fd = mkstemp(&filename[0]);
+  EXPECT(fd != -1, "mkstemp() failed");
+  close(fd);
+  return filename;
+}
+
+std::string read_file(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+// Every 4:2:0 source packs to the same frame in each layout, and sources
+// that can't be packed leave the output file alone
+void test_va_image_dump() {
+  std::mt19937 rng(6);
+  const int w = 70;
+  const int h = 34;
+  const ScopedImage nv12(random_nv12_image(rng, w, h));
+  const ScopedImage i420(va_image_create_i420(test_display(), w, h));
+  const ScopedImage yv12(va_image_create_yv12(test_display(), w, h));
+  va_image_yuv420_copy(test_display(), *nv12, *i420);
+  va_image_yuv420_copy(test_display(), *nv12, *yv12);
+
+  const std::string filename = temp_file();
+  for (const uint32_t layout :
+       {VA_FOURCC_NV12, VA_FOURCC_I420, VA_FOURCC_YV12}) {
+    std::string expected(raw_frame_size(w, h), '\0');
+    va_image_pack_planes(test_display(), *nv12, layout,
+                         reinterpret_cast<uint8_t*>(&expected[0]));
+    for (const VAImage* src : {&*nv12, &*i420, &*yv12}) {
+      va_image_dump(test_display(), *src, filename, layout);
+      EXPECT(read_file(filename) == expected,
+             "dump of " + hex_str(src->format.fourcc) + " as " +
+                 hex_str(layout));
+    }
+  }
+
+  std::ofstream(filename, std::ios::binary) << "kept";
+  const ScopedImage rgbx(va_image_create_rgb(test_display(), w, h));
+  bool threw = false;
+  try {
+    va_image_dump(test_display(), *rgbx, filename);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  const std::string kept = read_file(filename);
+  unlink(filename.c_str());
+  EXPECT(threw, "dump of RGBX didn't throw");
+  EXPECT(kept == "kept", "dump of RGBX truncated the file");
+}
+
+// The planar layouts convert to the same PNG as the NV12 image they were
+// copied from, and fourccs with no RGB conversion are rejected, by
+// va_image_save() before the file is touched
+void test_va_image_copy_to_png() {
+  std::mt19937 rng(7);
+  const int w = 70;
+  const int h = 34;
+  const ScopedImage nv12(random_nv12_image(rng, w, h));
+  const ScopedImage i420(va_image_create_i420(test_display(), w, h));
+  const ScopedImage yv12(va_image_create_yv12(test_display(), w, h));
+  va_image_yuv420_copy(test_display(), *nv12, *i420);
+  va_image_yuv420_copy(test_display(), *nv12, *yv12);
+
+  const SolidRgbImage expected = va_image_copy_to_png(test_display(), *nv12);
+  const std::string filename = temp_file();
+  va_image_save(test_display(), *nv12, filename);
+  const std::string expected_file = read_file(filename);
+  for (const VAImage* src : {&*i420, &*yv12}) {
+    const SolidRgbImage png = va_image_copy_to_png(test_display(), *src);
+    EXPECT(png.get_pixbuf().get_bytes() == expected.get_pixbuf().get_bytes(),
+           "copy of " + hex_str(src->format.fourcc));
+    va_image_save(test_display(), *src, filename);
+    EXPECT(read_file(filename) == expected_file,
+           "save of " + hex_str(src->format.fourcc));
+  }
+
+  VAImage unsupported = VAImage();
+  unsupported.format.fourcc = VA_FOURCC_YUY2;
+  std::ofstream(filename, std::ios::binary) << "kept";
+  bool copy_threw = false;
+  bool save_threw = false;
+  try {
+    va_image_copy_to_png(test_display(), unsupported);
+  } catch (const std::runtime_error&) {
+    copy_threw = true;
+  }
+  try {
+    va_image_save(test_display(), unsupported, filename);
+  } catch (const std::runtime_error&) {
+    save_threw = true;
+  }
+  const std::string kept = read_file(filename);
+  unlink(filename.c_str());
+  EXPECT(copy_threw, "copy of YUY2 didn't throw");
+  EXPECT(save_threw, "save of YUY2 didn't throw");
+  EXPECT(kept == "kept", "save of YUY2 truncated the file");
+}
+
+// P010 and P016 images save as the 16-bit PNG va_image_p016_copy_to_png()
+// makes of them, and the copy into a reused image matches a new one
+void test_va_image_p016_copy_to_png() {
+  std::mt19937 rng(8);
+  const int w = 70;
+  const int h = 34;
+  SolidRgb16Image rgb16(w, h);
+  for (int y = 0; y < h; y++) {
+    const auto row = random_samples<uint16_t>(rng, w * 3, 65535);
+    std::copy(row.begin(), row.end(), &rgb16.get_row(y)[0].red);
+  }
+
+  const std::string filename = temp_file();
+  SolidRgb16Image reused(2, 2);
+  for (const uint32_t fourcc : {VA_FOURCC_P010, VA_FOURCC_P016}) {
+    const ScopedImage image((fourcc == VA_FOURCC_P010)
+                                ? va_image_create_p010(test_display(), w, h)
+                                : va_image_create_p016(test_display(), w, h));
+    va_image_p016_copy_from_png(test_display(), *image, rgb16);
+    const SolidRgb16Image expected =
+        va_image_p016_copy_to_png<Bt709Full>(test_display(), *image);
+
+    va_image_p016_copy_to_png<Bt709Full>(test_display(), *image, reused);
+    EXPECT(reused.get_pixbuf().get_bytes() == expected.get_pixbuf().get_bytes(),
+           "copy of " + hex_str(fourcc) + " into a reused image");
+
+    va_image_save<FixedPointArithmetic<Bt709Full>>(test_display(), *image,
+                                                   filename);
+    const SolidRgb16Image saved(filename);
+    EXPECT(saved.get_pixbuf().get_bytes() == expected.get_pixbuf().get_bytes(),
+           "save of " + hex_str(fourcc));
+  }
+  unlink(filename.c_str());
+}
+
+// |image|'s pixels in the NV12 layout, without padding
+std::string packed_nv12(const VAImage& image) {
+  std::string packed(raw_frame_size(image.width, image.height), '\0');
+  va_image_pack_planes(test_display(), image, VA_FOURCC_NV12,
+                       reinterpret_cast<uint8_t*>(&packed[0]));
+  return packed;
+}
+
+// Every 4:2:0 fourcc takes the same pixels from a PNG as NV12 does, or
+// as va_image_p016_copy_from_png() does for the 16-bit ones, and fourccs
+// with no conversion are rejected
+void test_va_image_copy_from_png() {
+  std::mt19937 rng(11);
+  const int w = 70;
+  const int h = 34;
+  SolidRgbImage rgb(w, h);
+  for (int y = 0; y < h; y++) {
+    const auto row = random_samples<uint8_t>(rng, w * 3, 255);
+    std::copy(row.begin(), row.end(), &rgb.get_row(y)[0].red);
+  }
+
+  const ScopedImage nv12(va_image_create_nv12(test_display(), w, h));
+  va_image_copy_from_png(test_display(), *nv12, rgb);
+  const std::string expected = packed_nv12(*nv12);
+  for (const uint32_t fourcc : {VA_FOURCC_I420, VA_FOURCC_YV12}) {
+    const ScopedImage image((fourcc == VA_FOURCC_I420)
+                                ? va_image_create_i420(test_display(), w, h)
+                                : va_image_create_yv12(test_display(), w, h));
+    va_image_copy_from_png(test_display(), *image, rgb);
+    EXPECT(packed_nv12(*image) == expected, "copy to " + hex_str(fourcc));
+  }
+
+  const SolidRgb16Image rgb16 = png_widen_to_16_bit(rgb);
+  for (const uint32_t fourcc : {VA_FOURCC_P010, VA_FOURCC_P016}) {
+    const ScopedImage image((fourcc == VA_FOURCC_P010)
+                                ? va_image_create_p010(test_display(), w, h)
+                                : va_image_create_p016(test_display(), w, h));
+    va_image_p016_copy_from_png<Bt709Full>(test_display(), *image, rgb16);
+    const SolidRgb16Image expected16 =
+        va_image_p016_copy_to_png<Bt709Full>(test_display(), *image);
+    va_image_copy_from_png<FloatArithmetic<Bt709Full>>(test_display(), *image,
+                                                       rgb);
+    const SolidRgb16Image png =
+        va_image_p016_copy_to_png<Bt709Full>(test_display(), *image);
+    EXPECT(png.get_pixbuf().get_bytes() == expected16.get_pixbuf().get_bytes(),
+           "copy to " + hex_str(fourcc));
+  }
+
+  VAImage unsupported = VAImage();
+  unsupported.format.fourcc = VA_FOURCC_YUY2;
+  bool threw = false;
+  try {
+    va_image_copy_from_png(test_display(), unsupported, rgb);
+  } catch (const std::runtime_error&) {
+    threw = true;
+  }
+  EXPECT(threw, "copy to YUY2 didn't throw");
+}
+
+// Whether constructing a Y4mReader on |contents| throws
+bool y4m_rejects(const std::string& filename, const std::string& contents) {
+  std::ofstream(filename, std::ios::binary) << contents;
+  try {
+    Y4mReader reader(filename);
+    const ScopedImage image(
+        va_image_create_nv12(test_display(), reader.width(), reader.height()));
+    while (reader.read(test_display(), *image)) {
+    }
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+// Frames written by Y4mWriter read back unchanged, with the header's
+// size, rate and chroma siting; headers from elsewhere parse in any
+// order; and malformed streams are rejected
+void test_y4m() {
+  std::mt19937 rng(10);
+  const int w = 70;
+  const int h = 34;
+  const std::string filename = temp_file();
+
+  std::vector<std::string> frames;
+  {
+    Y4mWriter writer(filename, w, h, 25, 2, ChromaFilter::kSample);
+    for (int i = 0; i < 3; i++) {
+      const ScopedImage image(random_nv12_image(rng, w, h));
+      writer.write(test_display(), *image);
+      frames.push_back(packed_nv12(*image));
+    }
+    writer.close();
+    EXPECT(writer.frames() == frames.size(), "frames written");
+  }
+  const std::string header = "YUV4MPEG2 W70 H34 F25:2 Ip A1:1 C420\n";
+  EXPECT(read_file(filename).compare(0, header.size(), header) == 0,
+         "header of a kSample stream");
+  {
+    Y4mReader reader(filename);
+    EXPECT(reader.width() == w && reader.height() == h &&
+               reader.fps_num() == 25 && reader.fps_den() == 2 &&
+               reader.chroma() == "420",
+           "header read back");
+    const ScopedImage image(va_image_create_nv12(test_display(), w, h));
+    for (std::size_t i = 0; i < frames.size(); i++) {
+      EXPECT(reader.read(test_display(), *image) &&
+                 packed_nv12(*image) == frames[i],
+             "frame " + std::to_string(i) + " read back");
+    }
+    EXPECT(!reader.read(test_display(), *image) &&
+               reader.frames() == frames.size(),
+           "end of stream");
+  }
+
+  {
+    Y4mWriter writer(filename, w, h);
+    writer.close();
+  }
+  EXPECT(read_file(filename).find(" C420jpeg\n") != std::string::npos,
+         "header of a kBox stream");
+
+  // Parameters in another order, no rate, a frame with parameters and
+  // an extension the reader skips. Y4M chroma is planar, NV12's isn't.
+  const std::string frame = "YYYYYYYYUUVV";
+  std::ofstream(filename, std::ios::binary)
+      << "YUV4MPEG2 H2 C420mpeg2 W4 XYSCSS=420MPEG2\nFRAME Ip\n" << frame;
+  {
+    Y4mReader reader(filename);
+    EXPECT(reader.width() == 4 && reader.height() == 2 &&
+               reader.fps_num() == 0 && reader.fps_den() == 0 &&
+               reader.chroma() == "420mpeg2",
+           "hand-written header");
+    const ScopedImage image(va_image_create_nv12(test_display(), 4, 2));
+    EXPECT(reader.read(test_display(), *image), "hand-written frame");
+    EXPECT(packed_nv12(*image) == "YYYYYYYYUVUV",
+           "hand-written frame's planes");
+    EXPECT(!reader.read(test_display(), *image), "end of hand-written stream");
+  }
+
+  const bool not_y4m = y4m_rejects(filename, "P5 4 2 255\n");
+  const bool chroma_422 = y4m_rejects(filename, "YUV4MPEG2 W4 H2 C422\n");
+  const bool odd_size = y4m_rejects(filename, "YUV4MPEG2 W3 H2\n");
+  const bool truncated =
+      y4m_rejects(filename, "YUV4MPEG2 W4 H2\nFRAME\n" + frame.substr(1));
+  unlink(filename.c_str());
+  EXPECT(not_y4m, "non-Y4M file accepted");
+  EXPECT(chroma_422, "4:2:2 stream accepted");
+  EXPECT(odd_size, "odd frame size accepted");
+  EXPECT(truncated, "truncated frame accepted");
+}
+
+// Frames dumped in each layout load back unchanged, frames past the
+// first of a file are found by index, and odd sizes are rejected before
+// any file is touched
+void test_raw() {
+  std::mt19937 rng(11);
+  const int w = 70;
+  const int h = 34;
+  const std::string filename = temp_file();
+  for (const uint32_t layout :
+       {VA_FOURCC_NV12, VA_FOURCC_I420, VA_FOURCC_YV12}) {
+    const ScopedImage src(random_nv12_image(rng, w, h));
+    va_image_dump(test_display(), *src, filename, layout);
+    const ScopedImage loaded(
+        va_image_nv12_load_raw(test_display(), filename, w, h, layout));
+    EXPECT(packed_nv12(*loaded) == packed_nv12(*src),
+           "round trip as " + hex_str(layout));
+  }
+
+  std::string frames;
+  std::vector<std::string> expected;
+  for (int i = 0; i < 3; i++) {
+    const ScopedImage src(random_nv12_image(rng, w, h));
+    std::string frame(raw_frame_size(w, h), '\0');
+    va_image_pack_planes(test_display(), *src, VA_FOURCC_I420,
+                         reinterpret_cast<uint8_t*>(&frame[0]));
+    frames += frame;
+    expected.push_back(packed_nv12(*src));
+  }
+  std::ofstream(filename, std::ios::binary) << frames;
+  const ScopedImage dst(va_image_create_nv12(test_display(), w, h));
+  for (std::size_t i = 0; i < expected.size(); i++) {
+    va_image_load_raw(test_display(), *dst, filename, VA_FOURCC_I420, i);
+    EXPECT(packed_nv12(*dst) == expected[i],
+           "frame " + std::to_string(i) + " of " +
+               std::to_string(expected.size()));
+  }
+  bool past_end_threw = false;
+  try {
+    va_image_load_raw(test_display(), *dst, filename, VA_FOURCC_I420,
+                      expected.size());
+  } catch (const std::runtime_error&) {
+    past_end_threw = true;
+  }
+  EXPECT(past_end_threw, "load past the last frame didn't throw");
+
+  std::ofstream(filename, std::ios::binary) << "kept";
+  const ScopedImage odd(va_image_create_nv12(test_display(), w - 1, h));
+  bool dump_threw = false;
+  bool load_threw = false;
+  try {
+    va_image_dump(test_display(), *odd, filename);
+  } catch (const std::runtime_error&) {
+    dump_threw = true;
+  }
+  try {
+    const VAImage image =
+        va_image_nv12_load_raw(test_display(), filename, w, h - 1);
+    va_image_destroy(test_display(), image);
+  } catch (const std::runtime_error&) {
+    load_threw = true;
+  }
+  const std::string kept = read_file(filename);
+  unlink(filename.c_str());
+  EXPECT(dump_threw, "dump of an odd width didn't throw");
+  EXPECT(load_threw, "load of an odd height didn't throw");
+  EXPECT(kept == "kept", "dump of an odd width truncated the file");
+}
+
+// Every item pushed by several producers is popped exactly once by
+// several consumers, and after close() pop() drains what's left and then
+// returns false
+void test_bounded_queue() {
+  const int producers = 4;
+  const int consumers = 3;
+  const int per_producer = 20000;
+  BoundedQueue<int> queue(8);
+  std::vector<std::vector<int>> popped(consumers);
+  std::vector<std::thread> consumer_threads;
+  for (int i = 0; i < consumers; i++) {
+    consumer_threads.emplace_back([&queue, &popped, i] {
+      int value;
+      while (queue.pop(&value)) {
+        popped[i].push_back(value);
+      }
+    });
+  }
+  std::vector<std::thread> producer_threads;
+  for (int i = 0; i < producers; i++) {
+    producer_threads.emplace_back([&queue, i] {
+      for (int j = 0; j < per_producer; j++) {
+        queue.push(i * per_producer + j);
+      }
+    });
+  }
+  for (std::thread& thread : producer_threads) {
+    thread.join();
+  }
+  queue.close();
+  for (std::thread& thread : consumer_threads) {
+    thread.join();
+  }
+
+  std::vector<int> times_popped(producers * per_producer);
+  for (const std::vector<int>& values : popped) {
+    for (const int value : values) {
+      EXPECT(value >= 0 && value < producers * per_producer,
+             "popped " + std::to_string(value) + ", which wasn't pushed");
+      times_popped[value]++;
+    }
+  }
+  for (std::size_t value = 0; value < times_popped.size(); value++) {
+    EXPECT(times_popped[value] == 1,
+           std::to_string(value) + " popped " +
+               std::to_string(times_popped[value]) + " times");
+  }
+
+  BoundedQueue<int> closed(4);
+  for (int i = 0; i < 3; i++) {
+    closed.push(i);
+  }
+  closed.close();
+  for (int i = 0; i < 3; i++) {
+    int value = -1;
+    EXPECT(closed.pop(&value) && value == i,
+           "pop " + std::to_string(i) + " after close()");
+  }
+  int value;
+  EXPECT(!closed.pop(&value), "pop from a closed, empty queue");
+}
+
+// batch_run() round-trips every good input to what the conversions make
+// of it on their own, and drops an undecodable one without stopping the
+// rest
+void test_batch_run() {
+  std::string dir =
+      std::string(getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp") +
+      "/vadem_test_XXXXXX";
+  EXPECT(mkdtemp(&dir[0]), "mkdtemp() failed");
+
+  std::mt19937 rng(9);
+  const std::vector<std::string> names = {"a.png", "b.png", "c.png"};
+  std::vector<SolidRgbImage> expected;
+  for (const std::string& name : names) {
+    const int w = 34;
+    const int h = 18;
+    SolidRgbImage rgb(w, h);
+    for (int y = 0; y < h; y++) {
+      const auto row = random_samples<uint8_t>(rng, w * 3, 255);
+      std::copy(row.begin(), row.end(), &rgb.get_row(y)[0].red);
+    }
+    rgb.write(dir + "/" + name);
+    const ScopedImage nv12(va_image_create_nv12(test_display(), w, h));
+    va_image_copy_from_png(test_display(), *nv12, rgb);
+    expected.push_back(va_image_copy_to_png(test_display(), *nv12));
+  }
+  std::ofstream(dir + "/broken.png", std::ios::binary) << "not a PNG";
+
+  BatchOptions options = batch_default_options();
+  options.inputs = batch_list_inputs(dir);
+  options.output_dir = dir + "/out";
+  const BatchStats stats = batch_run(test_display(), options);
+
+  const BatchStageStats& decode =
+      stats.stages[static_cast<int>(BatchStage::kDecode)];
+  const BatchStageStats& encode =
+      stats.stages[static_cast<int>(BatchStage::kEncode)];
+  EXPECT(decode.frames == names.size() && decode.errors == 1,
+         "decode passed on " + std::to_string(decode.frames) +
+             " frames with " + std::to_string(decode.errors) + " errors");
+  EXPECT(encode.frames == names.size() && encode.errors == 0,
+         "encode passed on " + std::to_string(encode.frames) +
+             " frames with " + std::to_string(encode.errors) + " errors");
+  for (std::size_t i = 0; i < names.size(); i++) {
+    const std::string output = options.output_dir + "/" + names[i];
+    const SolidRgbImage png(output);
+    EXPECT(png.get_pixbuf().get_bytes() == expected[i].get_pixbuf().get_bytes(),
+           "output " + names[i]);
+    unlink(output.c_str());
+    unlink((dir + "/" + names[i]).c_str());
+  }
+  const bool broken_written =
+      access((options.output_dir + "/broken.png").c_str(), F_OK) == 0;
+  unlink((dir + "/broken.png").c_str());
+  rmdir(options.output_dir.c_str());
+  rmdir(dir.c_str());
+  EXPECT(!broken_written, "broken.png was written");
+}
+
+struct Test {
+  std::string name;
+  std::function<void()> run;
+};
+
+std::vector<Test> all_tests() {
+  std::vector<Test> tests;
+#define ADD_ARITHMETIC_TESTS(Arithmetic)                               \
+  tests.push_back({"rgb_rows_to_nv12<" #Arithmetic ">", [] {           \
+                     test_rgb_rows_to_nv12<Arithmetic>(#Arithmetic);   \
+                   }});                                                \
+  tests.push_back({"nv12_row_to_rgb<" #Arithmetic ">", [] {            \
+                     test_nv12_row_to_rgb<Arithmetic>(#Arithmetic);    \
+                   }});
+  VADEM_FOR_EACH_ARITHMETIC(ADD_ARITHMETIC_TESTS)
+#undef ADD_ARITHMETIC_TESTS
+  tests.push_back(
+      {"rgb_rows_to_nv12_all_colours", test_rgb_rows_to_nv12_all_colours});
+
+  tests.push_back({"nv12_uv_split_merge", test_nv12_uv_split_merge});
+
+#define ADD_MATRIX_TESTS(Matrix)                                      \
+  tests.push_back({"rgb16_rows_to_p016<" #Matrix ">",                 \
+                   [] { test_rgb16_rows_to_p016<Matrix>(#Matrix); }}); \
+  tests.push_back({"p016_row_to_rgb16<" #Matrix ">",                  \
+                   [] { test_p016_row_to_rgb16<Matrix>(#Matrix); }}); \
+  tests.push_back({"fixed_point_error<" #Matrix ">",                  \
+                   [] { test_fixed_point_error<Matrix>(#Matrix); }}); \
+  tests.push_back({"p016_reference<" #Matrix ">",                     \
+                   [] { test_p016_reference<Matrix>(#Matrix); }});
+  VADEM_FOR_EACH_MATRIX(ADD_MATRIX_TESTS)
+#undef ADD_MATRIX_TESTS
+
+  tests.push_back({"va_image_dump", test_va_image_dump});
+  tests.push_back({"va_image_copy_to_png", test_va_image_copy_to_png});
+  tests.push_back(
+      {"va_image_p016_copy_to_png", test_va_image_p016_copy_to_png});
+  tests.push_back({"va_image_copy_from_png", test_va_image_copy_from_png});
+  tests.push_back({"raw", test_raw});
+  tests.push_back({"y4m", test_y4m});
+  tests.push_back({"bounded_queue", test_bounded_queue});
+  tests.push_back({"batch_run", test_batch_run});
+  return tests;
+}
+}
+}
+
+int main(int argc, char** argv) {
+  using namespace vadem;
+
+  std::string filter;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    std::string value;
+    if (parse_flag(arg, "filter", &value)) {
+      filter = value;
+    } else {
+      std::cerr << "unknown argument: " << arg << std::endl;
+      return 2;
+    }
+  }
+
+  // va_image_dump() and va_image_save() log every call
+  std::cout.setstate(std::ios::failbit);
+
+  int failures = 0;
+  for (const Test& test : all_tests()) {
+    if (test.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    try {
+      test.run();
+      std::cerr << "ok      " << test.name << std::endl;
+    } catch (const std::exception& e) {
+      std::cerr << "FAILED  " << test.name << ": " << e.what() << std::endl;
+      failures++;
+    }
+    simd_level_set(simd_level_detect());
+  }
+  return failures ? 1 : 0;
+}
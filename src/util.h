@@ -4,6 +4,8 @@
 #define UTIL_H_
 
 #include <sstream>
+#include <stdexcept>
+#include <string>
 
 namespace vadem {
 
@@ -21,6 +23,18 @@ void assert_equal(const A& a, const B& b) {
   }
 }
 
+// If |arg| is --|name|=VALUE, store VALUE in |value|
+inline bool parse_flag(const std::string& arg,
+                       const std::string& name,
+                       std::string* value) {
+  const std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
 template <typename T, typename L, typename H>
 T clamp(const T val, const L min, const H max) {
   if (val < min) {
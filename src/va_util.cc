@@ -1,7 +1,9 @@
 // Copyright 2017 Neverware
 
+#include <cstring>
 #include <stdexcept>
 
+#include "map_cache.h"
 #include "nv12.h"
 #include "util.h"
 #include "va_util.h"
@@ -14,32 +16,18 @@ void check_status(const VAStatus status) {
   }
 }
 
-std::size_t va_image_check_offset(const VAImage& image,
-                                  const std::size_t offset) {
-  if (offset >= image.data_size) {
-    throw std::runtime_error("image offset out of bounds: " +
-                             std::to_string(offset) + " >= " +
-                             std::to_string(image.data_size));
-  }
-  return offset;
-}
-
-void va_image_set_u8(const VAImage& image,
-                     uint8_t* const mem,
-                     const std::size_t offset,
-                     const uint8_t val) {
-  va_image_check_offset(image, offset);
-  mem[offset] = val;
+void va_image_throw_out_of_bounds(const VAImage& image,
+                                  const std::size_t offset,
+                                  const std::size_t size) {
+  throw std::runtime_error("image offset out of bounds: " +
+                           std::to_string(offset) + " + " +
+                           std::to_string(size) + " > " +
+                           std::to_string(image.data_size));
 }
 
-uint8_t va_image_get_u8(const VAImage& image,
-                        uint8_t* const mem,
-                        const std::size_t offset) {
-  va_image_check_offset(image, offset);
-  return mem[offset];
-}
-
-VAImage va_image_create_rgb(VADisplay display, const int width, const int height) {
+VAImage va_image_create_rgb(VADisplay display,
+                            const int width,
+                            const int height) {
   VAImageFormat image_format{
       .fourcc = VA_FOURCC_RGBX,
       .byte_order = VA_LSB_FIRST,
@@ -56,11 +44,17 @@ VAImage va_image_create_rgb(VADisplay display, const int width, const int height
   return image;
 }
 
-VAImage va_image_create_nv12(VADisplay display, const int width, const int height) {
+// 4:2:0 image of |fourcc|: NV12, I420 or YV12 at 12 bits per pixel, or
+// P010 or P016 at 24
+static VAImage va_image_create_yuv420(VADisplay display,
+                                      const uint32_t fourcc,
+                                      const int width,
+                                      const int height,
+                                      const uint32_t bits_per_pixel = 12) {
   VAImageFormat image_format{
-      .fourcc = VA_FOURCC_NV12,
+      .fourcc = fourcc,
       .byte_order = VA_LSB_FIRST,
-      .bits_per_pixel = 12,
+      .bits_per_pixel = bits_per_pixel,
       // These are only for RGB
       .depth = 0,
       .red_mask = 0,
@@ -74,37 +68,80 @@ VAImage va_image_create_nv12(VADisplay display, const int width, const int heigh
   return image;
 }
 
+VAImage va_image_create_nv12(VADisplay display,
+                             const int width,
+                             const int height) {
+  return va_image_create_yuv420(display, VA_FOURCC_NV12, width, height);
+}
+
+VAImage va_image_create_i420(VADisplay display,
+                             const int width,
+                             const int height) {
+  return va_image_create_yuv420(display, VA_FOURCC_I420, width, height);
+}
+
+VAImage va_image_create_yv12(VADisplay display,
+                             const int width,
+                             const int height) {
+  return va_image_create_yuv420(display, VA_FOURCC_YV12, width, height);
+}
+
+VAImage va_image_create_p010(VADisplay display,
+                             const int width,
+                             const int height) {
+  return va_image_create_yuv420(display, VA_FOURCC_P010, width, height, 24);
+}
+
+VAImage va_image_create_p016(VADisplay display,
+                             const int width,
+                             const int height) {
+  return va_image_create_yuv420(display, VA_FOURCC_P016, width, height, 24);
+}
+
+unsigned int va_surface_rt_format(const uint32_t fourcc) {
+  switch (fourcc) {
+    case VA_FOURCC_NV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_YV12:
+      return VA_RT_FORMAT_YUV420;
+    case VA_FOURCC_P010:
+      return VA_RT_FORMAT_YUV420_10;
+    case VA_FOURCC_P016:
+#ifdef VA_RT_FORMAT_YUV420_12
+      return VA_RT_FORMAT_YUV420_12;
+#else
+      // Older libva has no 12-bit format; 16-bit samples hold 10 as well
+      return VA_RT_FORMAT_YUV420_10;
+#endif
+    case VA_FOURCC_RGBX:
+      return VA_RT_FORMAT_RGB32;
+  }
+  throw std::runtime_error("no surface format for fourcc " + hex_str(fourcc));
+}
+
+void va_image_destroy(VADisplay display, const VAImage& image) {
+  buffer_map_invalidate(display, image.buf);
+  check_status(vaDestroyImage(display, image.image_id));
+}
+
 VAImage va_image_nv12_gen_CbCr_gradient(VADisplay display, const float Y) {
   const std::size_t w = 512;
   const std::size_t half_w = w / 2;
   const VAImage image = va_image_create_nv12(display, w, w);
   Nv12Buffer buf(display, image);
 
-  std::size_t offset = 0;
-
   for (std::size_t y = 0; y < w; y++) {
-    for (std::size_t x = 0; x < w; x++) {
-      buf.set_u8(y * w + x, Y);
-      offset++;
-    }
+    memset(buf.y_row(y), Y, w);
   }
 
-  const std::size_t plane2 = w * w;
   for (std::size_t y = 0; y < half_w; y++) {
+    uint8_t* const uv = buf.uv_row(y * 2);
     for (std::size_t x = 0; x < half_w; x++) {
-      const std::size_t Cb = (y * half_w + x) * 2;
-      const std::size_t Cr = Cb + 1;
-      buf.set_u8(plane2 + Cb, x);
-      buf.set_u8(offset, x);
-      offset++;
-      buf.set_u8(plane2 + Cr, y);
-      buf.set_u8(offset, y);
-      offset++;
+      uv[x * 2] = x;
+      uv[x * 2 + 1] = y;
     }
   }
 
-  assert_equal(offset, image.data_size);
-
   return image;
 }
 
@@ -115,10 +152,11 @@ VAImage va_image_nv12_gen_Y_gradient(VADisplay display) {
   buf.fill_u8(128);
 
   for (std::size_t y = 0; y < w; y++) {
+    uint8_t* const row = buf.y_row(y);
     for (std::size_t x = 0; x < w; x++) {
       const auto fx = (x * 1.0) / w;
       const auto fy = (y * 1.0) / w;
-      buf.set_u8(y * w + x, fx * fy * 256);
+      row[x] = fx * fy * 256;
     }
   }
 
@@ -3,28 +3,109 @@
 #ifndef VA_UTIL_H_
 #define VA_UTIL_H_
 
+#include <cstddef>
+#include <cstdint>
+
 #include <va/va.h>
 
+// Missing from older libva headers
+#ifndef VA_FOURCC_P016
+#define VA_FOURCC_P016 0x36313050
+#endif
+
 namespace vadem {
 
 void check_status(VAStatus status);
 
-std::size_t va_image_check_offset(const VAImage& image,
-                                  std::size_t offset);
+// Throws for an access of |size| bytes at |offset| that doesn't fit in
+// |image|. Kept out of line so the checks below stay small enough to
+// inline.
+[[noreturn]] void va_image_throw_out_of_bounds(const VAImage& image,
+                                               std::size_t offset,
+                                               std::size_t size);
 
-void va_image_set_u8(const VAImage& image,
-                     uint8_t* mem,
-                     std::size_t offset,
-                     uint8_t val);
+inline std::size_t va_image_check_offset(const VAImage& image,
+                                         const std::size_t offset) {
+  if (offset >= image.data_size) {
+    va_image_throw_out_of_bounds(image, offset, 1);
+  }
+  return offset;
+}
+
+// Check that the |size| bytes starting at |offset| are all in |image|,
+// e.g. a whole row before handing it to an unchecked loop.
+inline std::size_t va_image_check_range(const VAImage& image,
+                                        const std::size_t offset,
+                                        const std::size_t size) {
+  if (offset > image.data_size || size > image.data_size - offset) {
+    va_image_throw_out_of_bounds(image, offset, size);
+  }
+  return offset;
+}
 
-uint8_t va_image_get_u8(const VAImage& image,
-                        uint8_t* mem,
-                        std::size_t offset);
+// Bounds-checking policies for single-byte image access. Row accessors
+// such as Nv12Buffer::y_row() validate the whole row regardless of
+// policy; the policy only decides whether every byte is checked too.
+struct CheckedAccess {
+  static std::size_t check(const VAImage& image, const std::size_t offset) {
+    return va_image_check_offset(image, offset);
+  }
+};
+
+struct UncheckedAccess {
+  static std::size_t check(const VAImage& /*image*/,
+                           const std::size_t offset) {
+    return offset;
+  }
+};
+
+// Check every byte in debug builds only
+#ifdef NDEBUG
+using DefaultAccess = UncheckedAccess;
+#else
+using DefaultAccess = CheckedAccess;
+#endif
+
+template <typename Access = DefaultAccess>
+inline void va_image_set_u8(const VAImage& image,
+                            uint8_t* const mem,
+                            const std::size_t offset,
+                            const uint8_t val) {
+  mem[Access::check(image, offset)] = val;
+}
+
+template <typename Access = DefaultAccess>
+inline uint8_t va_image_get_u8(const VAImage& image,
+                               const uint8_t* const mem,
+                               const std::size_t offset) {
+  return mem[Access::check(image, offset)];
+}
 
 VAImage va_image_create_rgb(VADisplay display, int width, int height);
 
 VAImage va_image_create_nv12(VADisplay display, int width, int height);
 
+// Planar 4:2:0 images: Y, Cb and Cr planes for I420, and Y, Cr and Cb
+// for YV12. See I420Buffer.
+VAImage va_image_create_i420(VADisplay display, int width, int height);
+
+VAImage va_image_create_yv12(VADisplay display, int width, int height);
+
+// 16-bit 4:2:0 images: a Y plane and an interleaved CbCr plane of
+// little-endian uint16_t samples, the top 10 bits significant for P010
+// and all 16 for P016. See P016Buffer.
+VAImage va_image_create_p010(VADisplay display, int width, int height);
+
+VAImage va_image_create_p016(VADisplay display, int width, int height);
+
+// vaCreateSurfaces() format for surfaces holding |fourcc|: NV12, I420,
+// YV12, P010, P016 or RGBX
+unsigned int va_surface_rt_format(uint32_t fourcc);
+
+// vaDestroyImage(), dropping any cached mapping of the image's buffer
+// first
+void va_image_destroy(VADisplay display, const VAImage& image);
+
 VAImage va_image_nv12_gen_CbCr_gradient(VADisplay display, float Y);
 
 VAImage va_image_nv12_gen_Y_gradient(VADisplay display);
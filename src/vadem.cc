@@ -1,6 +1,15 @@
 // Copyright 2017 Neverware
 
+// Without arguments, runs the demo on data/color_bus_buddy_256_square.png.
+// With --batch, round-trips every PNG in a directory or file list through
+// the GPU instead, see batch.h:
+//
+//   vadem --batch=DIR_OR_LIST [--output=DIR] [--queue-size=N]
+//         [--decode-workers=N] [--convert-workers=N] [--upload-workers=N]
+//         [--readback-workers=N] [--encode-workers=N]
+
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 
@@ -9,21 +18,62 @@
 #include <va/va.h>
 #include <va/va_drm.h>
 
+#include "batch.h"
 #include "color.h"
+#include "dmabuf.h"
 #include "io.h"
+#include "map_cache.h"
 #include "nv12.h"
 #include "png.hpp"
+#include "pool.h"
+#include "raw.h"
 #include "util.h"
+#include "y4m.h"
 
 using namespace vadem;
 
-int main() {
+int main(int argc, char** argv) {
+  std::string batch_path;
+  BatchOptions batch_options = batch_default_options();
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    std::string value;
+    bool known = false;
+    if (parse_flag(arg, "batch", &value)) {
+      batch_path = value;
+      known = true;
+    } else if (parse_flag(arg, "output", &value)) {
+      batch_options.output_dir = value;
+      known = true;
+    } else if (parse_flag(arg, "queue-size", &value)) {
+      batch_options.queue_capacity = strtoul(value.c_str(), nullptr, 10);
+      known = true;
+    }
+    for (std::size_t stage = 0; stage < kBatchStageCount; stage++) {
+      const std::string name =
+          batch_stage_name(static_cast<BatchStage>(stage));
+      if (parse_flag(arg, name + "-workers", &value)) {
+        batch_options.workers[stage] = strtoul(value.c_str(), nullptr, 10);
+        known = true;
+      }
+    }
+    if (!known) {
+      std::cerr << "unknown argument: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+#ifdef VADEM_SOFT_VA
+  // No device behind the software backend
+  const int fd = -1;
+#else
   const char* device_path = "/dev/dri/renderD128";
   const int fd = open(device_path, 0);
   if (fd == -1) {
     std::cerr << "failed to open " << device_path << std::endl;
     return 1;
   }
+#endif
 
   VADisplay display = vaGetDisplayDRM(fd);
 
@@ -34,39 +84,91 @@ int main() {
   std::cout << "libva initialized, version " << major << "." << minor
             << std::endl;
 
-  // Load test image
+  if (!batch_path.empty()) {
+    batch_options.inputs = batch_list_inputs(batch_path);
+    std::cout << "processing " << batch_options.inputs.size() << " files from "
+              << batch_path << std::endl;
+    const BatchStats stats = batch_run(display, batch_options);
+    batch_print_stats(std::cout, stats);
+    check_status(vaTerminate(display));
+    return 0;
+  }
+
   const std::string& input_path = "data/color_bus_buddy_256_square.png";
-  std::cout << "loading test image: " << input_path << std::endl;
-  png::image<png::rgb_pixel> input_png(input_path);
-  const auto width = input_png.get_width();
-  const auto height = input_png.get_height();
-
-  const auto gradient_image = va_image_nv12_gen_CbCr_gradient(display, 128);
-  // const auto gradient_image = va_image_nv12_gen_Y_gradient();
-  va_image_save(display, gradient_image, "gradient.png");
-  va_image_dump(display, gradient_image, "gradient.raw");
-
-  // Copy test image into a new VAImage
-  VAImage input_image = va_image_create_nv12(display, width, height);
-  va_image_nv12_copy_from_png(display, input_image, input_png);
-
-  // Sanity check: copy the original image back out to a new PNG file
-  va_image_save(display, input_image, "input.png");
-
-  // Create an empty surface
-  const unsigned int surface_format = VA_RT_FORMAT_RGB32;
-  VASurfaceID surface_id = 0;
-  check_status(vaCreateSurfaces(display, surface_format, width, height,
-                                &surface_id, 1, nullptr, 0));
-
-  // Copy the test image into the surface
-  check_status(vaPutImage(display, surface_id, input_image.image_id, 0, 0,
-                          width, height, 0, 0, width, height));
-
-  // Write the surface's image back out to a new PNG file
-  VAImage surf_image;
-  check_status(vaDeriveImage(display, surface_id, &surf_image));
-  va_image_save(display, surf_image, "output.png");
+
+  {
+    // Keeps each image mapped between the saves and dumps below. Declared
+    // first so that it outlives the pool and its leases.
+    BufferMapCache map_cache(display);
+
+    const auto gradient_image =
+        va_image_nv12_gen_CbCr_gradient(display, 128);
+    // const auto gradient_image = va_image_nv12_gen_Y_gradient();
+    va_image_save(display, gradient_image, "gradient.png");
+    va_image_dump(display, gradient_image, "gradient.raw");
+    {
+      Y4mWriter writer("gradient.y4m", gradient_image.width,
+                       gradient_image.height);
+      writer.write(display, gradient_image);
+      writer.close();
+    }
+
+    va_image_destroy(display, gradient_image);
+
+    // Recycles images and surfaces across frames of the same size. The
+    // leases below must be released before it's destroyed.
+    VaPool pool(display, 256 << 20);
+
+    // Load test image
+    std::cout << "loading test image: " << input_path << std::endl;
+    const SolidRgbImage input(input_path);
+    const auto width = input.get_width();
+    const auto height = input.get_height();
+
+    // Convert it straight into an NV12 surface if the driver lets us map
+    // the surface, or through an image and vaPutImage() if not
+    const SurfaceLease surface =
+        pool.acquire_surface(VA_FOURCC_NV12, width, height);
+    const UploadPath path = va_surface_copy_from_png(pool, *surface, input);
+    std::cout << "uploaded test image via " << upload_path_name(path)
+              << std::endl;
+
+    // Sanity check: copy the surface back out to a new PNG file, as is
+    // and converted to RGBX by the driver
+    for (const uint32_t fourcc : {VA_FOURCC_NV12, VA_FOURCC_RGBX}) {
+      const ImageLease image = pool.acquire_image(fourcc, width, height);
+      buffer_map_invalidate(display, image->buf);
+      check_status(vaGetImage(display, surface->id, 0, 0, width, height,
+                              image->image_id));
+      va_image_save(display, *image,
+                    (fourcc == VA_FOURCC_NV12) ? "input.png" : "output.png");
+    }
+
+    // Share the surface as a DMA-BUF, as for another process, and read
+    // the frame back through the imported surface
+    const DmaBuf dmabuf = va_surface_export_dmabuf(display, surface->id);
+    VASurfaceID imported = va_surface_import_dmabuf(display, dmabuf);
+    {
+      const ImageLease image =
+          pool.acquire_image(VA_FOURCC_RGBX, width, height);
+      buffer_map_invalidate(display, image->buf);
+      check_status(vaGetImage(display, imported, 0, 0, width, height,
+                              image->image_id));
+      va_image_save(display, *image, "dmabuf.png");
+    }
+    check_status(vaDestroySurfaces(display, &imported, 1));
+
+    // The same frame at 10 bits: widen the input, convert it into a
+    // P010 image and back
+    {
+      const ImageLease image =
+          pool.acquire_image(VA_FOURCC_P010, width, height);
+      va_image_p016_copy_from_png(display, *image,
+                                  png_widen_to_16_bit(input));
+      va_image_save<FloatArithmetic<Bt2020Limited>>(display, *image,
+                                                    "p010.png");
+    }
+  }
 
   check_status(vaTerminate(display));
 
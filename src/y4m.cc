@@ -0,0 +1,230 @@
+// Copyright 2017 Neverware
+
+#include "src/y4m.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "src/raw.h"
+
+namespace vadem {
+
+namespace {
+
+const char kStreamMagic[] = "YUV4MPEG2";
+const char kFrameMagic[] = "FRAME";
+
+// Longest header line accepted, parameters included
+const std::size_t kMaxHeaderLine = 1024;
+
+std::runtime_error y4m_error(const std::string& filename,
+                             const std::string& message) {
+  return std::runtime_error(filename + ": " + message);
+}
+
+void check_size(const std::string& filename,
+                const int width,
+                const int height) {
+  if (width <= 0 || height <= 0 || width % 2 || height % 2) {
+    throw y4m_error(filename, "unsupported frame size " +
+                                  std::to_string(width) + "x" +
+                                  std::to_string(height));
+  }
+}
+
+// Read one header line without its newline. Returns false if the stream
+// ended before any of it.
+bool read_line(FILE* file, const std::string& filename, std::string* line) {
+  line->clear();
+  int c;
+  while ((c = getc(file)) != '\n') {
+    if (c == EOF) {
+      if (line->empty()) {
+        return false;
+      }
+      throw y4m_error(filename, "truncated header");
+    }
+    if (line->size() == kMaxHeaderLine) {
+      throw y4m_error(filename, "header too long");
+    }
+    line->push_back(c);
+  }
+  return true;
+}
+
+}  // namespace
+
+const char* y4m_chroma_tag(const ChromaFilter filter) {
+  switch (filter) {
+    case ChromaFilter::kSample:
+      return "420";
+    case ChromaFilter::kBox:
+      return "420jpeg";
+  }
+  return "420";
+}
+
+Y4mWriter::Y4mWriter(const std::string& filename,
+                     const int width,
+                     const int height,
+                     const int fps_num,
+                     const int fps_den,
+                     const ChromaFilter filter)
+    : filename(filename),
+      width(width),
+      height(height),
+      file(nullptr),
+      count(0) {
+  check_size(filename, width, height);
+
+  file = fopen(filename.c_str(), "wb");
+  if (!file) {
+    throw y4m_error(filename, strerror(errno));
+  }
+
+  std::ostringstream header;
+  header << kStreamMagic << " W" << width << " H" << height << " F" << fps_num
+         << ":" << fps_den << " Ip A1:1 C" << y4m_chroma_tag(filter) << "\n";
+  const std::string line = header.str();
+  if (fwrite(line.data(), 1, line.size(), file) != line.size()) {
+    fclose(file);
+    throw y4m_error(filename, "write failed");
+  }
+
+  const std::size_t magic = sizeof(kFrameMagic) - 1;
+  frame.resize(magic + 1 + raw_frame_size(this->width, this->height));
+  memcpy(frame.data(), kFrameMagic, magic);
+  frame[magic] = '\n';
+}
+
+Y4mWriter::~Y4mWriter() {
+  if (file) {
+    fclose(file);
+  }
+}
+
+void Y4mWriter::write(VADisplay display, const VAImage& src) {
+  if (!file) {
+    throw y4m_error(filename, "write after close");
+  }
+  if (src.width != static_cast<int>(width) ||
+      src.height != static_cast<int>(height)) {
+    throw y4m_error(filename, "frame size doesn't match the stream");
+  }
+  va_image_pack_planes(display, src, VA_FOURCC_I420,
+                       frame.data() + sizeof(kFrameMagic));
+
+  if (fwrite(frame.data(), 1, frame.size(), file) != frame.size()) {
+    throw y4m_error(filename, "write failed");
+  }
+  count++;
+}
+
+void Y4mWriter::close() {
+  if (!file) {
+    return;
+  }
+  FILE* const closing = file;
+  file = nullptr;
+  if (fclose(closing) != 0) {
+    throw y4m_error(filename, std::string("close failed: ") + strerror(errno));
+  }
+}
+
+Y4mReader::Y4mReader(const std::string& filename)
+    : filename(filename),
+      file(fopen(filename.c_str(), "rb")),
+      w(0),
+      h(0),
+      rate_num(0),
+      rate_den(0),
+      chroma_tag("420jpeg"),
+      count(0) {
+  if (!file) {
+    throw y4m_error(filename, strerror(errno));
+  }
+
+  try {
+    // Checked before reading the rest of the line, so other files fail
+    // here rather than on their first newline
+    char magic[sizeof(kStreamMagic)] = {};
+    if (fread(magic, 1, sizeof(magic) - 1, file) != sizeof(magic) - 1 ||
+        strcmp(magic, kStreamMagic) != 0) {
+      throw y4m_error(filename, "not a YUV4MPEG2 stream");
+    }
+
+    std::string line;
+    if (!read_line(file, filename, &line)) {
+      throw y4m_error(filename, "truncated header");
+    }
+
+    std::istringstream header(line);
+    std::string token;
+
+    // The 4:2:0 sitings only differ in where chroma samples sit, not how
+    // many there are, so all of them are read the same way
+    while (header >> token) {
+      const std::string value = token.substr(1);
+      switch (token[0]) {
+        case 'W':
+          w = atoi(value.c_str());
+          break;
+        case 'H':
+          h = atoi(value.c_str());
+          break;
+        case 'F':
+          if (sscanf(value.c_str(), "%d:%d", &rate_num, &rate_den) != 2) {
+            throw y4m_error(filename, "bad frame rate " + value);
+          }
+          break;
+        case 'C':
+          chroma_tag = value;
+          break;
+        default:
+          // Interlacing, aspect ratio and extensions don't change the
+          // frame layout
+          break;
+      }
+    }
+
+    if (chroma_tag.compare(0, 3, "420") != 0) {
+      throw y4m_error(filename, "unsupported chroma " + chroma_tag);
+    }
+    check_size(filename, w, h);
+  } catch (...) {
+    fclose(file);
+    throw;
+  }
+
+  frame.resize(raw_frame_size(w, h));
+}
+
+Y4mReader::~Y4mReader() {
+  fclose(file);
+}
+
+bool Y4mReader::read(VADisplay display, const VAImage& dst) {
+  std::string line;
+  if (!read_line(file, filename, &line)) {
+    return false;
+  }
+  if (line.compare(0, sizeof(kFrameMagic) - 1, kFrameMagic) != 0) {
+    throw y4m_error(filename, "bad frame header in frame " +
+                                  std::to_string(count));
+  }
+  if (fread(frame.data(), 1, frame.size(), file) != frame.size()) {
+    throw y4m_error(filename, "truncated frame " + std::to_string(count));
+  }
+
+  if (dst.width != w || dst.height != h) {
+    throw y4m_error(filename, "image size doesn't match the stream");
+  }
+  va_image_unpack_planes(display, dst, VA_FOURCC_I420, frame.data());
+
+  count++;
+  return true;
+}
+}
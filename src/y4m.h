@@ -0,0 +1,129 @@
+// Copyright 2017 Neverware
+
+#ifndef Y4M_H_
+#define Y4M_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <va/va.h>
+
+#include "src/convert.h"
+
+namespace vadem {
+
+// YUV4MPEG2 streams of 4:2:0 frames, which ffmpeg, ffplay, mpv and most
+// encoders read and write directly:
+//
+//   ffplay frames.y4m
+//   ffmpeg -i frames.y4m -c:v libx264 frames.mp4
+//
+// Each frame is stored as its full Y plane followed by its Cb and Cr
+// planes, so NV12's interleaved chroma is split on the way out and
+// merged on the way in; nothing goes through RGB. Frames are staged in
+// one cached buffer and moved with a single fwrite() or fread() each, so
+// the file is opened once however many frames pass through it.
+
+// Appends NV12 images to a new Y4M file
+//
+//   Y4mWriter writer("frames.y4m", 1920, 1080);
+//   for (...) {
+//     writer.write(display, image);
+//   }
+//   writer.close();
+class Y4mWriter {
+ public:
+  // Frame rate is |fps_num| / |fps_den| frames per second. The header's
+  // chroma siting is the one |filter| decimates to, see y4m_chroma_tag().
+  // Throws if |filename| can't be created or the size isn't even.
+  Y4mWriter(const std::string& filename,
+            int width,
+            int height,
+            int fps_num = 30,
+            int fps_den = 1,
+            ChromaFilter filter = ChromaFilter::kBox);
+
+  // Closes the file if close() wasn't called, ignoring errors
+  ~Y4mWriter();
+
+  Y4mWriter(const Y4mWriter&) = delete;
+  Y4mWriter& operator=(const Y4mWriter&) = delete;
+
+  // Append |src|, an NV12 image of the stream's size. Throws once closed.
+  void write(VADisplay display, const VAImage& src);
+
+  // Close the file, throwing if the buffered frames can't be written out
+  void close();
+
+  std::size_t frames() const { return count; }
+
+ private:
+  const std::string filename;
+  const std::size_t width, height;
+  FILE* file;
+  // "FRAME\n" and the three planes, packed
+  std::vector<uint8_t> frame;
+  std::size_t count;
+};
+
+// Chroma tag, without its C, for 4:2:0 frames decimated with |filter|:
+// "420jpeg", chroma centred in each 2x2 block, for kBox. kSample takes
+// each block's bottom-right pixel, which no Y4M siting describes, so it
+// gets the bare "420".
+const char* y4m_chroma_tag(ChromaFilter filter);
+
+// Reads the frames of a 4:2:0 Y4M file into NV12 images
+//
+//   Y4mReader reader("frames.y4m");
+//   VAImage image = va_image_create_nv12(display, reader.width(),
+//                                        reader.height());
+//   while (reader.read(display, image)) {
+//     ...
+//   }
+class Y4mReader {
+ public:
+  // Reads the stream header. Throws if |filename| can't be opened, isn't
+  // a Y4M file, or its chroma isn't 4:2:0 with an even frame size.
+  explicit Y4mReader(const std::string& filename);
+
+  ~Y4mReader();
+
+  Y4mReader(const Y4mReader&) = delete;
+  Y4mReader& operator=(const Y4mReader&) = delete;
+
+  // Read the next frame into |dst|, an NV12 image of the stream's size.
+  // Returns false at the end of the stream, and throws on a truncated or
+  // malformed frame.
+  bool read(VADisplay display, const VAImage& dst);
+
+  int width() const { return w; }
+
+  int height() const { return h; }
+
+  // Frame rate as given in the header, 0:0 if it gives none
+  int fps_num() const { return rate_num; }
+
+  int fps_den() const { return rate_den; }
+
+  // Chroma tag as given in the header, without its C, e.g. "420mpeg2".
+  // "420jpeg" if it gives none.
+  const std::string& chroma() const { return chroma_tag; }
+
+  std::size_t frames() const { return count; }
+
+ private:
+  const std::string filename;
+  FILE* file;
+  int w, h;
+  int rate_num, rate_den;
+  std::string chroma_tag;
+  // The three planes, packed
+  std::vector<uint8_t> frame;
+  std::size_t count;
+};
+}
+
+#endif  // Y4M_H_